@@ -0,0 +1,98 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "post_script.h"
+#include "bytecode.h"
+#include "jit.h"
+#include "utils.h"
+
+#define SAMPLES 1000000     /* Samples per timed evaluation */
+#define ROUNDS 5            /* Timed evaluations; the fastest one counts */
+
+/* Expressions from cheap arithmetic to libm-bound */
+static const char *expressions[] = {
+    "x*x*x - 2*x + 1",
+    "(x+1)*(x-1)/(x*x+2) + 3*x",
+    "((((x+1)*x+2)*x+3)*x+4)*x+5",
+    "|x| - x/3 + 1/(x-0.5)",
+    "x^3 - x^2",
+    "sin(x)*x",
+    "exp(-x*x)*cos(3*x)",
+    "ln(x) + log(x)",
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Fastest of ROUNDS evaluations, in nanoseconds per sample */
+static double time_program(const Program *program, const double *xs, double *ys) {
+    double best = 0.0;
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now();
+        evaluate_program_batch(program, xs, ys, SAMPLES);
+        double elapsed = now() - start;
+        if (round == 0 || elapsed < best) best = elapsed;
+    }
+    return best * 1e9 / SAMPLES;
+}
+
+int main(void) {
+    double *xs = (double*)malloc(SAMPLES * sizeof(double));
+    double *interpreted = (double*)malloc(SAMPLES * sizeof(double));
+    double *native = (double*)malloc(SAMPLES * sizeof(double));
+    int status = 0;
+
+    if (xs == NULL || interpreted == NULL || native == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+    if (!jit_supported()) {
+        printf("Native code is not supported on this machine; nothing to compare.\n");
+        return 0;
+    }
+    for (size_t i = 0; i < SAMPLES; i++) xs[i] = -10.0 + 20.0 * i / (SAMPLES - 1);
+
+    printf("%-32s %14s %14s %8s\n", "expression", "interp ns/x", "jit ns/x", "speedup");
+    for (size_t e = 0; e < sizeof(expressions) / sizeof(expressions[0]); e++) {
+        ExprTree *tree;
+        ParseError error;
+
+        int parsed = parse_text(expressions[e], strlen(expressions[e]), &tree, &error);
+        if (parsed == PARSE_NO_MEMORY) return 1;
+        if (parsed != PARSE_OK) {
+            fprintf(stderr, "Error: %s at offset %zu in \"%s\".\n", error.message, error.position, expressions[e]);
+            return 2;
+        }
+        Program *program = compile_expression(tree, -10.0, 10.0);
+        free_tree(tree);
+        if (program == NULL) return 1;
+
+        double interpreter_time = time_program(program, xs, interpreted);
+        jit_compile_program(program);
+        double jit_time = time_program(program, xs, native);
+
+        /* Both backends must agree bit for bit, any NaN matching any NaN */
+        for (size_t i = 0; i < SAMPLES; i++) {
+            if (memcmp(&interpreted[i], &native[i], sizeof(double)) != 0 &&
+                !(is_nan(interpreted[i]) && is_nan(native[i]))) {
+                fprintf(stderr, "Mismatch for \"%s\" at x = %.17g: %.17g != %.17g\n",
+                        expressions[e], xs[i], interpreted[i], native[i]);
+                status = 1;
+                break;
+            }
+        }
+        printf("%-32s %14.2f %14.2f %7.2fx\n", expressions[e], interpreter_time, jit_time, interpreter_time / jit_time);
+
+        free_program(program);
+    }
+
+    free(xs);
+    free(interpreted);
+    free(native);
+    return status;
+}
@@ -0,0 +1,354 @@
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "post_script.h"
+#include "parser.h"
+#include "bytecode.h"
+#include "polyline.h"
+#include "sampler.h"
+
+#define MIN_SECONDS 0.2         /* Each phase repeats until it has run this long */
+#define EVAL_SAMPLES 100000     /* Samples per timed batch evaluation */
+#define WORK_BUDGET 200000000.0 /* Instructions per sampling pass; huge programs get fewer samples */
+#define GENERATED_SUM_BYTES (512 * 1024)
+#define GENERATED_DEPTH 100000
+#define GENERATED_TERMS 2000
+
+/* Throughput of every phase for one expression */
+typedef struct {
+    const char *name;
+    size_t bytes;               /* Length of the expression text */
+    size_t nodes;               /* Nodes of the parsed tree */
+    size_t instructions;        /* Length of the compiled program */
+    double validate_rate;       /* Bytes of text per second */
+    double parse_rate;          /* Bytes of text per second */
+    double compile_seconds;     /* Simplification and compilation */
+    double evaluate_rate;       /* Samples per second */
+    size_t plot_samples;        /* Samples drawn by plot_graph() */
+    size_t ps_bytes;            /* PostScript written by plot_graph() */
+    double plot_rate;           /* PostScript bytes per second */
+} PhaseResult;
+
+typedef enum { REPORT_TABLE, REPORT_CSV, REPORT_JSON } ReportFormat;
+
+/* Data shared by the timed phases of one expression */
+typedef struct {
+    const char *text;
+    size_t length;
+    const Program *program;
+    const double *xs;
+    double *ys;
+    size_t samples;
+    const SampleBuffer *plot;
+    double x_min, x_max, y_min, y_max;
+    size_t ps_bytes;
+} PhaseInput;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Runs a phase until MIN_SECONDS have passed; returns the runs per second */
+static double repeat_phase(int (*phase)(PhaseInput*), PhaseInput *input) {
+    size_t runs = 0;
+    double start = now(), elapsed;
+    do {
+        if (!phase(input)) return 0.0;
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_SECONDS);
+    return runs / elapsed;
+}
+
+static int validate_phase(PhaseInput *input) {
+    ParseError error;
+    return validate_expression(input->text, &error);
+}
+
+static int parse_phase(PhaseInput *input) {
+    ExprTree *tree;
+    ParseError error;
+    int status = parse_text(input->text, input->length, &tree, &error);
+    free_tree(tree);
+    return status == PARSE_OK;
+}
+
+static int evaluate_phase(PhaseInput *input) {
+    evaluate_program_batch(input->program, input->xs, input->ys, input->samples);
+    return 1;
+}
+
+/* Draws the sampled graph into memory, like the page body of a render */
+static int plot_phase(PhaseInput *input) {
+    PsBuffer buffer = { NULL, 0, 0 };
+    PsWriter *writer = (PsWriter*)malloc(sizeof(PsWriter));
+    PolylineSimplifier path;
+
+    if (writer == NULL) return 0;
+    ps_init(writer, ps_buffer_sink, &buffer);
+    polyline_init(&path, writer, 0.0);
+    plot_graph(&path, input->plot, input->x_min, input->x_max, input->y_min, input->y_max, NULL);
+    int ok = ps_flush(writer);
+    input->ps_bytes = buffer.length;
+    free(buffer.data);
+    free(writer);
+    return ok;
+}
+
+/* Deterministic pseudo-random numbers, so generated inputs match across runs */
+static unsigned long next_random(unsigned long *state) {
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return *state >> 33;
+}
+
+/* A long sum of mixed terms, like a machine-generated fit */
+static char* generate_sum(void) {
+    static const char *terms[] = { "x", "sin(x)", "0.5", "|x-1|", "(x+2)", "x^2", "cos(x/3)" };
+    static const char operators[] = "+-*";
+    char *text = (char*)malloc(GENERATED_SUM_BYTES + 32);
+    unsigned long state = 1;
+    size_t length = 0;
+
+    if (text == NULL) return NULL;
+    length += sprintf(text, "x");
+    while (length < GENERATED_SUM_BYTES) {
+        length += sprintf(text + length, " %c %s", operators[next_random(&state) % 3],
+                          terms[next_random(&state) % (sizeof(terms) / sizeof(terms[0]))]);
+    }
+    return text;
+}
+
+/* x wrapped in GENERATED_DEPTH parenthesized additions */
+static char* generate_nesting(void) {
+    char *text = (char*)malloc(GENERATED_DEPTH * 4 + 2);
+    if (text == NULL) return NULL;
+    memset(text, '(', GENERATED_DEPTH);
+    text[GENERATED_DEPTH] = 'x';
+    for (size_t i = 0; i < GENERATED_DEPTH; i++) memcpy(text + GENERATED_DEPTH + 1 + 3 * i, "+1)", 3);
+    text[GENERATED_DEPTH * 4 + 1] = '\0';
+    return text;
+}
+
+/* A fitted series with long decimal coefficients; the grammar has no exponent notation */
+static char* generate_series(void) {
+    char *text = (char*)malloc(GENERATED_TERMS * 48 + 8);
+    unsigned long state = 2;
+    size_t length = 0;
+
+    if (text == NULL) return NULL;
+    length += sprintf(text, "1");
+    for (int k = 1; k <= GENERATED_TERMS; k++) {
+        double coefficient = (double)(next_random(&state) % 2000001) / 1e6 - 1.0;
+        length += sprintf(text + length, " + %.15f*(x/10)^%d", coefficient, k % 40);
+    }
+    return text;
+}
+
+/*
+ * Times every phase for one expression. Returns 0 on success, 1 if memory
+ * allocation failed, 2 if the expression is invalid.
+ */
+static int run_expression(const char *name, const char *text, PhaseResult *result) {
+    PhaseInput input;
+    ExprTree *tree;
+    ParseError error;
+    RenderOptions options;
+
+    memset(result, 0, sizeof(PhaseResult));
+    memset(&input, 0, sizeof(PhaseInput));
+    result->name = name;
+    result->bytes = strlen(text);
+    input.text = text;
+    input.length = result->bytes;
+
+    int status = parse_text(text, input.length, &tree, &error);
+    if (status != PARSE_OK) {
+        if (status == PARSE_INVALID) {
+            fprintf(stderr, "Error: %s: %s at offset %zu.\n", name, error.message, error.position);
+        }
+        return status == PARSE_INVALID ? 2 : 1;
+    }
+    result->nodes = tree->count;
+    result->validate_rate = repeat_phase(validate_phase, &input) * input.length;
+    result->parse_rate = repeat_phase(parse_phase, &input) * input.length;
+
+    double start = now();
+    Program *program = compile_expression(tree, -10.0, 10.0);
+    result->compile_seconds = now() - start;
+    free_tree(tree);
+    if (program == NULL) return 1;
+    result->instructions = program->length;
+
+    /* Keep a sampling pass within the budget for huge programs */
+    init_render_options(&options);
+    double affordable = WORK_BUDGET / (double)program->length;
+    size_t plot_samples = (size_t)PLOT_SIZE * options.oversampling + 1;
+    if (affordable < plot_samples) plot_samples = affordable > PLOT_SIZE + 1 ? (size_t)affordable : PLOT_SIZE + 1;
+    input.samples = affordable < EVAL_SAMPLES ? (affordable > 1000 ? (size_t)affordable : 1000) : EVAL_SAMPLES;
+
+    double *xs = (double*)malloc(input.samples * sizeof(double));
+    double *ys = (double*)malloc(input.samples * sizeof(double));
+    SampleBuffer *samples = sample_program(program, -10.0, 10.0, plot_samples, 1);
+    if (xs == NULL || ys == NULL || samples == NULL) {
+        free(xs);
+        free(ys);
+        free_samples(samples);
+        free_program(program);
+        return 1;
+    }
+    for (size_t i = 0; i < input.samples; i++) xs[i] = -10.0 + 20.0 * i / (input.samples - 1);
+    input.program = program;
+    input.xs = xs;
+    input.ys = ys;
+    result->evaluate_rate = repeat_phase(evaluate_phase, &input) * input.samples;
+
+    /* The default page: the x range as given and y fixed to [-10, 10] */
+    input.plot = samples;
+    input.x_min = -10.0;
+    input.x_max = 10.0;
+    input.y_min = -10.0;
+    input.y_max = 10.0;
+    calculate_ranges(samples, &input.x_min, &input.x_max, &input.y_min, &input.y_max, 1, 1);
+    double plots = repeat_phase(plot_phase, &input);
+    result->plot_samples = plot_samples;
+    result->ps_bytes = input.ps_bytes;
+    result->plot_rate = plots * input.ps_bytes;
+
+    free(xs);
+    free(ys);
+    free_samples(samples);
+    free_program(program);
+    return plots > 0.0 ? 0 : 1;
+}
+
+static void print_header(FILE *out, ReportFormat format) {
+    if (format == REPORT_CSV) {
+        fprintf(out, "name,bytes,nodes,instructions,validate_bytes_per_s,parse_bytes_per_s,"
+                     "compile_s,evaluate_samples_per_s,plot_samples,ps_bytes,plot_bytes_per_s\n");
+    } else if (format == REPORT_JSON) {
+        fprintf(out, "[\n");
+    } else {
+        fprintf(out, "%-18s %9s %8s %12s %12s %10s %12s %10s %12s\n", "expression", "bytes", "nodes",
+                "valid MB/s", "parse MB/s", "comp ms", "eval Ms/s", "ps bytes", "plot MB/s");
+    }
+}
+
+static void print_result(FILE *out, ReportFormat format, const PhaseResult *r, int first) {
+    if (format == REPORT_CSV) {
+        fprintf(out, "%s,%zu,%zu,%zu,%.6g,%.6g,%.6g,%.6g,%zu,%zu,%.6g\n", r->name, r->bytes, r->nodes,
+                r->instructions, r->validate_rate, r->parse_rate, r->compile_seconds, r->evaluate_rate,
+                r->plot_samples, r->ps_bytes, r->plot_rate);
+    } else if (format == REPORT_JSON) {
+        fprintf(out, "%s  {\"name\": \"%s\", \"bytes\": %zu, \"nodes\": %zu, \"instructions\": %zu, "
+                     "\"validate_bytes_per_s\": %.6g, \"parse_bytes_per_s\": %.6g, \"compile_s\": %.6g, "
+                     "\"evaluate_samples_per_s\": %.6g, \"plot_samples\": %zu, \"ps_bytes\": %zu, "
+                     "\"plot_bytes_per_s\": %.6g}",
+                first ? "" : ",\n", r->name, r->bytes, r->nodes, r->instructions, r->validate_rate,
+                r->parse_rate, r->compile_seconds, r->evaluate_rate, r->plot_samples, r->ps_bytes, r->plot_rate);
+    } else {
+        fprintf(out, "%-18s %9zu %8zu %12.1f %12.1f %10.3f %12.2f %10zu %12.1f\n", r->name, r->bytes, r->nodes,
+                r->validate_rate / 1e6, r->parse_rate / 1e6, r->compile_seconds * 1e3, r->evaluate_rate / 1e6,
+                r->ps_bytes, r->plot_rate / 1e6);
+    }
+    fflush(out);
+}
+
+static void print_footer(FILE *out, ReportFormat format) {
+    if (format == REPORT_JSON) fprintf(out, "\n]\n");
+}
+
+/* Reads the corpus into one buffer, terminating each name and expression in place */
+static char* read_corpus(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char *text = size >= 0 ? (char*)malloc((size_t)size + 1) : NULL;
+    if (text != NULL && fread(text, 1, (size_t)size, file) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    fclose(file);
+    if (text != NULL) text[size] = '\0';
+    return text;
+}
+
+int main(int argc, char *argv[]) {
+    const char *corpus_path = "bench/corpus.txt";
+    const char *output_path = "-";
+    ReportFormat format = REPORT_TABLE;
+    int status = 0, first = 1;
+    PhaseResult result;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "csv") == 0) format = REPORT_CSV;
+            else if (strcmp(argv[i], "json") == 0) format = REPORT_JSON;
+            else if (strcmp(argv[i], "table") == 0) format = REPORT_TABLE;
+            else {
+                fprintf(stderr, "Error: --format expects table, csv or json.\n");
+                return 5;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (argv[i][0] != '-') {
+            corpus_path = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [--format table|csv|json] [--output FILE] [corpus]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char *corpus = read_corpus(corpus_path);
+    if (corpus == NULL) {
+        fprintf(stderr, "Error: Cannot read corpus '%s'.\n", corpus_path);
+        return 3;
+    }
+    FILE *out = strcmp(output_path, "-") == 0 ? stdout : fopen(output_path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error: Cannot create/write to file '%s'.\n", output_path);
+        free(corpus);
+        return 3;
+    }
+
+    print_header(out, format);
+    for (char *line = corpus; line != NULL && status == 0; ) {
+        char *end = strchr(line, '\n');
+        if (end) *end = '\0';
+        char *name = line;
+        while (isspace((unsigned char)*name)) name++;
+        if (*name != '\0' && *name != '#') {
+            char *expr = name;
+            while (*expr != '\0' && !isspace((unsigned char)*expr)) expr++;
+            if (*expr != '\0') *expr++ = '\0';
+            status = run_expression(name, expr, &result);
+            if (status == 0) print_result(out, format, &result, first);
+            first = 0;
+        }
+        line = end ? end + 1 : NULL;
+    }
+
+    /* Huge inputs that would bloat the corpus file */
+    const char *generated_names[] = { "generated_sum", "generated_nesting", "generated_series" };
+    char* (*generators[])(void) = { generate_sum, generate_nesting, generate_series };
+    for (int g = 0; g < 3 && status == 0; g++) {
+        char *text = generators[g]();
+        status = text ? run_expression(generated_names[g], text, &result) : 1;
+        if (status == 0) print_result(out, format, &result, first);
+        first = 0;
+        free(text);
+    }
+    print_footer(out, format);
+
+    if (status == 1) fprintf(stderr, "Error: Memory allocation failed.\n");
+    if (out != stdout) fclose(out);
+    free(corpus);
+    return status;
+}
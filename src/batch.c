@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 199309L
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "job.h"
+#include "sampler.h"
+#include "cache.h"
+#include "utils.h"
+
+/* Fields of one manifest line, pointing into the manifest text */
+typedef struct {
+    size_t line;            /* Line number in the manifest, for error reports */
+    const char *func;
+    const char *outfile;
+    const char *range;      /* NULL if the line has no range */
+    int status;             /* Result of the job, -1 if the line is malformed */
+} BatchEntry;
+
+/* State shared by the worker threads */
+typedef struct {
+    const char *manifest;
+    BatchEntry *entries;
+    size_t count;
+    size_t next;            /* First entry not yet claimed by a worker */
+    RenderOptions options;
+    DiskCache *cache;
+    pthread_mutex_t lock;
+} BatchQueue;
+
+/*
+ * Reads a whole file into a null-terminated buffer.
+ */
+static char* read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    char *text = NULL;
+    size_t length = 0, capacity = 0;
+
+    if (file == NULL) return NULL;
+    for (;;) {
+        if (capacity - length < 4096) {
+            capacity = capacity ? capacity * 2 : 65536;
+            char *grown = (char*)realloc(text, capacity);
+            if (grown == NULL) {
+                free(text);
+                fclose(file);
+                return NULL;
+            }
+            text = grown;
+        }
+        size_t read = fread(text + length, 1, capacity - length - 1, file);
+        length += read;
+        if (read == 0) break;
+    }
+    int failed = ferror(file);
+    fclose(file);
+    if (failed) {
+        free(text);
+        return NULL;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+/*
+ * Splits the manifest text into entries, skipping blank lines and comments.
+ */
+static BatchEntry* parse_manifest(char *text, size_t *count) {
+    size_t capacity = 0;
+    BatchEntry *entries = NULL;
+    size_t line_number = 0;
+
+    *count = 0;
+    for (char *line = text; line != NULL; ) {
+        char *end = strchr(line, '\n');
+        if (end) *end = '\0';
+        line_number++;
+
+        char *start = line;
+        while (isspace((unsigned char)*start)) start++;
+        if (*start != '\0' && *start != '#') {
+            if (*count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                BatchEntry *grown = (BatchEntry*)realloc(entries, capacity * sizeof(BatchEntry));
+                if (grown == NULL) {
+                    free(entries);
+                    return NULL;
+                }
+                entries = grown;
+            }
+            BatchEntry *entry = &entries[(*count)++];
+            entry->line = line_number;
+            entry->status = split_job_line(start, &entry->func, &entry->outfile, &entry->range) ? 0 : -1;
+        }
+        line = end ? end + 1 : NULL;
+    }
+    if (entries == NULL) entries = (BatchEntry*)malloc(sizeof(BatchEntry));
+    return entries;
+}
+
+/*
+ * Runs one manifest entry and returns its status.
+ */
+static int run_entry(const BatchEntry *entry, const RenderOptions *options, DiskCache *cache) {
+    PlotJob job;
+    int status;
+
+    init_job(&job);
+    status = set_job_function(&job, entry->func);
+    if (status == 0) status = set_job_outfile(&job, entry->outfile);
+    if (status == 0 && entry->range) status = set_job_range(&job, entry->range);
+    if (status == 0) status = run_job(&job, options, cache);
+    free_job(&job);
+    return status;
+}
+
+/*
+ * Worker loop: claims entries one at a time until none are left.
+ */
+static void* batch_worker(void *arg) {
+    BatchQueue *queue = (BatchQueue*)arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t index = queue->next < queue->count ? queue->next++ : queue->count;
+        pthread_mutex_unlock(&queue->lock);
+        if (index == queue->count) return NULL;
+
+        BatchEntry *entry = &queue->entries[index];
+        if (entry->status == -1) {
+            fprintf(stderr, "Error: %s:%zu: Expected <function> <output file> [x_min:x_max:y_min:y_max]\n",
+                    queue->manifest, entry->line);
+            continue;
+        }
+        entry->status = run_entry(entry, &queue->options, queue->cache);
+        if (entry->status != 0) {
+            fprintf(stderr, "Error: %s:%zu: Failed to render '%s'.\n", queue->manifest, entry->line, entry->outfile);
+        }
+    }
+}
+
+/*
+ * Runs the manifest on the worker pool; the calling thread is one of the workers.
+ */
+int run_batch(const char *manifest, const RenderOptions *options, DiskCache *cache) {
+    BatchQueue queue;
+    pthread_t workers[MAX_SAMPLER_THREADS];
+    int started = 0;
+    size_t failed = 0;
+    double start = monotonic_seconds();
+
+    char *text = read_file(manifest);
+    if (text == NULL) {
+        fprintf(stderr, "Error: Cannot read manifest '%s'.\n", manifest);
+        return 3;
+    }
+
+    queue.manifest = manifest;
+    queue.entries = parse_manifest(text, &queue.count);
+    if (queue.entries == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        free(text);
+        return 1;
+    }
+    queue.next = 0;
+    queue.options = *options;
+    queue.options.threads = 1;  /* Parallelism comes from running jobs side by side */
+    queue.cache = cache;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    while (started < options->threads - 1 && pthread_create(&workers[started], NULL, batch_worker, &queue) == 0) {
+        started++;
+    }
+    batch_worker(&queue);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+
+    for (size_t i = 0; i < queue.count; i++) {
+        if (queue.entries[i].status != 0) failed++;
+    }
+    double elapsed = monotonic_seconds() - start;
+    printf("Batch: %zu jobs, %zu succeeded, %zu failed in %.3f s (%.1f plots/s, %d workers).\n",
+           queue.count, queue.count - failed, failed, elapsed,
+           elapsed > 0 ? (double)(queue.count - failed) / elapsed : 0.0, started + 1);
+
+    free(queue.entries);
+    free(text);
+    return failed ? 6 : 0;
+}
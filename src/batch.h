@@ -0,0 +1,32 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "post_script.h"
+#include "cache.h"
+
+/**
+ * @brief Renders every plot listed in a manifest file.
+ *
+ * Each line of the manifest holds a function, an output file and optionally
+ * a range, separated by whitespace (see split_job_line()):
+ *
+ *     sin(x) * x   sine.ps   -5:5:-20:20
+ *
+ * Blank lines and lines starting with '#' are skipped.
+ *
+ * Jobs run on a pool of options->threads worker threads, each rendering one
+ * plot at a time. A job that fails is reported with its line number and the
+ * remaining jobs still run. A summary with the number of jobs, failures and
+ * throughput is printed to stdout at the end.
+ *
+ * @param[in] manifest Path of the manifest file.
+ * @param[in] options Rendering options; threads sets the number of workers.
+ * @param[in,out] cache The on-disk render cache shared by the jobs, or NULL.
+ * @return int Returns 0 if every job succeeded, or an error code:
+ * - 1: Memory allocation failed.
+ * - 3: Unable to read the manifest.
+ * - 6: At least one job failed.
+ */
+int run_batch(const char *manifest, const RenderOptions *options, DiskCache *cache);
+
+#endif /* BATCH_H */
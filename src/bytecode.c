@@ -0,0 +1,496 @@
+#include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bytecode.h"
+#include "jit.h"
+#include "dual.h"
+#include "utils.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/* Values kept on the C stack before the evaluator falls back to the heap */
+#define LOCAL_STACK_SIZE 64
+
+/* Slot index of a node that is not saved in a slot */
+#define NO_SLOT UINT_MAX
+
+/* Number of samples processed by each instruction of the batch evaluator */
+#define BATCH_BLOCK 256
+
+/* Applies an arithmetic operator to a block: left[i] = left[i] op right[i] */
+typedef void (*BinaryKernel)(OpCode opcode, double *left, const double *right, size_t n);
+
+/* Opcodes of the supported functions, indexed by FunctionId */
+static const OpCode function_opcodes[] = {
+    OP_SIN, OP_COS, OP_TAN, OP_ASIN, OP_ACOS, OP_ATAN,
+    OP_SINH, OP_COSH, OP_TANH, OP_LN, OP_LOG, OP_EXP, OP_ABS
+};
+
+/* Pending node of the iterative post-order walk */
+typedef struct {
+    NodeId node;
+    int children_done;
+} CompileFrame;
+
+/*
+ * Resolves a function to its opcode, or OP_NAN for unknown functions.
+ */
+OpCode function_opcode(unsigned char function) {
+    return function < FUNC_UNKNOWN ? function_opcodes[function] : OP_NAN;
+}
+
+/*
+ * Resolves an operator character to its opcode, or OP_NAN for unknown operators.
+ */
+OpCode operator_opcode(char operator) {
+    switch (operator) {
+        case '+': return OP_ADD;
+        case '-': return OP_SUB;
+        case '*': return OP_MUL;
+        case '/': return OP_DIV;
+        case '^': return OP_POW;
+    }
+    return OP_NAN;
+}
+
+/*
+ * Appends an instruction to the program, growing the code array as needed.
+ */
+static int emit(Program *program, size_t *capacity, OpCode opcode, double value) {
+    if (program->length == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        Instruction *code = (Instruction*)realloc(program->code, new_capacity * sizeof(Instruction));
+        if (code == NULL) return 0;
+        program->code = code;
+        *capacity = new_capacity;
+    }
+    program->code[program->length].opcode = opcode;
+    program->code[program->length].slot = 0;
+    program->code[program->length].value = value;
+    program->length++;
+    return 1;
+}
+
+/*
+ * Appends an instruction that accesses a slot.
+ */
+static int emit_slot(Program *program, size_t *capacity, OpCode opcode, unsigned int slot) {
+    if (!emit(program, capacity, opcode, 0.0)) return 0;
+    program->code[program->length - 1].slot = slot;
+    return 1;
+}
+
+/*
+ * Marks the nodes that are used by more than one live parent.
+ */
+static unsigned char* find_shared_nodes(const ExprTree *tree) {
+    unsigned char *live = mark_live_nodes(tree);
+    if (live == NULL) return NULL;
+
+    unsigned char *uses = (unsigned char*)calloc(tree->count ? tree->count : 1, 1);
+    if (uses == NULL) {
+        free(live);
+        return NULL;
+    }
+    for (NodeId i = 0; i < tree->count; i++) {
+        const Node *node = &tree->nodes[i];
+        if (!live[i] || (node->type != OPERATOR && node->type != FUNCTION)) continue;
+        if (node->data.child.left != NO_NODE && uses[node->data.child.left] < 2) {
+            uses[node->data.child.left]++;
+        }
+        if (node->type == OPERATOR && node->data.child.right != NO_NODE && uses[node->data.child.right] < 2) {
+            uses[node->data.child.right]++;
+        }
+    }
+    free(live);
+    return uses;
+}
+
+/*
+ * Compiles the expression tree into postfix order using an explicit stack.
+ */
+Program* compile_tree(const ExprTree *tree) {
+    Program *program = (Program*)calloc(1, sizeof(Program));
+    if (program == NULL) return NULL;
+    if (tree) program->deduplicated = tree->deduplicated;
+
+    size_t capacity = 0, frame_capacity = 16, frame_count = 0, depth = 0;
+    size_t node_count = tree && tree->count ? tree->count : 1;
+    CompileFrame *frames = (CompileFrame*)malloc(frame_capacity * sizeof(CompileFrame));
+    unsigned char *uses = tree ? find_shared_nodes(tree) : (unsigned char*)calloc(1, 1);
+    unsigned int *slots = (unsigned int*)malloc(node_count * sizeof(unsigned int));
+    if (frames == NULL || uses == NULL || slots == NULL) {
+        free(frames);
+        free(uses);
+        free(slots);
+        free(program);
+        return NULL;
+    }
+    for (size_t i = 0; i < node_count; i++) slots[i] = NO_SLOT;
+    frames[frame_count].node = tree ? tree->root : NO_NODE;
+    frames[frame_count++].children_done = 0;
+
+    while (frame_count > 0) {
+        CompileFrame frame = frames[--frame_count];
+        const Node *node = frame.node != NO_NODE ? &tree->nodes[frame.node] : NULL;
+        OpCode opcode = OP_NAN;
+        int ok = 1;
+
+        if (node == NULL) {
+            ok = emit(program, &capacity, OP_NAN, 0.0);
+            depth++;
+        } else if (node->type == CONST) {
+            ok = emit(program, &capacity, OP_CONST, node->data.value);
+            depth++;
+        } else if (node->type == VAR) {
+            ok = emit(program, &capacity, OP_VAR, 0.0);
+            depth++;
+        } else {
+            opcode = node->type == OPERATOR ? operator_opcode((char)node->op)
+                                            : function_opcode(node->op);
+            if (slots[frame.node] != NO_SLOT) {
+                /* Shared node that has already been computed */
+                ok = emit_slot(program, &capacity, OP_LOAD, slots[frame.node]);
+                depth++;
+            } else if (opcode == OP_NAN) {
+                /* Unknown operators and functions always evaluate to NaN */
+                ok = emit(program, &capacity, OP_NAN, 0.0);
+                depth++;
+            } else if (frame.children_done) {
+                ok = emit(program, &capacity, opcode, 0.0);
+                if (node->type == OPERATOR) depth--;
+                if (ok && uses[frame.node] > 1) {
+                    slots[frame.node] = (unsigned int)program->slot_count++;
+                    ok = emit_slot(program, &capacity, OP_STORE, slots[frame.node]);
+                }
+            } else {
+                /* Revisit the node after its children, left child first */
+                if (frame_count + 3 > frame_capacity) {
+                    frame_capacity *= 2;
+                    CompileFrame *grown = (CompileFrame*)realloc(frames, frame_capacity * sizeof(CompileFrame));
+                    if (grown == NULL) {
+                        ok = 0;
+                    } else {
+                        frames = grown;
+                    }
+                }
+                if (ok) {
+                    frames[frame_count].node = frame.node;
+                    frames[frame_count++].children_done = 1;
+                    if (node->type == OPERATOR) {
+                        frames[frame_count].node = node->data.child.right;
+                        frames[frame_count++].children_done = 0;
+                    }
+                    frames[frame_count].node = node->data.child.left;
+                    frames[frame_count++].children_done = 0;
+                }
+            }
+        }
+
+        if (!ok) {
+            free(frames);
+            free(uses);
+            free(slots);
+            free_program(program);
+            return NULL;
+        }
+        if (depth > program->max_depth) program->max_depth = depth;
+    }
+
+    free(frames);
+    free(uses);
+    free(slots);
+    return program;
+}
+
+/*
+ * Applies a binary operator with the same domain rules as evaluate().
+ */
+double run_operator(OpCode opcode, double left_val, double right_val) {
+    if (!isfinite(left_val) || !isfinite(right_val)) return create_nan();
+
+    switch (opcode) {
+        case OP_ADD: return left_val + right_val;
+        case OP_SUB: return left_val - right_val;
+        case OP_MUL: return left_val * right_val;
+        case OP_DIV:
+            if (fabs(right_val) < MIN_DIVISOR) return create_nan();
+            return left_val / right_val;
+        case OP_POW: {
+            if (left_val < 0 && floor(right_val) != right_val) return create_nan();
+            double result = pow(left_val, right_val);
+            return isfinite(result) && fabs(result) < MAX_VALUE ? result : create_nan();
+        }
+        default:
+            return create_nan();
+    }
+}
+
+/*
+ * Applies a function with the same domain rules as evaluate().
+ */
+double run_function(OpCode opcode, double arg_val) {
+    if (!isfinite(arg_val)) return create_nan();
+
+    switch (opcode) {
+        case OP_SIN: return sin(arg_val);
+        case OP_COS: return cos(arg_val);
+        case OP_TAN: return tan(arg_val);
+        case OP_ASIN: return asin(arg_val);
+        case OP_ACOS: return acos(arg_val);
+        case OP_ATAN: return atan(arg_val);
+        case OP_SINH: return sinh(arg_val);
+        case OP_COSH: return cosh(arg_val);
+        case OP_TANH: return tanh(arg_val);
+        case OP_LN: return arg_val > 0 ? log(arg_val) : create_nan();
+        case OP_LOG: return arg_val > 0 ? log10(arg_val) : create_nan();
+        case OP_EXP: return exp(arg_val);
+        case OP_ABS: return fabs(arg_val);
+        default: return create_nan();
+    }
+}
+
+/*
+ * Runs the postfix program on a value stack without recursion.
+ */
+double evaluate_program(const Program *program, double x) {
+    if (!program || program->length == 0) return create_nan();
+    if (program->derivative) return evaluate_program_dual(program, x).slope;
+
+    double local_stack[LOCAL_STACK_SIZE];
+    double *stack = local_stack;
+    size_t scratch_size = program->max_depth + program->slot_count;
+    if (scratch_size > LOCAL_STACK_SIZE) {
+        stack = (double*)malloc(scratch_size * sizeof(double));
+        if (stack == NULL) return create_nan();
+    }
+    double *slots = stack + program->max_depth;
+
+    size_t sp = 0;
+    for (size_t i = 0; i < program->length; i++) {
+        const Instruction *instruction = &program->code[i];
+        switch (instruction->opcode) {
+            case OP_CONST:
+                stack[sp++] = instruction->value;
+                break;
+            case OP_VAR:
+                stack[sp++] = x;
+                break;
+            case OP_NAN:
+                stack[sp++] = create_nan();
+                break;
+            case OP_LOAD:
+                stack[sp++] = slots[instruction->slot];
+                break;
+            case OP_STORE:
+                slots[instruction->slot] = stack[sp - 1];
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_POW:
+                sp--;
+                stack[sp - 1] = run_operator(instruction->opcode, stack[sp - 1], stack[sp]);
+                break;
+            default:
+                stack[sp - 1] = run_function(instruction->opcode, stack[sp - 1]);
+                break;
+        }
+    }
+
+    /* A well-formed program leaves exactly its result on the stack */
+    double result = sp > 0 ? stack[sp - 1] : create_nan();
+    if (stack != local_stack) free(stack);
+    return result;
+}
+
+/*
+ * Scalar operator kernel, also used for the tails of the vector kernels.
+ */
+static void binary_scalar(OpCode opcode, double *left, const double *right, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        left[i] = run_operator(opcode, left[i], right[i]);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * SSE2 operator kernel. Lanes whose operands are not finite, or whose divisor
+ * is below MIN_DIVISOR, are replaced by NaN as in run_operator().
+ */
+__attribute__((target("sse2")))
+static void binary_sse2(OpCode opcode, double *left, const double *right, size_t n) {
+    if (opcode == OP_POW) {
+        binary_scalar(opcode, left, right, n);
+        return;
+    }
+
+    const __m128d sign_mask = _mm_set1_pd(-0.0);
+    const __m128d max_finite = _mm_set1_pd(DBL_MAX);
+    const __m128d min_divisor = _mm_set1_pd(MIN_DIVISOR);
+    const __m128d nan = _mm_set1_pd(create_nan());
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        __m128d a = _mm_loadu_pd(left + i);
+        __m128d b = _mm_loadu_pd(right + i);
+        __m128d abs_b = _mm_andnot_pd(sign_mask, b);
+        __m128d valid = _mm_and_pd(_mm_cmple_pd(_mm_andnot_pd(sign_mask, a), max_finite),
+                                   _mm_cmple_pd(abs_b, max_finite));
+        __m128d result;
+
+        switch (opcode) {
+            case OP_ADD: result = _mm_add_pd(a, b); break;
+            case OP_SUB: result = _mm_sub_pd(a, b); break;
+            case OP_MUL: result = _mm_mul_pd(a, b); break;
+            default:
+                valid = _mm_and_pd(valid, _mm_cmpge_pd(abs_b, min_divisor));
+                result = _mm_div_pd(a, b);
+                break;
+        }
+        _mm_storeu_pd(left + i, _mm_or_pd(_mm_and_pd(valid, result), _mm_andnot_pd(valid, nan)));
+    }
+    binary_scalar(opcode, left + i, right + i, n - i);
+}
+
+/*
+ * AVX2 operator kernel, four lanes at a time with the same masking as the
+ * SSE2 kernel.
+ */
+__attribute__((target("avx2")))
+static void binary_avx2(OpCode opcode, double *left, const double *right, size_t n) {
+    if (opcode == OP_POW) {
+        binary_scalar(opcode, left, right, n);
+        return;
+    }
+
+    const __m256d sign_mask = _mm256_set1_pd(-0.0);
+    const __m256d max_finite = _mm256_set1_pd(DBL_MAX);
+    const __m256d min_divisor = _mm256_set1_pd(MIN_DIVISOR);
+    const __m256d nan = _mm256_set1_pd(create_nan());
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256d a = _mm256_loadu_pd(left + i);
+        __m256d b = _mm256_loadu_pd(right + i);
+        __m256d abs_b = _mm256_andnot_pd(sign_mask, b);
+        __m256d valid = _mm256_and_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign_mask, a), max_finite, _CMP_LE_OQ),
+                                      _mm256_cmp_pd(abs_b, max_finite, _CMP_LE_OQ));
+        __m256d result;
+
+        switch (opcode) {
+            case OP_ADD: result = _mm256_add_pd(a, b); break;
+            case OP_SUB: result = _mm256_sub_pd(a, b); break;
+            case OP_MUL: result = _mm256_mul_pd(a, b); break;
+            default:
+                valid = _mm256_and_pd(valid, _mm256_cmp_pd(abs_b, min_divisor, _CMP_GE_OQ));
+                result = _mm256_div_pd(a, b);
+                break;
+        }
+        _mm256_storeu_pd(left + i, _mm256_blendv_pd(nan, result, valid));
+    }
+    binary_scalar(opcode, left + i, right + i, n - i);
+}
+#endif
+
+/*
+ * Picks the widest operator kernel supported by the running CPU.
+ */
+static BinaryKernel select_binary_kernel(void) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return binary_avx2;
+    if (__builtin_cpu_supports("sse2")) return binary_sse2;
+#endif
+    return binary_scalar;
+}
+
+/*
+ * Runs the postfix program over blocks of samples. Each stack slot holds a
+ * whole block, so every instruction is dispatched once per block instead of
+ * once per sample.
+ */
+void evaluate_program_batch(const Program *program, const double *xs, double *ys, size_t n) {
+    if (!program || program->length == 0) {
+        for (size_t i = 0; i < n; i++) ys[i] = create_nan();
+        return;
+    }
+    if (program->derivative) {
+        evaluate_program_dual_batch(program, xs, NULL, ys, n);
+        return;
+    }
+    if (program->jit) {
+        jit_evaluate(program->jit, xs, ys, n);
+        return;
+    }
+
+    double *stack = (double*)malloc((program->max_depth + program->slot_count) * BATCH_BLOCK * sizeof(double));
+    if (stack == NULL) {
+        for (size_t i = 0; i < n; i++) ys[i] = evaluate_program(program, xs[i]);
+        return;
+    }
+    double *slots = stack + program->max_depth * BATCH_BLOCK;
+
+    BinaryKernel binary = select_binary_kernel();
+    double nan = create_nan();
+
+    for (size_t start = 0; start < n; start += BATCH_BLOCK) {
+        size_t count = n - start < BATCH_BLOCK ? n - start : BATCH_BLOCK;
+        double *top = stack - BATCH_BLOCK;
+
+        for (size_t i = 0; i < program->length; i++) {
+            const Instruction *instruction = &program->code[i];
+            switch (instruction->opcode) {
+                case OP_CONST:
+                    top += BATCH_BLOCK;
+                    for (size_t j = 0; j < count; j++) top[j] = instruction->value;
+                    break;
+                case OP_VAR:
+                    top += BATCH_BLOCK;
+                    memcpy(top, xs + start, count * sizeof(double));
+                    break;
+                case OP_NAN:
+                    top += BATCH_BLOCK;
+                    for (size_t j = 0; j < count; j++) top[j] = nan;
+                    break;
+                case OP_LOAD:
+                    top += BATCH_BLOCK;
+                    memcpy(top, slots + instruction->slot * BATCH_BLOCK, count * sizeof(double));
+                    break;
+                case OP_STORE:
+                    memcpy(slots + instruction->slot * BATCH_BLOCK, top, count * sizeof(double));
+                    break;
+                case OP_ADD:
+                case OP_SUB:
+                case OP_MUL:
+                case OP_DIV:
+                case OP_POW:
+                    top -= BATCH_BLOCK;
+                    binary(instruction->opcode, top, top + BATCH_BLOCK, count);
+                    break;
+                default:
+                    for (size_t j = 0; j < count; j++) {
+                        top[j] = run_function(instruction->opcode, top[j]);
+                    }
+                    break;
+            }
+        }
+        memcpy(ys + start, stack, count * sizeof(double));
+    }
+
+    free(stack);
+}
+
+/* Free the instruction array and the program */
+void free_program(Program *program) {
+    if (!program) return;
+    jit_free(program->jit);
+    free(program->code);
+    free(program);
+}
@@ -0,0 +1,153 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stddef.h>
+#include "parser.h"
+
+struct JitCode;
+
+/**
+ * @brief Opcodes of the postfix expression program.
+ *
+ * Leaves push one value, binary operators pop two values and push one,
+ * functions replace the value on top of the stack.
+ */
+typedef enum {
+    OP_CONST,   /**< Push the instruction's constant value */
+    OP_VAR,     /**< Push the value of 'x' */
+    OP_NAN,     /**< Push NaN (missing or unknown subtree) */
+    OP_LOAD,    /**< Push the value saved in a slot */
+    OP_STORE,   /**< Save the value on top of the stack in a slot, leaving it there */
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_POW,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_ASIN,
+    OP_ACOS,
+    OP_ATAN,
+    OP_SINH,
+    OP_COSH,
+    OP_TANH,
+    OP_LN,
+    OP_LOG,
+    OP_EXP,
+    OP_ABS
+} OpCode;
+
+/**
+ * @brief A single instruction of the postfix expression program.
+ */
+typedef struct {
+    OpCode opcode;      /**< Operation to perform */
+    unsigned int slot;  /**< Slot index, used only by OP_LOAD and OP_STORE */
+    double value;       /**< Constant value, used only by OP_CONST */
+} Instruction;
+
+/**
+ * @brief Expression tree compiled into a flat postfix instruction array.
+ */
+typedef struct {
+    Instruction *code;  /**< Instructions in evaluation order */
+    size_t length;      /**< Number of instructions */
+    size_t max_depth;   /**< Maximum depth of the value stack during evaluation */
+    size_t slot_count;  /**< Number of slots holding shared subexpression values */
+    size_t deduplicated; /**< Nodes the compiled tree had merged by share_subexpressions() */
+    struct JitCode *jit; /**< Native code attached by jit_compile_program(), or NULL */
+    int derivative;     /**< Nonzero if evaluation returns the derivative with respect to 'x' instead of the value */
+} Program;
+
+/**
+ * @brief Compiles an expression tree into a postfix program.
+ *
+ * The tree is walked iteratively, so arbitrarily deep trees can be compiled
+ * without growing the C stack. Operator and function nodes with more than one
+ * parent, as produced by share_subexpressions(), are computed once, saved in
+ * a slot and reloaded wherever they are used again.
+ *
+ * @param[in] tree Pointer to the expression tree.
+ * @return Program* Returns the compiled program, or NULL if memory allocation failed.
+ */
+Program* compile_tree(const ExprTree *tree);
+
+/**
+ * @brief Resolves an operator character to its opcode.
+ *
+ * @param[in] operator The operator character (+, -, *, /, ^).
+ * @return OpCode Returns the opcode, or OP_NAN for unknown operators.
+ */
+OpCode operator_opcode(char operator);
+
+/**
+ * @brief Resolves a function identifier to its opcode.
+ *
+ * @param[in] function The FunctionId of the function.
+ * @return OpCode Returns the opcode, or OP_NAN for unknown functions.
+ */
+OpCode function_opcode(unsigned char function);
+
+/**
+ * @brief Applies a binary operator opcode with the same domain rules as evaluate().
+ *
+ * This is the one definition of those rules, which apply_operator() calls;
+ * the vector kernels, the JIT and the interval evaluator use the same
+ * MIN_DIVISOR and MAX_VALUE.
+ *
+ * @param[in] opcode One of OP_ADD, OP_SUB, OP_MUL, OP_DIV and OP_POW.
+ * @param[in] left_val The left operand.
+ * @param[in] right_val The right operand.
+ * @return double Returns the result, or NaN where it is undefined.
+ */
+double run_operator(OpCode opcode, double left_val, double right_val);
+
+/**
+ * @brief Applies a function opcode with the same domain rules as evaluate().
+ *
+ * @param[in] opcode One of the function opcodes, OP_SIN to OP_ABS.
+ * @param[in] arg_val The argument.
+ * @return double Returns the result, or NaN where it is undefined.
+ */
+double run_function(OpCode opcode, double arg_val);
+
+/**
+ * @brief Evaluates a compiled program for a given value of 'x'.
+ *
+ * Produces the same results as evaluate() on the tree the program was
+ * compiled from, including its NaN semantics. Programs with the
+ * 'derivative' flag set return the slope computed by evaluate_program_dual()
+ * instead.
+ *
+ * @param[in] program Pointer to the compiled program.
+ * @param[in] x The value of the variable 'x'.
+ * @return double Returns the result of the evaluation.
+ */
+double evaluate_program(const Program *program, double x);
+
+/**
+ * @brief Evaluates a compiled program for an array of 'x' values.
+ *
+ * Each instruction is applied to a whole block of samples at a time. The
+ * arithmetic operators use AVX2 or SSE2 when the CPU supports them, which is
+ * detected at runtime, and a scalar loop otherwise. Programs with native code
+ * attached by jit_compile_program() run that code instead, and programs with
+ * the 'derivative' flag set run evaluate_program_dual_batch(). Results are
+ * identical to calling evaluate_program() for each element.
+ *
+ * @param[in] program Pointer to the compiled program.
+ * @param[in] xs Array of 'x' values.
+ * @param[out] ys Array receiving the results, may alias xs.
+ * @param[in] n Number of values in xs and ys.
+ */
+void evaluate_program_batch(const Program *program, const double *xs, double *ys, size_t n);
+
+/**
+ * @brief Frees a compiled program.
+ *
+ * @param[in] program Pointer to the program to free (may be NULL).
+ */
+void free_program(Program *program);
+
+#endif /* BYTECODE_H */
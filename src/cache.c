@@ -0,0 +1,367 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "parser.h"
+
+#define CACHE_KEY_VERSION "ps1"     /* Changes whenever the output format changes */
+#define CACHE_SUFFIX ".page"        /* Extension of cache files */
+#define EVICT_TARGET 0.9            /* Eviction frees space down to this fraction of the limit */
+
+/* Growable string used to build keys */
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+    int failed;
+} KeyBuilder;
+
+/*
+ * Appends printf-style text to a key.
+ */
+static void key_append(KeyBuilder *builder, const char *format, ...) {
+    char part[128];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(part, sizeof(part), format, args);
+    va_end(args);
+    if (builder->failed || length < 0) {
+        builder->failed = 1;
+        return;
+    }
+    if ((size_t)length >= sizeof(part)) length = sizeof(part) - 1;
+
+    if (builder->capacity - builder->length <= (size_t)length) {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 256;
+        while (capacity - builder->length <= (size_t)length) capacity *= 2;
+        char *grown = (char*)realloc(builder->text, capacity);
+        if (grown == NULL) {
+            builder->failed = 1;
+            return;
+        }
+        builder->text = grown;
+        builder->capacity = capacity;
+    }
+    memcpy(builder->text + builder->length, part, (size_t)length + 1);
+    builder->length += (size_t)length;
+}
+
+/*
+ * Serializes the parse tree node by node, followed by the ranges and the
+ * options that change the output. The parser leaves no unreachable nodes,
+ * so the serialization only depends on the expression.
+ */
+char* make_render_key(const PlotJob *job, const RenderOptions *options) {
+    KeyBuilder builder = { NULL, 0, 0, 0 };
+    const ExprTree *tree = job->tree;
+
+    key_append(&builder, "%s;%u;", CACHE_KEY_VERSION, (unsigned)tree->root);
+    for (NodeId i = 0; i < tree->count; i++) {
+        const Node *node = &tree->nodes[i];
+        switch (node->type) {
+            case CONST:
+                key_append(&builder, "c%.17g;", node->data.value);
+                break;
+            case VAR:
+                key_append(&builder, "x;");
+                break;
+            case OPERATOR:
+                key_append(&builder, "o%c%ld,%ld;", node->op,
+                           node->data.child.left == NO_NODE ? -1L : (long)node->data.child.left,
+                           node->data.child.right == NO_NODE ? -1L : (long)node->data.child.right);
+                break;
+            default:
+                key_append(&builder, "f%s%ld;", function_name((FunctionId)node->op),
+                           node->data.child.left == NO_NODE ? -1L : (long)node->data.child.left);
+                break;
+        }
+    }
+
+    key_append(&builder, "|%.17g:%.17g:%.17g:%.17g:%d:%d", job->x_min, job->x_max, job->y_min, job->y_max,
+               job->calc_x_range, job->calc_y_range);
+    key_append(&builder, "|%d:%d:%.17g:%.17g:%d:%d:%d", options->oversampling, options->adaptive,
+               options->tolerance, options->simplify, options->derivative, (int)options->format,
+               options->format == FORMAT_PS ? 0 : options->raster_size);
+
+    if (builder.failed) {
+        free(builder.text);
+        return NULL;
+    }
+    return builder.text;
+}
+
+uint64_t hash_render_key(const char *key) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (; *key != '\0'; key++) {
+        hash ^= (unsigned char)*key;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void init_memory_cache(MemoryCache *cache, size_t limit) {
+    memset(cache, 0, sizeof(MemoryCache));
+    cache->limit = limit;
+}
+
+/*
+ * Unlinks an entry from the LRU list.
+ */
+static void detach_entry(MemoryCache *cache, CacheEntry *entry) {
+    if (entry->newer) entry->newer->older = entry->older; else cache->newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer; else cache->oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+/*
+ * Links an entry in as the most recently used one.
+ */
+static void attach_newest(MemoryCache *cache, CacheEntry *entry) {
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest) cache->newest->newer = entry; else cache->oldest = entry;
+    cache->newest = entry;
+}
+
+/*
+ * Removes the least recently used entry from the list, its bucket and the byte count.
+ */
+static void evict_oldest(MemoryCache *cache) {
+    CacheEntry *entry = cache->oldest;
+    CacheEntry **link = &cache->buckets[entry->hash % MEMORY_CACHE_BUCKETS];
+
+    while (*link != entry) link = &(*link)->bucket_next;
+    *link = entry->bucket_next;
+    detach_entry(cache, entry);
+    cache->bytes -= entry->length + strlen(entry->key) + 1;
+    free(entry->key);
+    free(entry->data);
+    free(entry);
+}
+
+const CacheEntry* memory_cache_get(MemoryCache *cache, const char *key) {
+    uint64_t hash = hash_render_key(key);
+    for (CacheEntry *entry = cache->buckets[hash % MEMORY_CACHE_BUCKETS]; entry; entry = entry->bucket_next) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            detach_entry(cache, entry);
+            attach_newest(cache, entry);
+            cache->hits++;
+            return entry;
+        }
+    }
+    cache->misses++;
+    return NULL;
+}
+
+void memory_cache_put(MemoryCache *cache, const char *key, const char *data, size_t length) {
+    size_t key_length = strlen(key) + 1;
+    if (length + key_length > cache->limit) return;
+
+    CacheEntry *entry = (CacheEntry*)calloc(1, sizeof(CacheEntry));
+    if (entry) {
+        entry->key = (char*)malloc(key_length);
+        entry->data = (char*)malloc(length ? length : 1);
+    }
+    if (entry == NULL || entry->key == NULL || entry->data == NULL) {
+        if (entry) {
+            free(entry->key);
+            free(entry->data);
+        }
+        free(entry);
+        return;
+    }
+    memcpy(entry->key, key, key_length);
+    memcpy(entry->data, data, length);
+    entry->length = length;
+    entry->hash = hash_render_key(key);
+
+    while (cache->oldest && cache->bytes + length + key_length > cache->limit) {
+        evict_oldest(cache);
+    }
+    entry->bucket_next = cache->buckets[entry->hash % MEMORY_CACHE_BUCKETS];
+    cache->buckets[entry->hash % MEMORY_CACHE_BUCKETS] = entry;
+    attach_newest(cache, entry);
+    cache->bytes += length + key_length;
+}
+
+void free_memory_cache(MemoryCache *cache) {
+    while (cache->oldest) evict_oldest(cache);
+}
+
+int init_disk_cache(DiskCache *cache, const char *directory, size_t limit) {
+    if (mkdir(directory, 0777) != 0 && errno != EEXIST) return 0;
+    cache->directory = directory;
+    cache->limit = limit;
+    cache->bytes = 0;
+    cache->scanned = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+    return 1;
+}
+
+/*
+ * Builds the path of the cache file for a key.
+ */
+static char* page_path(const DiskCache *cache, const char *key) {
+    size_t length = strlen(cache->directory) + 64;
+    char *path = (char*)malloc(length);
+    if (path == NULL) return NULL;
+    snprintf(path, length, "%s/%016llx%s", cache->directory,
+             (unsigned long long)hash_render_key(key), CACHE_SUFFIX);
+    return path;
+}
+
+/*
+ * Reads a cache file and checks that it was stored under the same key.
+ */
+int disk_cache_get(DiskCache *cache, const char *key, char **data, size_t *length) {
+    char *path = page_path(cache, key);
+    FILE *file = path ? fopen(path, "rb") : NULL;
+    size_t key_length = strlen(key);
+    struct stat info;
+    int hit = 0;
+
+    *data = NULL;
+    *length = 0;
+    if (file && fstat(fileno(file), &info) == 0 && (size_t)info.st_size > key_length) {
+        size_t size = (size_t)info.st_size;
+        char *contents = (char*)malloc(size);
+        if (contents && fread(contents, 1, size, file) == size &&
+            memcmp(contents, key, key_length) == 0 && contents[key_length] == '\n') {
+            *length = size - key_length - 1;
+            memmove(contents, contents + key_length + 1, *length);
+            *data = contents;
+            hit = 1;
+        } else {
+            free(contents);
+        }
+    }
+    if (file) fclose(file);
+    /* Refresh the modification time, which orders eviction */
+    if (hit) utimensat(AT_FDCWD, path, NULL, 0);
+    free(path);
+    return hit;
+}
+
+/* A cache file considered for eviction */
+typedef struct {
+    char *name;
+    time_t used;
+    size_t size;
+} CacheFile;
+
+/*
+ * Orders cache files from least to most recently used for qsort().
+ */
+static int compare_cache_files(const void *a, const void *b) {
+    time_t ua = ((const CacheFile*)a)->used, ub = ((const CacheFile*)b)->used;
+    return (ua > ub) - (ua < ub);
+}
+
+/*
+ * Lists the cache files, recounts their size and, if evicting, removes the
+ * least recently used ones until the cache is below its target size.
+ * Called with the lock held.
+ */
+static void scan_directory(DiskCache *cache, int evict) {
+    DIR *directory = opendir(cache->directory);
+    CacheFile *files = NULL;
+    size_t count = 0, capacity = 0;
+    size_t suffix_length = strlen(CACHE_SUFFIX);
+    struct dirent *item;
+
+    if (directory == NULL) return;
+    cache->bytes = 0;
+    while ((item = readdir(directory)) != NULL) {
+        size_t name_length = strlen(item->d_name);
+        if (name_length <= suffix_length || strcmp(item->d_name + name_length - suffix_length, CACHE_SUFFIX) != 0) {
+            continue;
+        }
+
+        size_t path_length = strlen(cache->directory) + name_length + 2;
+        char *path = (char*)malloc(path_length);
+        struct stat info;
+        if (path == NULL) break;
+        snprintf(path, path_length, "%s/%s", cache->directory, item->d_name);
+        if (stat(path, &info) != 0) {
+            free(path);
+            continue;
+        }
+        cache->bytes += (size_t)info.st_size;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            CacheFile *grown = (CacheFile*)realloc(files, capacity * sizeof(CacheFile));
+            if (grown == NULL) {
+                free(path);
+                break;
+            }
+            files = grown;
+        }
+        files[count].name = path;
+        files[count].used = info.st_mtime;
+        files[count].size = (size_t)info.st_size;
+        count++;
+    }
+    closedir(directory);
+
+    if (evict) {
+        size_t target = (size_t)(cache->limit * EVICT_TARGET);
+        qsort(files, count, sizeof(CacheFile), compare_cache_files);
+        for (size_t i = 0; i < count && cache->bytes > target; i++) {
+            if (unlink(files[i].name) == 0) cache->bytes -= files[i].size;
+        }
+    }
+    for (size_t i = 0; i < count; i++) free(files[i].name);
+    free(files);
+    cache->scanned = 1;
+}
+
+void disk_cache_put(DiskCache *cache, const char *key, const char *data, size_t length) {
+    static unsigned long counter = 0;
+    size_t key_length = strlen(key);
+    size_t size = key_length + 1 + length;
+    char *path = page_path(cache, key);
+    char *temporary = path ? (char*)malloc(strlen(path) + 48) : NULL;
+    int stored = 0;
+
+    if (temporary == NULL || size > cache->limit) {
+        free(path);
+        free(temporary);
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    sprintf(temporary, "%s.%ld.%lu.tmp", path, (long)getpid(), counter++);
+    pthread_mutex_unlock(&cache->lock);
+
+    FILE *file = fopen(temporary, "wb");
+    if (file) {
+        stored = fwrite(key, 1, key_length, file) == key_length && fputc('\n', file) != EOF &&
+                 fwrite(data, 1, length, file) == length;
+        stored = fclose(file) == 0 && stored;
+        stored = stored && rename(temporary, path) == 0;
+        if (!stored) unlink(temporary);
+    }
+
+    if (stored) {
+        pthread_mutex_lock(&cache->lock);
+        if (!cache->scanned) scan_directory(cache, 0);
+        else cache->bytes += size;
+        if (cache->bytes > cache->limit) scan_directory(cache, 1);
+        pthread_mutex_unlock(&cache->lock);
+    }
+    free(path);
+    free(temporary);
+}
+
+void free_disk_cache(DiskCache *cache) {
+    pthread_mutex_destroy(&cache->lock);
+}
@@ -0,0 +1,162 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "job.h"
+
+/**
+ * @brief Default size limit of a render cache, in MiB.
+ */
+#define DEFAULT_CACHE_MB 64
+
+/**
+ * @brief Number of hash buckets of the in-memory cache.
+ */
+#define MEMORY_CACHE_BUCKETS 4096
+
+/**
+ * @brief Builds the canonical cache key of a job.
+ *
+ * The job's parse tree is serialized, so spellings that
+ * parse to the same tree share a key ("x*2", "x * 2", "(x)*2.0"). The
+ * ranges and every rendering option that changes the output are appended;
+ * the thread count is not, since it never changes the output.
+ *
+ * @param[in] job The job with a parsed function.
+ * @param[in] options Rendering options of the job.
+ * @return char* Returns the key, to be freed by the caller, or NULL if memory allocation failed.
+ */
+char* make_render_key(const PlotJob *job, const RenderOptions *options);
+
+/**
+ * @brief Hashes a cache key with 64-bit FNV-1a.
+ *
+ * @param[in] key The key.
+ * @return uint64_t Returns the hash.
+ */
+uint64_t hash_render_key(const char *key);
+
+/**
+ * @brief A cached page in memory, linked into a hash bucket and the LRU list.
+ */
+typedef struct CacheEntry {
+    char *key;                      /**< Canonical key */
+    uint64_t hash;                  /**< Hash of the key */
+    char *data;                     /**< Rendered PostScript */
+    size_t length;                  /**< Number of bytes in data */
+    struct CacheEntry *bucket_next; /**< Next entry in the same bucket */
+    struct CacheEntry *newer;       /**< Next more recently used entry */
+    struct CacheEntry *older;       /**< Next less recently used entry */
+} CacheEntry;
+
+/**
+ * @brief In-memory render cache with LRU eviction, for long-running mode.
+ */
+typedef struct {
+    CacheEntry *buckets[MEMORY_CACHE_BUCKETS];  /**< Hash table of entries */
+    CacheEntry *newest;                         /**< Most recently used entry */
+    CacheEntry *oldest;                         /**< Least recently used entry */
+    size_t bytes;                               /**< Bytes of keys and pages held */
+    size_t limit;                               /**< Largest number of bytes held */
+    size_t hits;                                /**< Number of lookups that found a page */
+    size_t misses;                              /**< Number of lookups that did not */
+} MemoryCache;
+
+/**
+ * @brief Initializes an empty in-memory cache.
+ *
+ * @param[out] cache The cache.
+ * @param[in] limit Largest number of bytes of keys and pages to hold.
+ */
+void init_memory_cache(MemoryCache *cache, size_t limit);
+
+/**
+ * @brief Looks up a page and marks it most recently used.
+ *
+ * @param[in,out] cache The cache.
+ * @param[in] key The canonical key.
+ * @return const CacheEntry* Returns the entry, valid until the next insertion, or NULL on a miss.
+ */
+const CacheEntry* memory_cache_get(MemoryCache *cache, const char *key);
+
+/**
+ * @brief Stores a copy of a page, evicting least recently used pages over the limit.
+ *
+ * Pages larger than the limit are not stored. Allocation failures only
+ * mean the page is not cached.
+ *
+ * @param[in,out] cache The cache.
+ * @param[in] key The canonical key.
+ * @param[in] data The rendered page.
+ * @param[in] length The number of bytes in data.
+ */
+void memory_cache_put(MemoryCache *cache, const char *key, const char *data, size_t length);
+
+/**
+ * @brief Frees every page of an in-memory cache.
+ *
+ * @param[in,out] cache The cache.
+ */
+void free_memory_cache(MemoryCache *cache);
+
+/**
+ * @brief On-disk render cache in a directory, shared by the threads of a process.
+ *
+ * Each page is stored in a file named after the hash of its key, which also
+ * holds the key itself, so hash collisions are detected. Hits refresh the
+ * file's modification time, and the least recently used files are removed
+ * once the directory grows past the limit.
+ */
+typedef struct DiskCache {
+    const char *directory;  /**< Directory holding the cache files */
+    size_t limit;           /**< Largest number of bytes held */
+    size_t bytes;           /**< Bytes held, as far as this process knows */
+    int scanned;            /**< Set once bytes was initialized from the directory */
+    pthread_mutex_t lock;   /**< Serializes eviction and the byte count */
+} DiskCache;
+
+/**
+ * @brief Initializes an on-disk cache; the directory is created if needed.
+ *
+ * @param[out] cache The cache.
+ * @param[in] directory The directory holding the cache files.
+ * @param[in] limit Largest number of bytes of cache files.
+ * @return int Returns 1 on success, 0 if the directory cannot be created.
+ */
+int init_disk_cache(DiskCache *cache, const char *directory, size_t limit);
+
+/**
+ * @brief Looks up a page.
+ *
+ * @param[in,out] cache The cache.
+ * @param[in] key The canonical key.
+ * @param[out] data Pointer receiving the page, to be freed by the caller.
+ * @param[out] length Pointer receiving the number of bytes in the page.
+ * @return int Returns 1 on a hit, 0 on a miss.
+ */
+int disk_cache_get(DiskCache *cache, const char *key, char **data, size_t *length);
+
+/**
+ * @brief Stores a page, evicting least recently used files over the limit.
+ *
+ * The file is written under a temporary name and renamed into place, so
+ * concurrent readers never see a partial page. Failures only mean the page
+ * is not cached.
+ *
+ * @param[in,out] cache The cache.
+ * @param[in] key The canonical key.
+ * @param[in] data The rendered page.
+ * @param[in] length The number of bytes in data.
+ */
+void disk_cache_put(DiskCache *cache, const char *key, const char *data, size_t length);
+
+/**
+ * @brief Releases the resources of an on-disk cache; the files are kept.
+ *
+ * @param[in,out] cache The cache.
+ */
+void free_disk_cache(DiskCache *cache);
+
+#endif /* CACHE_H */
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dag.h"
+
+/*
+ * Hashes the type, operator and payload of a node with FNV-1a.
+ */
+static uint64_t hash_node(const Node *node) {
+    unsigned char key[10];
+    uint64_t hash = 1469598103934665603ULL;
+
+    memset(key, 0, sizeof(key));
+    key[0] = node->type;
+    key[1] = node->op;
+    if (node->type == CONST) {
+        memcpy(key + 2, &node->data.value, sizeof(double));
+    } else if (node->type != VAR) {
+        memcpy(key + 2, &node->data.child.left, sizeof(NodeId));
+        if (node->type == OPERATOR) memcpy(key + 6, &node->data.child.right, sizeof(NodeId));
+    }
+
+    for (size_t i = 0; i < sizeof(key); i++) {
+        hash ^= key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Compares two nodes structurally. Constants are compared bit for bit, so
+ * 0 and -0 stay distinct.
+ */
+static int same_node(const Node *a, const Node *b) {
+    if (a->type != b->type || a->op != b->op) return 0;
+    switch (a->type) {
+        case CONST:
+            return memcmp(&a->data.value, &b->data.value, sizeof(double)) == 0;
+        case VAR:
+            return 1;
+        case OPERATOR:
+            return a->data.child.left == b->data.child.left && a->data.child.right == b->data.child.right;
+        default:
+            return a->data.child.left == b->data.child.left;
+    }
+}
+
+/*
+ * Interns the live nodes in index order. Children precede their parents,
+ * so a node's children are already interned when it is looked up, and the
+ * nodes can be compacted in place.
+ */
+int share_subexpressions(ExprTree *tree) {
+    size_t table_size = 16;
+    while (table_size < (size_t)tree->count * 2) table_size *= 2;
+
+    unsigned char *live = mark_live_nodes(tree);
+    NodeId *map = (NodeId*)malloc((tree->count ? tree->count : 1) * sizeof(NodeId));
+    NodeId *table = (NodeId*)malloc(table_size * sizeof(NodeId));
+    if (live == NULL || map == NULL || table == NULL) {
+        free(live);
+        free(map);
+        free(table);
+        return 0;
+    }
+    for (size_t i = 0; i < table_size; i++) table[i] = NO_NODE;
+
+    NodeId count = 0;
+    for (NodeId i = 0; i < tree->count; i++) {
+        if (!live[i]) continue;
+        Node node = tree->nodes[i];
+        if (node.type == OPERATOR || node.type == FUNCTION) {
+            if (node.data.child.left != NO_NODE) node.data.child.left = map[node.data.child.left];
+            if (node.type == OPERATOR && node.data.child.right != NO_NODE) {
+                node.data.child.right = map[node.data.child.right];
+            }
+        }
+
+        size_t slot = (size_t)hash_node(&node) & (table_size - 1);
+        while (table[slot] != NO_NODE && !same_node(&tree->nodes[table[slot]], &node)) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        if (table[slot] != NO_NODE) {
+            map[i] = table[slot];
+            tree->deduplicated++;
+        } else {
+            tree->nodes[count] = node;
+            table[slot] = count;
+            map[i] = count++;
+        }
+    }
+    if (tree->root != NO_NODE) tree->root = map[tree->root];
+    tree->count = count;
+
+    free(live);
+    free(map);
+    free(table);
+    return 1;
+}
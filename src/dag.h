@@ -0,0 +1,22 @@
+#ifndef DAG_H
+#define DAG_H
+
+#include "parser.h"
+
+/**
+ * @brief Merges structurally identical subtrees into shared nodes.
+ *
+ * Every reachable node is interned in a hash table keyed by its type,
+ * operator and payload, with children already replaced by their interned
+ * copies, so repeated subterms such as the three copies of x^2+1 in
+ * sin(x^2+1)*cos(x^2+1)/(x^2+1) collapse into one node. The tree becomes a
+ * DAG in place, unreachable nodes are dropped, and the number of merged
+ * nodes is added to tree->deduplicated.
+ *
+ * @param[in,out] tree Pointer to the expression tree.
+ * @return int Returns 1 on success, 0 if memory allocation failed, in which
+ *         case the tree is left unchanged.
+ */
+int share_subexpressions(ExprTree *tree);
+
+#endif /* DAG_H */
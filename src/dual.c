@@ -0,0 +1,227 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dual.h"
+#include "utils.h"
+
+#define LN_10 2.30258509299404568402
+#define LOCAL_STACK_SIZE 64     /* Stack and slot entries evaluated without allocating */
+#define BATCH_BLOCK 256         /* Samples carried through the program at a time */
+
+/* Pair returned wherever the value is undefined */
+static Dual undefined_dual(void) {
+    Dual result;
+    result.value = create_nan();
+    result.slope = result.value;
+    return result;
+}
+
+/*
+ * Applies a binary operator to two dual numbers: the value by the
+ * interpreter's rules, the slope by the sum, product and quotient rules.
+ */
+static Dual dual_operator(OpCode opcode, Dual a, Dual b) {
+    Dual result;
+    result.value = run_operator(opcode, a.value, b.value);
+    if (is_nan(result.value)) return undefined_dual();
+
+    switch (opcode) {
+        case OP_ADD:
+            result.slope = a.slope + b.slope;
+            break;
+        case OP_SUB:
+            result.slope = a.slope - b.slope;
+            break;
+        case OP_MUL:
+            result.slope = a.slope * b.value + a.value * b.slope;
+            break;
+        case OP_DIV:
+            result.slope = (a.slope - result.value * b.slope) / b.value;
+            break;
+        case OP_POW:
+            /* A constant exponent keeps negative bases, otherwise d(a^b) = a^b (b' ln a + b a'/a) */
+            if (b.slope == 0) {
+                result.slope = a.slope == 0 ? 0.0 : b.value * pow(a.value, b.value - 1) * a.slope;
+            } else if (a.value > 0) {
+                result.slope = result.value * (b.slope * log(a.value) + b.value * a.slope / a.value);
+            } else {
+                result.slope = create_nan();
+            }
+            break;
+        default:
+            return undefined_dual();
+    }
+    return result;
+}
+
+/*
+ * Derivative of a function at its argument, given the function's value there.
+ */
+static double function_slope(OpCode opcode, double arg, double value) {
+    switch (opcode) {
+        case OP_SIN: return cos(arg);
+        case OP_COS: return -sin(arg);
+        case OP_TAN: return 1 + value * value;
+        case OP_ASIN: return 1 / sqrt(1 - arg * arg);
+        case OP_ACOS: return -1 / sqrt(1 - arg * arg);
+        case OP_ATAN: return 1 / (1 + arg * arg);
+        case OP_SINH: return cosh(arg);
+        case OP_COSH: return sinh(arg);
+        case OP_TANH: return 1 - value * value;
+        case OP_LN: return 1 / arg;
+        case OP_LOG: return 1 / (arg * LN_10);
+        case OP_EXP: return value;
+        case OP_ABS: return arg > 0 ? 1.0 : arg < 0 ? -1.0 : 0.0;
+        default: return create_nan();
+    }
+}
+
+/* Applies a function to a dual number by the chain rule */
+static Dual dual_function(OpCode opcode, Dual a) {
+    Dual result;
+    result.value = run_function(opcode, a.value);
+    if (is_nan(result.value)) return undefined_dual();
+
+    /* A constant argument stays constant even where the slope is unbounded */
+    result.slope = a.slope == 0 ? 0.0 : function_slope(opcode, a.value, result.value) * a.slope;
+    return result;
+}
+
+/*
+ * Runs the postfix program on a stack of dual numbers.
+ */
+Dual evaluate_program_dual(const Program *program, double x) {
+    if (!program || program->length == 0) return undefined_dual();
+
+    Dual local_stack[LOCAL_STACK_SIZE];
+    Dual *stack = local_stack;
+    size_t scratch_size = program->max_depth + program->slot_count;
+    if (scratch_size > LOCAL_STACK_SIZE) {
+        stack = (Dual*)malloc(scratch_size * sizeof(Dual));
+        if (stack == NULL) return undefined_dual();
+    }
+    Dual *slots = stack + program->max_depth;
+
+    size_t sp = 0;
+    for (size_t i = 0; i < program->length; i++) {
+        const Instruction *instruction = &program->code[i];
+        switch (instruction->opcode) {
+            case OP_CONST:
+                stack[sp].value = instruction->value;
+                stack[sp++].slope = 0.0;
+                break;
+            case OP_VAR:
+                stack[sp].value = x;
+                stack[sp++].slope = 1.0;
+                break;
+            case OP_NAN:
+                stack[sp++] = undefined_dual();
+                break;
+            case OP_LOAD:
+                stack[sp++] = slots[instruction->slot];
+                break;
+            case OP_STORE:
+                slots[instruction->slot] = stack[sp - 1];
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_POW:
+                sp--;
+                stack[sp - 1] = dual_operator(instruction->opcode, stack[sp - 1], stack[sp]);
+                break;
+            default:
+                stack[sp - 1] = dual_function(instruction->opcode, stack[sp - 1]);
+                break;
+        }
+    }
+
+    /* A well-formed program leaves exactly its result on the stack */
+    Dual result = sp > 0 ? stack[sp - 1] : undefined_dual();
+    if (stack != local_stack) free(stack);
+    return result;
+}
+
+/* Stores the results of one sample in the requested outputs */
+static void store_dual(Dual result, double *values, double *slopes, size_t i) {
+    if (values) values[i] = result.value;
+    if (slopes) slopes[i] = result.slope;
+}
+
+/*
+ * Runs the postfix program over blocks of samples, each stack entry holding
+ * the dual numbers of a whole block.
+ */
+void evaluate_program_dual_batch(const Program *program, const double *xs, double *values, double *slopes, size_t n) {
+    if (!program || program->length == 0) {
+        for (size_t i = 0; i < n; i++) store_dual(undefined_dual(), values, slopes, i);
+        return;
+    }
+
+    Dual *stack = (Dual*)malloc((program->max_depth + program->slot_count) * BATCH_BLOCK * sizeof(Dual));
+    if (stack == NULL) {
+        for (size_t i = 0; i < n; i++) {
+            Dual result = evaluate_program_dual(program, xs[i]);
+            store_dual(result, values, slopes, i);
+        }
+        return;
+    }
+    Dual *slots = stack + program->max_depth * BATCH_BLOCK;
+    Dual undefined = undefined_dual();
+
+    for (size_t start = 0; start < n; start += BATCH_BLOCK) {
+        size_t count = n - start < BATCH_BLOCK ? n - start : BATCH_BLOCK;
+        Dual *top = stack - BATCH_BLOCK;
+
+        for (size_t i = 0; i < program->length; i++) {
+            const Instruction *instruction = &program->code[i];
+            switch (instruction->opcode) {
+                case OP_CONST:
+                    top += BATCH_BLOCK;
+                    for (size_t j = 0; j < count; j++) {
+                        top[j].value = instruction->value;
+                        top[j].slope = 0.0;
+                    }
+                    break;
+                case OP_VAR:
+                    top += BATCH_BLOCK;
+                    for (size_t j = 0; j < count; j++) {
+                        top[j].value = xs[start + j];
+                        top[j].slope = 1.0;
+                    }
+                    break;
+                case OP_NAN:
+                    top += BATCH_BLOCK;
+                    for (size_t j = 0; j < count; j++) top[j] = undefined;
+                    break;
+                case OP_LOAD:
+                    top += BATCH_BLOCK;
+                    memcpy(top, slots + instruction->slot * BATCH_BLOCK, count * sizeof(Dual));
+                    break;
+                case OP_STORE:
+                    memcpy(slots + instruction->slot * BATCH_BLOCK, top, count * sizeof(Dual));
+                    break;
+                case OP_ADD:
+                case OP_SUB:
+                case OP_MUL:
+                case OP_DIV:
+                case OP_POW:
+                    top -= BATCH_BLOCK;
+                    for (size_t j = 0; j < count; j++) {
+                        top[j] = dual_operator(instruction->opcode, top[j], top[j + BATCH_BLOCK]);
+                    }
+                    break;
+                default:
+                    for (size_t j = 0; j < count; j++) {
+                        top[j] = dual_function(instruction->opcode, top[j]);
+                    }
+                    break;
+            }
+        }
+        /* Inputs of the block are consumed, so the outputs may overwrite them */
+        for (size_t j = 0; j < count; j++) store_dual(stack[j], values, slopes, start + j);
+    }
+
+    free(stack);
+}
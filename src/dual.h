@@ -0,0 +1,47 @@
+#ifndef DUAL_H
+#define DUAL_H
+
+#include <stddef.h>
+#include "bytecode.h"
+
+/**
+ * @brief Value of an expression together with its derivative with respect to 'x'.
+ */
+typedef struct {
+    double value;   /**< Value of the expression, NaN where undefined */
+    double slope;   /**< Derivative at the same 'x', NaN where the value is NaN */
+} Dual;
+
+/**
+ * @brief Evaluates a compiled program and its derivative for a given value of 'x'.
+ *
+ * Every instruction carries a dual number through the program, so both
+ * come out of one pass. Values follow evaluate_program() exactly. Slopes use
+ * the chain rule for every operator and function. They are NaN wherever the
+ * value is NaN, and where a power with a varying exponent has a non-positive
+ * base. The slope of |u| where u is 0 is taken as 0, and slopes may be
+ * infinite at vertical tangents.
+ *
+ * @param[in] program Pointer to the compiled program; its 'derivative' flag is ignored.
+ * @param[in] x The value of the variable 'x'.
+ * @return Dual Returns the value and the derivative.
+ */
+Dual evaluate_program_dual(const Program *program, double x);
+
+/**
+ * @brief Evaluates a compiled program and its derivative for an array of 'x' values.
+ *
+ * Like evaluate_program_batch(), each instruction is applied to a block of
+ * samples at a time. Results are identical to calling
+ * evaluate_program_dual() for each element.
+ *
+ * @param[in] program Pointer to the compiled program; its 'derivative' flag is ignored.
+ * @param[in] xs Array of 'x' values.
+ * @param[out] values Array receiving the values, or NULL if not needed.
+ * @param[out] slopes Array receiving the derivatives, or NULL if not needed.
+ *             Either output may alias xs, but not the other output.
+ * @param[in] n Number of values in each array.
+ */
+void evaluate_program_dual_batch(const Program *program, const double *xs, double *values, double *slopes, size_t n);
+
+#endif /* DUAL_H */
@@ -0,0 +1,324 @@
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include "interval.h"
+
+#define PI 3.14159265358979323846
+#define LOCAL_STACK_SIZE 64     /* Stack and slot entries evaluated without allocating */
+#define LIBM_ULPS 4             /* Outward rounding of libm results, which may be off by an ulp or two */
+#define MAX_PHASE 1e6           /* Largest |x| for which the critical points of sin, cos and tan are located */
+#define PHASE_TOLERANCE 1e-6    /* Distance within which a critical point counts as inside the range */
+
+/* Builds an interval, or the empty one if the bounds are reversed */
+static Interval make_interval(double lo, double hi, int partial) {
+    Interval result;
+    result.lo = lo;
+    result.hi = hi;
+    result.partial = partial || !(lo <= hi);
+    return result;
+}
+
+static Interval empty_interval(void) {
+    return make_interval(INFINITY, -INFINITY, 1);
+}
+
+int interval_is_empty(Interval interval) {
+    return !(interval.lo <= interval.hi);
+}
+
+/* Moves a bound a number of ulps down or up */
+static double round_down(double value, int ulps) {
+    while (ulps-- > 0) value = nextafter(value, -INFINITY);
+    return value;
+}
+
+static double round_up(double value, int ulps) {
+    while (ulps-- > 0) value = nextafter(value, INFINITY);
+    return value;
+}
+
+/* Rounds both bounds of a computed interval outward */
+static Interval widen(double lo, double hi, int partial, int ulps) {
+    return make_interval(round_down(lo, ulps), round_up(hi, ulps), partial);
+}
+
+/* Hull of up to four candidate bounds, rounded outward */
+static Interval hull(const double *values, int count, int partial, int ulps) {
+    double lo = values[0], hi = values[0];
+    for (int i = 1; i < count; i++) {
+        lo = fmin(lo, values[i]);
+        hi = fmax(hi, values[i]);
+    }
+    return widen(lo, hi, partial, ulps);
+}
+
+/*
+ * Drops infinite values from an operand: operators and functions give NaN
+ * for them, so only the finite part of the range contributes to the result.
+ */
+static Interval finite_part(Interval a) {
+    if (a.lo < -DBL_MAX) {
+        a.lo = -DBL_MAX;
+        a.partial = 1;
+    }
+    if (a.hi > DBL_MAX) {
+        a.hi = DBL_MAX;
+        a.partial = 1;
+    }
+    return make_interval(a.lo, a.hi, a.partial);
+}
+
+/* Quotient bounds for a divisor range of one sign */
+static Interval divide_same_sign(Interval a, double b_lo, double b_hi, int partial) {
+    double corners[4] = { a.lo / b_lo, a.lo / b_hi, a.hi / b_lo, a.hi / b_hi };
+    return hull(corners, 4, partial, 1);
+}
+
+/* Combines two results that each cover part of the operand range */
+static Interval join(Interval a, Interval b) {
+    if (interval_is_empty(a)) return b;
+    if (interval_is_empty(b)) return a;
+    return make_interval(fmin(a.lo, b.lo), fmax(a.hi, b.hi), a.partial || b.partial);
+}
+
+/*
+ * Division leaves out the divisors within MIN_DIVISOR of zero and bounds
+ * the negative and positive divisors separately.
+ */
+static Interval interval_divide(Interval a, Interval b, int partial) {
+    Interval negative = empty_interval(), positive = empty_interval();
+
+    if (b.lo < MIN_DIVISOR && b.hi > -MIN_DIVISOR) partial = 1;
+    if (b.lo <= -MIN_DIVISOR) negative = divide_same_sign(a, b.lo, fmin(b.hi, -MIN_DIVISOR), partial);
+    if (b.hi >= MIN_DIVISOR) positive = divide_same_sign(a, fmax(b.lo, MIN_DIVISOR), b.hi, partial);
+    if (interval_is_empty(negative) && interval_is_empty(positive)) return empty_interval();
+    return join(negative, positive);
+}
+
+/*
+ * Powers of negative numbers with a constant integer exponent, which are
+ * monotonic on either side of zero.
+ */
+static Interval integer_power(Interval a, double n, int partial) {
+    double at_lo = pow(a.lo, n), at_hi = pow(a.hi, n);
+    int spans_zero = a.lo <= 0 && a.hi >= 0;
+
+    if (n == 0) return make_interval(1.0, 1.0, partial);
+    if (n < 0 && spans_zero) return make_interval(-INFINITY, INFINITY, 1);
+    if (n > 0 && fmod(n, 2.0) == 0 && spans_zero) return widen(0.0, fmax(at_lo, at_hi), partial, LIBM_ULPS);
+    return widen(fmin(at_lo, at_hi), fmax(at_lo, at_hi), partial, LIBM_ULPS);
+}
+
+/*
+ * Powers follow the interpreter: negative bases need integer exponents and
+ * results reaching MAX_VALUE in magnitude are NaN. For non-negative bases
+ * a^b = exp(b ln a) is extreme at the corners of the operand ranges.
+ */
+static Interval interval_power(Interval a, Interval b, int partial) {
+    Interval result;
+
+    if (a.lo < 0 && b.lo == b.hi && floor(b.lo) == b.lo) {
+        result = integer_power(a, b.lo, partial);
+    } else {
+        if (a.lo < 0) {
+            /* Any integer exponent lets negative bases through with either sign */
+            if (floor(b.hi) >= b.lo) return make_interval(-MAX_VALUE, MAX_VALUE, 1);
+            if (a.hi < 0) return empty_interval();
+            a.lo = 0.0;
+            partial = 1;
+        }
+        double corners[4] = { pow(a.lo, b.lo), pow(a.lo, b.hi), pow(a.hi, b.lo), pow(a.hi, b.hi) };
+        result = hull(corners, 4, partial, LIBM_ULPS);
+    }
+
+    if (result.lo <= -MAX_VALUE) {
+        result.lo = -MAX_VALUE;
+        result.partial = 1;
+    }
+    if (result.hi >= MAX_VALUE) {
+        result.hi = MAX_VALUE;
+        result.partial = 1;
+    }
+    if (result.lo >= MAX_VALUE || result.hi <= -MAX_VALUE) return empty_interval();
+    return result;
+}
+
+/* Applies a binary operator to two operand ranges */
+static Interval interval_operator(OpCode opcode, Interval a, Interval b) {
+    a = finite_part(a);
+    b = finite_part(b);
+    if (interval_is_empty(a) || interval_is_empty(b)) return empty_interval();
+
+    int partial = a.partial || b.partial;
+    switch (opcode) {
+        case OP_ADD:
+            return widen(a.lo + b.lo, a.hi + b.hi, partial, 1);
+        case OP_SUB:
+            return widen(a.lo - b.hi, a.hi - b.lo, partial, 1);
+        case OP_MUL: {
+            double corners[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+            return hull(corners, 4, partial, 1);
+        }
+        case OP_DIV:
+            return interval_divide(a, b, partial);
+        case OP_POW:
+            return interval_power(a, b, partial);
+        default:
+            return empty_interval();
+    }
+}
+
+/* Checks whether phase + k * period lies in [lo, hi] for some integer k */
+static int contains_phase(double lo, double hi, double phase, double period) {
+    double k = ceil((lo - PHASE_TOLERANCE - phase) / period);
+    return phase + k * period <= hi + PHASE_TOLERANCE;
+}
+
+/* Sine and cosine reach their extremes at the peaks and troughs inside the range */
+static Interval interval_periodic(OpCode opcode, Interval a) {
+    double (*function)(double) = opcode == OP_SIN ? sin : cos;
+    double peak = opcode == OP_SIN ? PI / 2 : 0.0;
+
+    if (a.hi - a.lo >= 2 * PI || fabs(a.lo) > MAX_PHASE || fabs(a.hi) > MAX_PHASE) {
+        return make_interval(-1.0, 1.0, a.partial);
+    }
+    double at_lo = function(a.lo), at_hi = function(a.hi);
+    Interval result = widen(fmin(at_lo, at_hi), fmax(at_lo, at_hi), a.partial, LIBM_ULPS);
+    if (contains_phase(a.lo, a.hi, peak, 2 * PI)) result.hi = 1.0;
+    if (contains_phase(a.lo, a.hi, peak + PI, 2 * PI)) result.lo = -1.0;
+    result.lo = fmax(result.lo, -1.0);
+    result.hi = fmin(result.hi, 1.0);
+    return result;
+}
+
+/* Bounds an increasing function from its values at the ends of the range */
+static Interval increasing(double (*function)(double), Interval a) {
+    return widen(function(a.lo), function(a.hi), a.partial, LIBM_ULPS);
+}
+
+/* Applies a function to an argument range */
+static Interval interval_function(OpCode opcode, Interval a) {
+    a = finite_part(a);
+    if (interval_is_empty(a)) return empty_interval();
+
+    switch (opcode) {
+        case OP_SIN:
+        case OP_COS:
+            return interval_periodic(opcode, a);
+        case OP_TAN:
+            /* Near a pole tan() is finite but unbounded */
+            if (a.hi - a.lo >= PI || fabs(a.lo) > MAX_PHASE || fabs(a.hi) > MAX_PHASE ||
+                contains_phase(a.lo, a.hi, PI / 2, PI)) {
+                return make_interval(-DBL_MAX, DBL_MAX, a.partial);
+            }
+            return increasing(tan, a);
+        case OP_ASIN:
+        case OP_ACOS:
+            if (a.lo < -1.0 || a.hi > 1.0) a.partial = 1;
+            a = make_interval(fmax(a.lo, -1.0), fmin(a.hi, 1.0), a.partial);
+            if (interval_is_empty(a)) return empty_interval();
+            if (opcode == OP_ASIN) return increasing(asin, a);
+            return widen(acos(a.hi), acos(a.lo), a.partial, LIBM_ULPS);
+        case OP_ATAN: return increasing(atan, a);
+        case OP_SINH: return increasing(sinh, a);
+        case OP_TANH: return increasing(tanh, a);
+        case OP_EXP: return increasing(exp, a);
+        case OP_COSH:
+            if (a.lo <= 0 && a.hi >= 0) return widen(1.0, fmax(cosh(a.lo), cosh(a.hi)), a.partial, LIBM_ULPS);
+            return widen(fmin(cosh(a.lo), cosh(a.hi)), fmax(cosh(a.lo), cosh(a.hi)), a.partial, LIBM_ULPS);
+        case OP_LN:
+        case OP_LOG:
+            if (a.hi <= 0) return empty_interval();
+            if (a.lo <= 0) {
+                a.lo = nextafter(0.0, 1.0);
+                a.partial = 1;
+            }
+            return increasing(opcode == OP_LN ? log : log10, a);
+        case OP_ABS:
+            if (a.lo <= 0 && a.hi >= 0) return make_interval(0.0, fmax(-a.lo, a.hi), a.partial);
+            return make_interval(fmin(fabs(a.lo), fabs(a.hi)), fmax(fabs(a.lo), fabs(a.hi)), a.partial);
+        default:
+            return empty_interval();
+    }
+}
+
+/*
+ * Runs the postfix program on a stack of intervals, the way
+ * evaluate_program() runs it on values.
+ */
+Interval evaluate_program_interval(const Program *program, double x_min, double x_max) {
+    if (!program || program->length == 0) return empty_interval();
+    /* Derivatives are not bounded; nothing can be ruled out for them */
+    if (program->derivative) return make_interval(-INFINITY, INFINITY, 1);
+
+    Interval local_stack[LOCAL_STACK_SIZE];
+    Interval *stack = local_stack;
+    size_t scratch_size = program->max_depth + program->slot_count;
+    if (scratch_size > LOCAL_STACK_SIZE) {
+        stack = (Interval*)malloc(scratch_size * sizeof(Interval));
+        if (stack == NULL) return make_interval(-INFINITY, INFINITY, 1);
+    }
+    Interval *slots = stack + program->max_depth;
+    Interval x = make_interval(fmin(x_min, x_max), fmax(x_min, x_max), 0);
+
+    size_t sp = 0;
+    for (size_t i = 0; i < program->length; i++) {
+        const Instruction *instruction = &program->code[i];
+        switch (instruction->opcode) {
+            case OP_CONST:
+                stack[sp++] = make_interval(instruction->value, instruction->value, 0);
+                break;
+            case OP_VAR:
+                stack[sp++] = x;
+                break;
+            case OP_NAN:
+                stack[sp++] = empty_interval();
+                break;
+            case OP_LOAD:
+                stack[sp++] = slots[instruction->slot];
+                break;
+            case OP_STORE:
+                slots[instruction->slot] = stack[sp - 1];
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_POW:
+                sp--;
+                stack[sp - 1] = interval_operator(instruction->opcode, stack[sp - 1], stack[sp]);
+                break;
+            default:
+                stack[sp - 1] = interval_function(instruction->opcode, stack[sp - 1]);
+                break;
+        }
+    }
+
+    Interval result = stack[0];
+    if (stack != local_stack) free(stack);
+    return result;
+}
+
+/*
+ * Bisects [x_min, x_max] while its bounds reach beyond those found so far.
+ */
+static void bound_range(const Program *program, double x_min, double x_max, int depth, Interval *found) {
+    Interval bound = evaluate_program_interval(program, x_min, x_max);
+    if (interval_is_empty(bound)) return;
+    if (!interval_is_empty(*found) && bound.lo >= found->lo && bound.hi <= found->hi) return;
+
+    double x_mid = x_min + (x_max - x_min) / 2;
+    if (depth <= 0 || x_mid <= x_min || x_mid >= x_max) {
+        *found = join(*found, bound);
+        return;
+    }
+    bound_range(program, x_min, x_mid, depth - 1, found);
+    bound_range(program, x_mid, x_max, depth - 1, found);
+}
+
+/* Combines the bounds of the pieces of a recursively bisected range */
+Interval bound_program(const Program *program, double x_min, double x_max, int depth) {
+    Interval found = empty_interval();
+    bound_range(program, fmin(x_min, x_max), fmax(x_min, x_max), depth, &found);
+    return found;
+}
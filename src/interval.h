@@ -0,0 +1,65 @@
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include "bytecode.h"
+
+/**
+ * @brief Bounds of the values an expression takes over a range of 'x'.
+ *
+ * Every defined value lies within [lo, hi]; infinite bounds mean the value
+ * may overflow. A value may also be NaN, which the bounds say nothing
+ * about unless 'partial' is 0. An empty interval, with lo greater than hi,
+ * means the expression is NaN everywhere in the range.
+ */
+typedef struct {
+    double lo;      /**< Lower bound of the defined values */
+    double hi;      /**< Upper bound of the defined values */
+    int partial;    /**< Nonzero if some values in the range may be NaN */
+} Interval;
+
+/**
+ * @brief Checks whether an interval holds no values.
+ *
+ * @param[in] interval The interval to check.
+ * @return int Returns 1 if the expression it bounds is NaN everywhere, otherwise 0.
+ */
+int interval_is_empty(Interval interval);
+
+/**
+ * @brief Evaluates a compiled program over a whole range of 'x' at once.
+ *
+ * Every operator and function is evaluated with interval arithmetic that
+ * follows the NaN rules of evaluate_program(): divisors smaller than MIN_DIVISOR,
+ * logarithms of non-positive numbers, inverse sines and cosines outside
+ * [-1, 1], non-integer powers of negative numbers and powers reaching
+ * MAX_VALUE are all treated as NaN. Bounds are rounded outward, so for every
+ * 'x' in the range evaluate_program() returns either NaN or a value within
+ * the result. The bounds are not always tight: each use of a variable or
+ * shared slot is bounded independently. Programs with the 'derivative' flag
+ * set get unbounded results.
+ *
+ * @param[in] program Pointer to the compiled program.
+ * @param[in] x_min The lowest value of 'x'.
+ * @param[in] x_max The highest value of 'x'.
+ * @return Interval Returns the bounds, or unbounded ones if memory allocation failed.
+ */
+Interval evaluate_program_interval(const Program *program, double x_min, double x_max);
+
+/**
+ * @brief Bounds a compiled program over [x_min, x_max] by recursive subdivision.
+ *
+ * The range is bisected up to 'depth' times and the bounds of the pieces are
+ * combined, which tightens the overestimate of a single interval
+ * evaluation. Pieces whose bounds already lie within those found so far are
+ * not subdivided, so at most 2^(depth+1) - 1 evaluations are made.
+ *
+ * @param[in] program Pointer to the compiled program.
+ * @param[in] x_min The lowest value of 'x'.
+ * @param[in] x_max The highest value of 'x'.
+ * @param[in] depth The number of times the range may be bisected.
+ * @return Interval Returns bounds holding every defined value of the
+ *         program over the range; empty if the program is NaN throughout.
+ */
+Interval bound_program(const Program *program, double x_min, double x_max, int depth);
+
+#endif /* INTERVAL_H */
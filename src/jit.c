@@ -0,0 +1,558 @@
+#define _DEFAULT_SOURCE
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+#include "parser.h"
+#include "utils.h"
+
+#if defined(__x86_64__) && defined(__GNUC__) && (defined(__unix__) || defined(__APPLE__))
+#include <sys/mman.h>
+#define HAVE_X86_64_JIT 1
+#endif
+
+#ifdef HAVE_X86_64_JIT
+
+/* General purpose registers */
+#define RAX 0
+#define RBX 3
+#define RSP 4
+#define R12 12
+#define R13 13
+#define R14 14
+
+/* SSE2 opcodes, after the 0x0F escape */
+#define MOVUPD_LOAD 0x10    /* Also MOVSD load with the 0xF2 prefix */
+#define MOVUPD_STORE 0x11   /* Also MOVSD store with the 0xF2 prefix */
+#define MOVAPD_LOAD 0x28
+#define MOVAPD_STORE 0x29
+#define UCOMISD 0x2E
+#define ANDPD 0x54
+#define ANDNPD 0x55
+#define ORPD 0x56
+#define XORPD 0x57
+#define ADDPD 0x58
+#define MULPD 0x59
+#define SUBPD 0x5C
+#define DIVPD 0x5E
+#define CMPPD 0xC2
+
+#define PACKED 0x66         /* Prefix of packed double instructions */
+#define SCALAR 0xF2         /* Prefix of scalar double instructions */
+#define CMP_LE 2            /* CMPPD predicate: less or equal, false for NaN */
+#define MAX_LANES 4         /* Samples per iteration with AVX */
+
+/* Constant pool entries, one copy of each value per lane */
+enum { POOL_ABS, POOL_MAX, POOL_MIN_DIVISOR, POOL_NAN, POOL_PROGRAM };
+
+#define MAX_INSTRUCTION_CODE 1024   /* Upper bound of the code emitted per instruction */
+#define PROLOG_CODE 128             /* Upper bound of the code around the instructions */
+#define MAX_FRAME_SIZE 65536        /* Largest stack frame, allocated without probing */
+#define MAX_MAPPING_SIZE (64u << 20)    /* Largest mapping of constants and code */
+
+/* Machine code being written into a buffer */
+typedef struct {
+    unsigned char *code;
+    size_t length;
+    size_t origin;      /* Offset of the code from the constant pool */
+    int avx;            /* Emit VEX-encoded instructions on 256-bit ymm registers */
+    int32_t vector;     /* Bytes per vector: 16 for SSE2, 32 for AVX */
+} Emitter;
+
+/* Offsets into the stack frame, which is addressed through rbx */
+typedef struct {
+    int32_t temp_a;     /* Lanes passed to libm, and their results */
+    int32_t temp_b;     /* Second operand of powers */
+    int32_t spill;      /* Register stack saved across calls */
+    int32_t stack;      /* Stack positions beyond the registers */
+    int32_t slots;      /* Shared subexpression values */
+    int32_t size;
+} FrameLayout;
+
+static void emit_byte(Emitter *e, int value) {
+    e->code[e->length++] = (unsigned char)value;
+}
+
+static void emit_int32(Emitter *e, int32_t value) {
+    memcpy(e->code + e->length, &value, sizeof(value));
+    e->length += sizeof(value);
+}
+
+static void emit_int64(Emitter *e, uint64_t value) {
+    memcpy(e->code + e->length, &value, sizeof(value));
+    e->length += sizeof(value);
+}
+
+/* REX prefix for registers 8-15, emitted only when needed */
+static void emit_rex(Emitter *e, int wide, int reg, int base) {
+    int rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+    if (rex != 0x40) emit_byte(e, rex);
+}
+
+/*
+ * VEX prefix replacing the legacy prefix, REX and 0x0F escape. Packed
+ * instructions other than UCOMISD work on all 256 bits; moves and compares
+ * into flags take no second source, which VEX encodes like xmm0.
+ */
+static void emit_vex(Emitter *e, int prefix, int opcode, int reg, int rm) {
+    int pp = prefix == PACKED ? 1 : prefix == SCALAR ? 3 : 0;
+    int wide = prefix == PACKED && opcode != UCOMISD;
+    int moves = opcode == MOVUPD_LOAD || opcode == MOVUPD_STORE || opcode == MOVAPD_LOAD ||
+                opcode == MOVAPD_STORE || opcode == UCOMISD;
+    int source = moves ? 0 : reg;
+
+    emit_byte(e, 0xC4);
+    emit_byte(e, ((reg & 8) ? 0 : 0x80) | 0x40 | ((rm & 8) ? 0 : 0x20) | 0x01);
+    emit_byte(e, (~source & 15) << 3 | (wide ? 4 : 0) | pp);
+    emit_byte(e, opcode);
+}
+
+/* Memory operands of VEX moves need no alignment only in their unaligned form */
+static int memory_opcode(const Emitter *e, int opcode) {
+    if (!e->avx) return opcode;
+    if (opcode == MOVAPD_LOAD) return MOVUPD_LOAD;
+    if (opcode == MOVAPD_STORE) return MOVUPD_STORE;
+    return opcode;
+}
+
+/* op xmm_reg, xmm_rm */
+static void sse_rr(Emitter *e, int prefix, int opcode, int reg, int rm) {
+    if (e->avx) {
+        emit_vex(e, prefix, opcode, reg, rm);
+        emit_byte(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+        return;
+    }
+    emit_byte(e, prefix);
+    emit_rex(e, 0, reg, rm);
+    emit_byte(e, 0x0F);
+    emit_byte(e, opcode);
+    emit_byte(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* op xmm_reg, [base + disp32] */
+static void sse_mem(Emitter *e, int prefix, int opcode, int reg, int base, int32_t disp) {
+    opcode = memory_opcode(e, opcode);
+    if (e->avx) {
+        emit_vex(e, prefix, opcode, reg, base);
+    } else {
+        emit_byte(e, prefix);
+        emit_rex(e, 0, reg, base);
+        emit_byte(e, 0x0F);
+        emit_byte(e, opcode);
+    }
+    emit_byte(e, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == RSP) emit_byte(e, 0x24);
+    emit_int32(e, disp);
+}
+
+/* op xmm_reg, [rip + pool entry], with an optional trailing immediate */
+static void sse_pool(Emitter *e, int prefix, int opcode, int reg, size_t entry, int imm) {
+    opcode = memory_opcode(e, opcode);
+    if (e->avx) {
+        emit_vex(e, prefix, opcode, reg, 0);
+    } else {
+        emit_byte(e, prefix);
+        emit_rex(e, 0, reg, 0);
+        emit_byte(e, 0x0F);
+        emit_byte(e, opcode);
+    }
+    emit_byte(e, 0x05 | (reg & 7) << 3);
+    /* RIP points past the displacement and the immediate */
+    int64_t end = (int64_t)(e->origin + e->length) + 4 + (imm >= 0 ? 1 : 0);
+    emit_int32(e, (int32_t)((int64_t)entry * e->vector - end));
+    if (imm >= 0) emit_byte(e, imm);
+}
+
+/* Stack position p lives in xmm8 + p, or in the frame */
+static void load_position(Emitter *e, const FrameLayout *frame, int xmm, size_t p) {
+    if (p < JIT_REGISTER_STACK) {
+        if (xmm != (int)(8 + p)) sse_rr(e, PACKED, MOVAPD_LOAD, xmm, (int)(8 + p));
+    } else {
+        sse_mem(e, PACKED, MOVAPD_LOAD, xmm, RBX, frame->stack + e->vector * (int32_t)(p - JIT_REGISTER_STACK));
+    }
+}
+
+static void store_position(Emitter *e, const FrameLayout *frame, size_t p, int xmm) {
+    if (p < JIT_REGISTER_STACK) {
+        if (xmm != (int)(8 + p)) sse_rr(e, PACKED, MOVAPD_LOAD, (int)(8 + p), xmm);
+    } else {
+        sse_mem(e, PACKED, MOVAPD_STORE, xmm, RBX, frame->stack + e->vector * (int32_t)(p - JIT_REGISTER_STACK));
+    }
+}
+
+/* Saves or restores the register stack below position 'count' around a call */
+static void spill_registers(Emitter *e, const FrameLayout *frame, size_t count, int save) {
+    for (size_t q = 0; q < count && q < JIT_REGISTER_STACK; q++) {
+        sse_mem(e, PACKED, save ? MOVAPD_STORE : MOVAPD_LOAD, (int)(8 + q), RBX, frame->spill + e->vector * (int32_t)q);
+    }
+}
+
+/* libm is SSE code, so the upper halves are cleared first to avoid AVX-SSE transition stalls */
+static void emit_call(Emitter *e, const void *function) {
+    if (e->avx) {
+        emit_byte(e, 0xC5); emit_byte(e, 0xF8); emit_byte(e, 0x77);    /* vzeroupper */
+    }
+    emit_rex(e, 1, 0, 0);
+    emit_byte(e, 0xB8 | RAX);               /* mov rax, imm64 */
+    emit_int64(e, (uint64_t)(uintptr_t)function);
+    emit_byte(e, 0xFF);                     /* call rax */
+    emit_byte(e, 0xD0 | RAX);
+}
+
+/* Short forward jump whose target is patched later; returns the offset to patch */
+static size_t emit_jump(Emitter *e, int opcode) {
+    emit_byte(e, opcode);
+    emit_byte(e, 0);
+    return e->length - 1;
+}
+
+static void patch_jump(Emitter *e, size_t at) {
+    e->code[at] = (unsigned char)(e->length - at - 1);
+}
+
+/*
+ * Power with the domain rules of the interpreter, called once per lane.
+ */
+static double checked_pow(double base, double exponent) {
+    if (!isfinite(base) || !isfinite(exponent)) return create_nan();
+    if (base < 0 && floor(exponent) != exponent) return create_nan();
+    double result = pow(base, exponent);
+    return isfinite(result) && fabs(result) < MAX_VALUE ? result : create_nan();
+}
+
+/* libm function computing an opcode, NULL for opcodes handled inline */
+static const void* libm_function(OpCode opcode) {
+    switch (opcode) {
+        case OP_SIN: return (const void*)sin;
+        case OP_COS: return (const void*)cos;
+        case OP_TAN: return (const void*)tan;
+        case OP_ASIN: return (const void*)asin;
+        case OP_ACOS: return (const void*)acos;
+        case OP_ATAN: return (const void*)atan;
+        case OP_SINH: return (const void*)sinh;
+        case OP_COSH: return (const void*)cosh;
+        case OP_TANH: return (const void*)tanh;
+        case OP_LN: return (const void*)log;
+        case OP_LOG: return (const void*)log10;
+        case OP_EXP: return (const void*)exp;
+        default: return NULL;
+    }
+}
+
+/*
+ * Arithmetic on all lanes. Lanes with a non-finite operand, or a divisor
+ * below MIN_DIVISOR, become NaN, exactly as in the interpreter's vector kernels.
+ */
+static void emit_arithmetic(Emitter *e, const FrameLayout *frame, OpCode opcode, size_t p) {
+    load_position(e, frame, 0, p);
+    load_position(e, frame, 1, p + 1);
+    sse_rr(e, PACKED, MOVAPD_LOAD, 2, 0);
+    sse_pool(e, PACKED, ANDPD, 2, POOL_ABS, -1);
+    sse_pool(e, PACKED, CMPPD, 2, POOL_MAX, CMP_LE);
+    sse_rr(e, PACKED, MOVAPD_LOAD, 3, 1);
+    sse_pool(e, PACKED, ANDPD, 3, POOL_ABS, -1);
+    sse_rr(e, PACKED, MOVAPD_LOAD, 4, 3);
+    sse_pool(e, PACKED, CMPPD, 4, POOL_MAX, CMP_LE);
+    sse_rr(e, PACKED, ANDPD, 2, 4);
+    if (opcode == OP_DIV) {
+        sse_pool(e, PACKED, MOVAPD_LOAD, 5, POOL_MIN_DIVISOR, -1);
+        sse_rr(e, PACKED, CMPPD, 5, 3);
+        emit_byte(e, CMP_LE);
+        sse_rr(e, PACKED, ANDPD, 2, 5);
+    }
+    switch (opcode) {
+        case OP_ADD: sse_rr(e, PACKED, ADDPD, 0, 1); break;
+        case OP_SUB: sse_rr(e, PACKED, SUBPD, 0, 1); break;
+        case OP_MUL: sse_rr(e, PACKED, MULPD, 0, 1); break;
+        default: sse_rr(e, PACKED, DIVPD, 0, 1); break;
+    }
+    sse_rr(e, PACKED, ANDPD, 0, 2);
+    sse_pool(e, PACKED, ANDNPD, 2, POOL_NAN, -1);
+    sse_rr(e, PACKED, ORPD, 0, 2);
+    store_position(e, frame, p, 0);
+}
+
+/* |x| on all lanes, NaN for non-finite lanes */
+static void emit_abs(Emitter *e, const FrameLayout *frame, size_t p) {
+    load_position(e, frame, 0, p);
+    sse_pool(e, PACKED, ANDPD, 0, POOL_ABS, -1);
+    sse_rr(e, PACKED, MOVAPD_LOAD, 1, 0);
+    sse_pool(e, PACKED, CMPPD, 1, POOL_MAX, CMP_LE);
+    sse_rr(e, PACKED, ANDPD, 0, 1);
+    sse_pool(e, PACKED, ANDNPD, 1, POOL_NAN, -1);
+    sse_rr(e, PACKED, ORPD, 0, 1);
+    store_position(e, frame, p, 0);
+}
+
+/*
+ * Calls libm once per lane. Non-finite arguments, and for the logarithms
+ * arguments that are not positive, skip the call and yield NaN.
+ */
+static void emit_function(Emitter *e, const FrameLayout *frame, OpCode opcode, size_t p) {
+    load_position(e, frame, 0, p);
+    sse_mem(e, PACKED, MOVAPD_STORE, 0, RBX, frame->temp_a);
+    spill_registers(e, frame, p, 1);
+
+    for (int lane = 0; lane < e->vector / 8; lane++) {
+        size_t to_nan[2];
+        int checks = 0;
+
+        sse_mem(e, SCALAR, MOVUPD_LOAD, 0, RBX, frame->temp_a + 8 * lane);
+        sse_rr(e, PACKED, MOVAPD_LOAD, 1, 0);
+        sse_pool(e, PACKED, ANDPD, 1, POOL_ABS, -1);
+        sse_pool(e, SCALAR, MOVUPD_LOAD, 2, POOL_MAX, -1);
+        sse_rr(e, PACKED, UCOMISD, 2, 1);
+        to_nan[checks++] = emit_jump(e, 0x72);          /* jb: |x| > DBL_MAX or NaN */
+        if (opcode == OP_LN || opcode == OP_LOG) {
+            sse_rr(e, PACKED, XORPD, 1, 1);
+            sse_rr(e, PACKED, UCOMISD, 0, 1);
+            to_nan[checks++] = emit_jump(e, 0x76);      /* jbe: x <= 0 */
+        }
+        emit_call(e, libm_function(opcode));
+        size_t to_store = emit_jump(e, 0xEB);
+        for (int i = 0; i < checks; i++) patch_jump(e, to_nan[i]);
+        sse_pool(e, SCALAR, MOVUPD_LOAD, 0, POOL_NAN, -1);
+        patch_jump(e, to_store);
+        sse_mem(e, SCALAR, MOVUPD_STORE, 0, RBX, frame->temp_a + 8 * lane);
+    }
+
+    spill_registers(e, frame, p, 0);
+    sse_mem(e, PACKED, MOVAPD_LOAD, 0, RBX, frame->temp_a);
+    store_position(e, frame, p, 0);
+}
+
+/* Powers go through checked_pow() once per lane */
+static void emit_power(Emitter *e, const FrameLayout *frame, size_t p) {
+    load_position(e, frame, 0, p);
+    sse_mem(e, PACKED, MOVAPD_STORE, 0, RBX, frame->temp_a);
+    load_position(e, frame, 0, p + 1);
+    sse_mem(e, PACKED, MOVAPD_STORE, 0, RBX, frame->temp_b);
+    spill_registers(e, frame, p, 1);
+
+    for (int lane = 0; lane < e->vector / 8; lane++) {
+        sse_mem(e, SCALAR, MOVUPD_LOAD, 0, RBX, frame->temp_a + 8 * lane);
+        sse_mem(e, SCALAR, MOVUPD_LOAD, 1, RBX, frame->temp_b + 8 * lane);
+        emit_call(e, (const void*)checked_pow);
+        sse_mem(e, SCALAR, MOVUPD_STORE, 0, RBX, frame->temp_a + 8 * lane);
+    }
+
+    spill_registers(e, frame, p, 0);
+    sse_mem(e, PACKED, MOVAPD_LOAD, 0, RBX, frame->temp_a);
+    store_position(e, frame, p, 0);
+}
+
+/*
+ * Emits void entry(const double *xs, double *ys, size_t groups), which keeps
+ * xs in r12, ys in r13 and the remaining groups of lanes in r14.
+ */
+static void emit_program(Emitter *e, const Program *program, const FrameLayout *frame) {
+    size_t constant = POOL_PROGRAM;
+    size_t sp = 0;
+
+    emit_byte(e, 0x53);                                         /* push rbx */
+    emit_byte(e, 0x41); emit_byte(e, 0x54);                     /* push r12 */
+    emit_byte(e, 0x41); emit_byte(e, 0x55);                     /* push r13 */
+    emit_byte(e, 0x41); emit_byte(e, 0x56);                     /* push r14 */
+    /* Four pushes leave rsp 8 bytes off the 16-byte alignment calls need */
+    emit_byte(e, 0x48); emit_byte(e, 0x81); emit_byte(e, 0xEC);  /* sub rsp, imm32 */
+    emit_int32(e, frame->size + 8);
+    emit_byte(e, 0x48); emit_byte(e, 0x89); emit_byte(e, 0xE3);  /* mov rbx, rsp */
+    emit_byte(e, 0x49); emit_byte(e, 0x89); emit_byte(e, 0xFC);  /* mov r12, rdi */
+    emit_byte(e, 0x49); emit_byte(e, 0x89); emit_byte(e, 0xF5);  /* mov r13, rsi */
+    emit_byte(e, 0x49); emit_byte(e, 0x89); emit_byte(e, 0xD6);  /* mov r14, rdx */
+    emit_byte(e, 0x4D); emit_byte(e, 0x85); emit_byte(e, 0xF6);  /* test r14, r14 */
+    emit_byte(e, 0x0F); emit_byte(e, 0x84);                     /* jz done */
+    size_t to_done = e->length;
+    emit_int32(e, 0);
+    size_t loop = e->length;
+
+    for (size_t i = 0; i < program->length; i++) {
+        const Instruction *instruction = &program->code[i];
+        int32_t slot = frame->slots + e->vector * (int32_t)instruction->slot;
+
+        switch (instruction->opcode) {
+            case OP_CONST:
+                sse_pool(e, PACKED, MOVAPD_LOAD, 0, constant++, -1);
+                store_position(e, frame, sp++, 0);
+                break;
+            case OP_VAR:
+                sse_mem(e, PACKED, MOVUPD_LOAD, 0, R12, 0);
+                store_position(e, frame, sp++, 0);
+                break;
+            case OP_NAN:
+                sse_pool(e, PACKED, MOVAPD_LOAD, 0, POOL_NAN, -1);
+                store_position(e, frame, sp++, 0);
+                break;
+            case OP_LOAD:
+                sse_mem(e, PACKED, MOVAPD_LOAD, 0, RBX, slot);
+                store_position(e, frame, sp++, 0);
+                break;
+            case OP_STORE:
+                load_position(e, frame, 0, sp - 1);
+                sse_mem(e, PACKED, MOVAPD_STORE, 0, RBX, slot);
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+                sp--;
+                emit_arithmetic(e, frame, instruction->opcode, sp - 1);
+                break;
+            case OP_POW:
+                sp--;
+                emit_power(e, frame, sp - 1);
+                break;
+            case OP_ABS:
+                emit_abs(e, frame, sp - 1);
+                break;
+            default:
+                emit_function(e, frame, instruction->opcode, sp - 1);
+                break;
+        }
+    }
+
+    load_position(e, frame, 0, 0);
+    sse_mem(e, PACKED, MOVUPD_STORE, 0, R13, 0);
+    emit_byte(e, 0x49); emit_byte(e, 0x83); emit_byte(e, 0xC4); emit_byte(e, e->vector);  /* add r12, vector */
+    emit_byte(e, 0x49); emit_byte(e, 0x83); emit_byte(e, 0xC5); emit_byte(e, e->vector);  /* add r13, vector */
+    emit_byte(e, 0x49); emit_byte(e, 0xFF); emit_byte(e, 0xCE);                    /* dec r14 */
+    emit_byte(e, 0x0F); emit_byte(e, 0x85);                                        /* jnz loop */
+    emit_int32(e, (int32_t)((int64_t)loop - (int64_t)(e->length + 4)));
+
+    int32_t done = (int32_t)(e->length - (to_done + 4));
+    memcpy(e->code + to_done, &done, sizeof(done));
+    emit_byte(e, 0x48); emit_byte(e, 0x81); emit_byte(e, 0xC4);  /* add rsp, imm32 */
+    emit_int32(e, frame->size + 8);
+    if (e->avx) {
+        emit_byte(e, 0xC5); emit_byte(e, 0xF8); emit_byte(e, 0x77);    /* vzeroupper */
+    }
+    emit_byte(e, 0x41); emit_byte(e, 0x5E);                     /* pop r14 */
+    emit_byte(e, 0x41); emit_byte(e, 0x5D);                     /* pop r13 */
+    emit_byte(e, 0x41); emit_byte(e, 0x5C);                     /* pop r12 */
+    emit_byte(e, 0x5B);                                         /* pop rbx */
+    emit_byte(e, 0xC3);                                         /* ret */
+}
+
+/* Writes every lane of a pool entry */
+static void set_pool_entry(unsigned char *pool, int lanes, size_t entry, uint64_t bits) {
+    for (int lane = 0; lane < lanes; lane++) memcpy(pool + 8 * (lanes * entry + lane), &bits, sizeof(bits));
+}
+
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+#endif /* HAVE_X86_64_JIT */
+
+int jit_supported(void) {
+#ifdef HAVE_X86_64_JIT
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Lays out the constant pool followed by the code in one mapping, which is
+ * made executable and read-only once the code is written.
+ */
+int jit_compile_program(Program *program) {
+#ifdef HAVE_X86_64_JIT
+    if (!jit_supported() || program == NULL || program->length == 0 || program->jit != NULL ||
+        program->derivative) return 0;
+
+    size_t constants = 0;
+    for (size_t i = 0; i < program->length; i++) {
+        if (program->code[i].opcode == OP_CONST) constants++;
+    }
+    /* Four lanes where the interpreter's own kernel would use AVX2, two otherwise */
+    int lanes = __builtin_cpu_supports("avx2") ? MAX_LANES : 2;
+    int32_t vector = 8 * lanes;
+    size_t entries = POOL_PROGRAM + constants;
+    size_t pool_size = entries * (size_t)vector;
+
+    /* Deep or very long programs stay with the interpreter, whose stack is on the heap */
+    size_t memory_depth = program->max_depth > JIT_REGISTER_STACK ? program->max_depth - JIT_REGISTER_STACK : 0;
+    size_t frame_size = (size_t)vector * (2 + JIT_REGISTER_STACK + memory_depth + program->slot_count);
+    if (frame_size > MAX_FRAME_SIZE || program->length > (MAX_MAPPING_SIZE - PROLOG_CODE) / MAX_INSTRUCTION_CODE ||
+        pool_size > MAX_MAPPING_SIZE - PROLOG_CODE - program->length * MAX_INSTRUCTION_CODE) return 0;
+    size_t size = pool_size + PROLOG_CODE + program->length * MAX_INSTRUCTION_CODE;
+
+    FrameLayout frame;
+    frame.temp_a = 0;
+    frame.temp_b = vector;
+    frame.spill = 2 * vector;
+    frame.stack = frame.spill + vector * JIT_REGISTER_STACK;
+    frame.slots = frame.stack + vector * (int32_t)memory_depth;
+    frame.size = frame.slots + vector * (int32_t)program->slot_count;
+
+    JitCode *jit = (JitCode*)malloc(sizeof(JitCode));
+    if (jit == NULL) return 0;
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        free(jit);
+        return 0;
+    }
+
+    unsigned char *pool = (unsigned char*)memory;
+    set_pool_entry(pool, lanes, POOL_ABS, 0x7FFFFFFFFFFFFFFFULL);
+    set_pool_entry(pool, lanes, POOL_MAX, double_bits(DBL_MAX));
+    set_pool_entry(pool, lanes, POOL_MIN_DIVISOR, double_bits(MIN_DIVISOR));
+    set_pool_entry(pool, lanes, POOL_NAN, double_bits(create_nan()));
+    size_t constant = POOL_PROGRAM;
+    for (size_t i = 0; i < program->length; i++) {
+        if (program->code[i].opcode == OP_CONST) {
+            set_pool_entry(pool, lanes, constant++, double_bits(program->code[i].value));
+        }
+    }
+
+    Emitter emitter = { pool + pool_size, 0, pool_size, lanes == MAX_LANES, vector };
+    emit_program(&emitter, program, &frame);
+
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        free(jit);
+        return 0;
+    }
+    jit->memory = (unsigned char*)memory;
+    jit->size = size;
+    jit->lanes = lanes;
+    /* Casting an object pointer to a function pointer is how every JIT gets its entry */
+    void *entry = pool + pool_size;
+    memcpy(&jit->entry, &entry, sizeof(entry));
+    program->jit = jit;
+    return 1;
+#else
+    (void)program;
+    return 0;
+#endif
+}
+
+/*
+ * Runs the native code over whole groups of lanes; the last few samples go
+ * through one group padded with copies of the last sample.
+ */
+void jit_evaluate(const JitCode *code, const double *xs, double *ys, size_t n) {
+    size_t lanes = (size_t)code->lanes;
+    size_t groups = n / lanes, rest = n % lanes;
+    code->entry(xs, ys, groups);
+    if (rest) {
+        double x[MAX_LANES], y[MAX_LANES];
+        for (size_t i = 0; i < lanes; i++) x[i] = xs[groups * lanes + (i < rest ? i : rest - 1)];
+        code->entry(x, y, 1);
+        memcpy(ys + groups * lanes, y, rest * sizeof(double));
+    }
+}
+
+void jit_free(JitCode *code) {
+    if (code == NULL) return;
+#ifdef HAVE_X86_64_JIT
+    munmap(code->memory, code->size);
+#endif
+    free(code);
+}
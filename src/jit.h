@@ -0,0 +1,66 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include "bytecode.h"
+
+/**
+ * @brief Number of stack positions the compiled code keeps in registers.
+ */
+#define JIT_REGISTER_STACK 8
+
+/**
+ * @brief Native machine code compiled from a program.
+ *
+ * The code evaluates four samples at a time with VEX-encoded AVX
+ * instructions on CPUs with AVX2, the same width as the interpreter's batch
+ * kernel there, and two at a time with packed SSE2 otherwise. The innermost
+ * stack positions live in registers 8-15, deeper ones and the slots in the
+ * stack frame. Transcendental functions and powers call libm once per lane.
+ */
+typedef struct JitCode {
+    unsigned char *memory;  /**< Executable mapping holding the constants and the code */
+    size_t size;            /**< Size of the mapping in bytes */
+    int lanes;              /**< Samples evaluated per iteration: 4 with AVX, 2 with SSE2 */
+    void (*entry)(const double *xs, double *ys, size_t groups);  /**< Evaluates lanes * groups samples */
+} JitCode;
+
+/**
+ * @brief Reports whether native code can be generated on this machine.
+ *
+ * @return int Returns 1 on x86-64 CPUs with SSE2 on systems with mmap(), otherwise 0.
+ */
+int jit_supported(void);
+
+/**
+ * @brief Compiles a program to native code and attaches it to the program.
+ *
+ * Once attached, evaluate_program_batch() runs the native code, which gives
+ * bit-identical results to the interpreter, NaN and domain rules included.
+ * When native code is not supported or cannot be mapped, the program
+ * evaluates a derivative, or it is too deep for a 64 KiB stack frame or too
+ * long for a 64 MiB mapping, the program is left to the interpreter.
+ *
+ * @param[in,out] program The program to compile.
+ * @return int Returns 1 if native code was attached, 0 if the interpreter stays in use.
+ */
+int jit_compile_program(Program *program);
+
+/**
+ * @brief Evaluates native code for an array of 'x' values.
+ *
+ * @param[in] code The compiled code.
+ * @param[in] xs Array of 'x' values.
+ * @param[out] ys Array receiving the results, may alias xs.
+ * @param[in] n Number of values in xs and ys.
+ */
+void jit_evaluate(const JitCode *code, const double *xs, double *ys, size_t n);
+
+/**
+ * @brief Releases native code.
+ *
+ * @param[in] code The code to release (may be NULL).
+ */
+void jit_free(JitCode *code);
+
+#endif /* JIT_H */
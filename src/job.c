@@ -0,0 +1,458 @@
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "job.h"
+#include "cache.h"
+#include "parser.h"
+#include "utils.h"
+#include "bytecode.h"
+#include "profile.h"
+
+/*
+ * Scans the last (up to) three fields from the end of the line, so the
+ * function may contain whitespace.
+ */
+int split_job_line(char *line, const char **func, const char **outfile, const char **range) {
+    char *fields[3];
+    char *ends[3];
+    int count = 0;
+    char *cursor = line + strlen(line);
+
+    while (count < 3) {
+        while (cursor > line && isspace((unsigned char)cursor[-1])) cursor--;
+        if (cursor == line) break;
+        ends[count] = cursor;
+        while (cursor > line && !isspace((unsigned char)cursor[-1])) cursor--;
+        fields[count++] = cursor;
+    }
+    if (count < 2) return 0;
+
+    int has_range = strchr(fields[0], ':') != NULL && count == 3;
+    int outfile_field = has_range ? 1 : 0;
+
+    *range = has_range ? fields[0] : NULL;
+    *outfile = fields[outfile_field];
+    *func = line;
+    for (int i = 0; i <= outfile_field; i++) *ends[i] = '\0';
+    /* The function is everything before the output file */
+    fields[outfile_field][-1] = '\0';
+    return 1;
+}
+
+/* Start from no expression and the default ranges */
+void init_job(PlotJob *job) {
+    job->tree = NULL;
+    job->parse_seconds = 0.0;
+    job->outfile = NULL;
+    job->x_min = -10.0;
+    job->x_max = 10.0;
+    job->y_min = -10.0;
+    job->y_max = 10.0;
+    job->calc_x_range = 1;
+    job->calc_y_range = 1;
+}
+
+/*
+ * Parses the text where it is, replacing the job's tree only if it is valid.
+ */
+static int set_job_expression(PlotJob *job, const char *text, size_t length) {
+    ParseError error;
+    ExprTree *tree;
+    double start = monotonic_seconds();
+    int status = parse_text(text, length, &tree, &error);
+
+    if (status == PARSE_NO_MEMORY) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+    if (status != PARSE_OK) {
+        fprintf(stderr, "Error: %s at offset %zu.\n", error.message, error.position);
+        fprintf(stderr, "Error: Invalid function provided.\n");
+        return 2;
+    }
+
+    free_tree(job->tree);
+    job->tree = tree;
+    job->parse_seconds = monotonic_seconds() - start;
+    return 0;
+}
+
+int set_job_function(PlotJob *job, const char *text) {
+    return set_job_expression(job, text, strlen(text));
+}
+
+/*
+ * Reads a pipe or terminal to its end into one growing buffer.
+ */
+static char* read_stream(int fd, size_t *length) {
+    char *text = NULL;
+    size_t capacity = 0;
+
+    *length = 0;
+    for (;;) {
+        if (capacity - *length < 4096) {
+            capacity = capacity ? capacity * 2 : 65536;
+            char *grown = (char*)realloc(text, capacity);
+            if (grown == NULL) {
+                free(text);
+                return NULL;
+            }
+            text = grown;
+        }
+        ssize_t count = read(fd, text + *length, capacity - *length);
+        if (count == 0) return text;
+        if (count < 0) {
+            free(text);
+            return NULL;
+        }
+        *length += (size_t)count;
+    }
+}
+
+/*
+ * Maps a regular file and parses it where it lies, so only the tree takes
+ * memory. Other inputs, such as a pipe on stdin, are read into a single
+ * buffer that is released as soon as the tree is built.
+ */
+int set_job_function_file(PlotJob *job, const char *path) {
+    int from_stdin = strcmp(path, "-") == 0;
+    int fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+    struct stat info;
+    int status = -1;
+    double start = monotonic_seconds();
+
+    if (fd >= 0 && fstat(fd, &info) == 0) {
+        if (S_ISREG(info.st_mode) && info.st_size == 0) {
+            status = set_job_expression(job, "", 0);
+        } else if (S_ISREG(info.st_mode)) {
+            size_t length = (size_t)info.st_size;
+            void *text = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (text != MAP_FAILED) {
+                posix_madvise(text, length, POSIX_MADV_SEQUENTIAL);
+                status = set_job_expression(job, (const char*)text, length);
+                munmap(text, length);
+            }
+        } else {
+            size_t length;
+            char *text = read_stream(fd, &length);
+            if (text != NULL) {
+                status = set_job_expression(job, text, length);
+                free(text);
+            }
+        }
+    }
+    if (fd >= 0 && !from_stdin) close(fd);
+
+    if (status < 0) {
+        fprintf(stderr, "Error: Cannot read expression file '%s'.\n", path);
+        return 5;
+    }
+    /* Reading the file counts as part of parsing */
+    if (status == 0) job->parse_seconds = monotonic_seconds() - start;
+    return status;
+}
+
+int set_job_outfile(PlotJob *job, const char *outfile) {
+    char *copy = (char *)malloc(strlen(outfile) + 1);
+    if (copy == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+    strcpy(copy, outfile);
+    free(job->outfile);
+    job->outfile = copy;
+    return 0;
+}
+
+/*
+ * A range fixes both axes; anything but four numbers is rejected.
+ */
+int set_job_range(PlotJob *job, const char *text) {
+    double temp_x_min, temp_x_max, temp_y_min, temp_y_max;
+    int matched_values = sscanf(text, "%lf:%lf:%lf:%lf",
+                                &temp_x_min, &temp_x_max, &temp_y_min, &temp_y_max);
+    if (matched_values != 4) {
+        fprintf(stderr, "Error: Invalid format for range. Expected x_min:x_max:y_min:y_max\n");
+        return 4;
+    }
+    job->x_min = temp_x_min;
+    job->x_max = temp_x_max;
+    job->y_min = temp_y_min;
+    job->y_max = temp_y_max;
+    job->calc_x_range = 0;
+    job->calc_y_range = 0;
+    return 0;
+}
+
+void report_render_stats(const RenderOptions *options, const RenderStats *stats) {
+    if (options->adaptive) {
+        fprintf(stderr, "Adaptive sampling: %zu evaluations, %ld fewer than %zu at a fixed step.\n",
+                stats->evaluations, (long)stats->fixed_samples - (long)stats->evaluations, stats->fixed_samples);
+    }
+    if (options->simplify > 0) {
+        fprintf(stderr, "Path simplification: %zu points in, %zu points out.\n", stats->points_in, stats->points_out);
+    }
+}
+
+/* Writes a string as a JSON string literal */
+static void write_json_string(FILE *out, const char *text) {
+    fputc('"', out);
+    for (; *text != '\0'; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/*
+ * Formats the report in memory and writes it with one call, so the reports
+ * of concurrent batch jobs do not interleave.
+ */
+void write_stats_report(const RenderOptions *options, const PlotJob *job, const char *cache, const Program *program,
+                        const RenderStats *stats, const JobTimes *times, size_t bytes) {
+    size_t counts[4] = { 0, 0, 0, 0 };
+    char *report = NULL;
+    size_t length = 0;
+
+    if (options->stats_path == NULL) return;
+    FILE *out = open_memstream(&report, &length);
+    if (out == NULL) return;
+
+    for (NodeId i = 0; i < job->tree->count; i++) counts[job->tree->nodes[i].type]++;
+
+    fprintf(out, "{\"outfile\": ");
+    write_json_string(out, job->outfile);
+    fprintf(out, ", \"cache\": \"%s\", \"seconds\": {\"parse\": %.9f, \"compile\": %.9f, \"open\": %.9f",
+            cache, job->parse_seconds, times->compile, times->open);
+    if (stats) {
+        fprintf(out, ", \"sample\": %.9f, \"ranges\": %.9f, \"plot\": %.9f, \"plot_blocked\": %.9f, \"writer_blocked\": %.9f",
+                stats->sample_seconds, stats->range_seconds, stats->plot_seconds,
+                stats->plot_blocked_seconds, stats->writer_blocked_seconds);
+    }
+    fprintf(out, ", \"write\": %.9f, \"total\": %.9f}", times->write, job->parse_seconds + times->total);
+    fprintf(out, ", \"tree\": {\"nodes\": %u, \"const\": %zu, \"var\": %zu, \"operator\": %zu, \"function\": %zu, \"depth\": %zu}",
+            (unsigned)job->tree->count, counts[CONST], counts[VAR], counts[OPERATOR], counts[FUNCTION], tree_depth(job->tree));
+    if (program) fprintf(out, ", \"instructions\": %zu, \"deduplicated\": %zu", program->length, program->deduplicated);
+    if (stats) {
+        fprintf(out, ", \"samples\": %zu, \"evaluations\": %zu, \"nan_samples\": %zu, \"clipped_samples\": %zu, \"culled_samples\": %zu"
+                     ", \"points_in\": %zu, \"points_out\": %zu, \"subpaths\": %zu, \"segments\": %zu",
+                stats->samples, stats->evaluations, stats->nan_samples, stats->clipped_samples, stats->culled_samples,
+                stats->points_in, stats->points_out, stats->subpaths, stats->points_out - stats->subpaths);
+    }
+    fprintf(out, ", \"bytes\": %zu}\n", bytes);
+    if (fclose(out) != 0) {
+        free(report);
+        return;
+    }
+
+    if (strcmp(options->stats_path, "-") == 0) {
+        fwrite(report, 1, length, stderr);
+    } else {
+        int fd = open(options->stats_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0 || write(fd, report, length) != (ssize_t)length) {
+            fprintf(stderr, "Error: Cannot write statistics to '%s'.\n", options->stats_path);
+        }
+        if (fd >= 0) close(fd);
+    }
+    free(report);
+}
+
+/* 
+ * Opens the output file and attaches the writer to it.
+ */
+FILE* initialize_postscript(const char *outfile, PsWriter *writer) {
+    FILE *ps_file = fopen(outfile, "w");
+    if (ps_file == NULL) {
+        fprintf(stderr, "Error opening file for writing: %s\n", outfile);
+        return NULL;
+    }
+    ps_init(writer, ps_file_sink, ps_file);
+    return ps_file;
+}
+
+/* 
+ * Generates the PostScript file by parsing the expression and plotting the graph.
+ */
+int generate_postscript(const PlotJob *job, const RenderOptions *options) {
+    PsWriter *writer = (PsWriter*)malloc(sizeof(PsWriter));
+    Program* program = NULL;
+    RenderStats stats;
+    JobTimes times;
+    double start = monotonic_seconds();
+
+    /* The simplifier relies on the x range, which is known before sampling */
+    if (writer) program = compile_for_render(job->tree, job->x_min, job->x_max, options);
+    if (program == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        free(writer);
+        return 1;
+    }
+    double compiled = monotonic_seconds();
+
+    FILE *ps_file = initialize_postscript(job->outfile, writer);
+    if (ps_file == NULL) {
+        free_program(program);
+        free(writer);
+        return 3;
+    }
+    double opened = monotonic_seconds();
+
+    int status = render_document(writer, program, job->x_min, job->x_max, job->y_min, job->y_max,
+                                 job->calc_x_range, job->calc_y_range, options, &stats);
+    if (status == 0) {
+        report_render_stats(options, &stats);
+    } else {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+    }
+    double rendered = monotonic_seconds();
+    int written = ps_flush(writer);
+    if (fclose(ps_file) != 0 || !written) {
+        fprintf(stderr, "Error writing to file: %s\n", job->outfile);
+        if (status == 0) status = 3;
+    }
+
+    if (status == 0) {
+        times.compile = compiled - start;
+        times.open = opened - compiled;
+        times.write = monotonic_seconds() - rendered;
+        times.total = monotonic_seconds() - start;
+        write_stats_report(options, job, "off", program, &stats, &times, writer->written);
+    }
+
+    /* Cleanup */
+    free(writer);
+    free_program(program);
+    return status;
+}
+
+/* Render into a memory buffer instead of a file */
+int render_page(const PlotJob *job, const Program *program, const RenderOptions *options, PsBuffer *buffer, RenderStats *stats) {
+    PsWriter *writer = (PsWriter*)malloc(sizeof(PsWriter));
+    RenderStats local_stats;
+    int status;
+
+    if (writer == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+    ps_init(writer, ps_buffer_sink, buffer);
+    status = render_document(writer, program, job->x_min, job->x_max, job->y_min, job->y_max,
+                             job->calc_x_range, job->calc_y_range, options, stats ? stats : &local_stats);
+    if (status == 0) report_render_stats(options, stats ? stats : &local_stats);
+    if (!ps_flush(writer) && status == 0) status = 1;
+    if (status != 0) fprintf(stderr, "Error: Memory allocation failed.\n");
+    free(writer);
+    return status;
+}
+
+int write_page(const char *outfile, const char *data, size_t length) {
+    FILE *ps_file = fopen(outfile, "w");
+    if (ps_file == NULL) {
+        fprintf(stderr, "Error opening file for writing: %s\n", outfile);
+        return 3;
+    }
+    int written = fwrite(data, 1, length, ps_file) == length;
+    if (fclose(ps_file) != 0 || !written) {
+        fprintf(stderr, "Error writing to file: %s\n", outfile);
+        return 3;
+    }
+    return 0;
+}
+
+/*
+ * Without a cache the page streams straight to the file; with one it is
+ * rendered into memory so it can be stored as well.
+ */
+int run_job(const PlotJob *job, const RenderOptions *options, struct DiskCache *cache) {
+    char *key, *data;
+    size_t length;
+    int status;
+    RenderStats stats;
+    JobTimes times = { 0.0, 0.0, 0.0, 0.0 };
+    double start = monotonic_seconds();
+
+    if (cache == NULL) {
+        return generate_postscript(job, options);
+    }
+
+    key = make_render_key(job, options);
+    if (key == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+    if (disk_cache_get(cache, key, &data, &length)) {
+        double found = monotonic_seconds();
+        status = write_page(job->outfile, data, length);
+        if (status == 0) {
+            times.write = monotonic_seconds() - found;
+            times.total = monotonic_seconds() - start;
+            write_stats_report(options, job, "hit", NULL, NULL, &times, length);
+        }
+        free(data);
+        free(key);
+        return status;
+    }
+
+    PsBuffer buffer = { NULL, 0, 0 };
+    double looked_up = monotonic_seconds();
+    Program *program = compile_for_render(job->tree, job->x_min, job->x_max, options);
+    double compiled = monotonic_seconds();
+    if (program == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        status = 1;
+    } else {
+        status = render_page(job, program, options, &buffer, &stats);
+    }
+    double rendered = monotonic_seconds();
+    if (status == 0) status = write_page(job->outfile, buffer.data, buffer.length);
+    double wrote = monotonic_seconds();
+    if (status == 0) disk_cache_put(cache, key, buffer.data, buffer.length);
+    if (status == 0) {
+        times.compile = compiled - looked_up;
+        times.write = wrote - rendered;
+        times.total = monotonic_seconds() - start;
+        write_stats_report(options, job, "miss", program, &stats, &times, buffer.length);
+    }
+
+    free_program(program);
+    free(buffer.data);
+    free(key);
+    return status;
+}
+
+int profile_job(const PlotJob *job, const RenderOptions *options, int folded, FILE *out) {
+    TreeProfile *profile = create_profile(job->tree);
+    if (profile == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+
+    size_t samples = (size_t)PLOT_SIZE * options->oversampling + 1;
+    double step = (job->x_max - job->x_min) / (double)(samples - 1);
+    for (size_t i = 0; i < samples; i++) {
+        evaluate_profiled(profile, job->x_min + step * (double)i);
+    }
+
+    int ok = folded ? write_profile_folded(out, profile) : write_profile_tree(out, profile);
+    free_profile(profile);
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+    return 0;
+}
+
+void free_job(PlotJob *job) {
+    free_tree(job->tree);
+    free(job->outfile);
+    job->tree = NULL;
+    job->outfile = NULL;
+}
@@ -0,0 +1,214 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include "post_script.h"
+#include "ps_writer.h"
+
+struct DiskCache;
+
+/**
+ * @brief A single plot to render: expression, output file and ranges.
+ */
+typedef struct {
+    ExprTree *tree;     /**< Parsed expression, owned by the job */
+    double parse_seconds; /**< Time taken to read and parse the expression */
+    char *outfile;      /**< Output file name, owned by the job */
+    double x_min;       /**< Lower bound of the x-axis domain */
+    double x_max;       /**< Upper bound of the x-axis domain */
+    double y_min;       /**< Lower bound of the y-axis range */
+    double y_max;       /**< Upper bound of the y-axis range */
+    int calc_x_range;   /**< Set if the x range was not given */
+    int calc_y_range;   /**< Set if the y range was not given */
+} PlotJob;
+
+/**
+ * @brief Splits a line of the form "function outfile [range]" in place.
+ *
+ * The output file is the last field, or the one before it when the last
+ * field is a range (it contains ':'); everything before it is the function,
+ * which may contain whitespace. Fields are separated by whitespace.
+ *
+ * @param[in,out] line The line to split; separators are overwritten with '\0'.
+ * @param[out] func Pointer receiving the function text.
+ * @param[out] outfile Pointer receiving the output file.
+ * @param[out] range Pointer receiving the range, or NULL if there is none.
+ * @return int Returns 1 on success, 0 if the line has fewer than two fields.
+ */
+int split_job_line(char *line, const char **func, const char **outfile, const char **range);
+
+/**
+ * @brief Initializes a job without function or output file and with the default ranges.
+ *
+ * @param[out] job The job to initialize.
+ */
+void init_job(PlotJob *job);
+
+/**
+ * @brief Parses an expression and stores its tree in the job.
+ *
+ * The text is parsed in place; errors are printed with their byte offset.
+ *
+ * @param[in,out] job The job.
+ * @param[in] text The expression as written by the user.
+ * @return int Returns 0 on success, 1 if memory allocation failed, 2 if the expression is invalid.
+ */
+int set_job_function(PlotJob *job, const char *text);
+
+/**
+ * @brief Parses an expression stored in a file and stores its tree in the job.
+ *
+ * A regular file is memory-mapped and parsed in place, so expressions of
+ * any size need no memory beyond their tree. The path "-" reads standard
+ * input, which is mapped too when it is redirected from a file.
+ *
+ * @param[in,out] job The job.
+ * @param[in] path The file holding the expression, or "-" for standard input.
+ * @return int Returns 0 on success, 1 if memory allocation failed, 2 if the
+ *         expression is invalid, 5 if the file cannot be read.
+ */
+int set_job_function_file(PlotJob *job, const char *path);
+
+/**
+ * @brief Stores a copy of the output file name in the job.
+ *
+ * @param[in,out] job The job.
+ * @param[in] outfile The output file name.
+ * @return int Returns 0 on success, 1 if memory allocation failed.
+ */
+int set_job_outfile(PlotJob *job, const char *outfile);
+
+/**
+ * @brief Parses a range of the form x_min:x_max:y_min:y_max into the job.
+ *
+ * @param[in,out] job The job.
+ * @param[in] text The range specification.
+ * @return int Returns 0 on success, 4 if the range is malformed.
+ */
+int set_job_range(PlotJob *job, const char *text);
+
+/**
+ * @brief Prints the sampling and simplification figures enabled by the options to stderr.
+ *
+ * @param[in] options Rendering options of the page.
+ * @param[in] stats Figures returned by render_postscript().
+ */
+void report_render_stats(const RenderOptions *options, const RenderStats *stats);
+
+/**
+ * @brief Wall-clock time of the phases of a job outside render_postscript(), in seconds.
+ */
+typedef struct {
+    double compile;     /**< Simplifying and compiling the expression */
+    double open;        /**< Opening the output file */
+    double write;       /**< Flushing and closing the output */
+    double total;       /**< The whole job after parsing */
+} JobTimes;
+
+/**
+ * @brief Appends the statistics of a finished job to options->stats_path.
+ *
+ * The report is a single line holding one JSON object: the time of every
+ * phase, the time the plotter and its writer thread waited on each other,
+ * the node counts of the parsed tree by type and its depth, the program
+ * length and the nodes merged by share_subexpressions(), the evaluated,
+ * NaN, clipped and culled samples, the path segments and the bytes written. A page served from the cache only has
+ * the figures that apply. Nothing is written if options->stats_path is NULL.
+ *
+ * @param[in] options Rendering options of the job, giving the destination.
+ * @param[in] job The job.
+ * @param[in] cache "off", "hit" or "miss", telling how the disk cache was used.
+ * @param[in] program The compiled program, or NULL if the page came from the cache.
+ * @param[in] stats Figures returned by render_postscript(), or NULL if the page came from the cache.
+ * @param[in] times Times of the phases outside render_postscript().
+ * @param[in] bytes Bytes written to the output file.
+ */
+void write_stats_report(const RenderOptions *options, const PlotJob *job, const char *cache, const Program *program,
+                        const RenderStats *stats, const JobTimes *times, size_t bytes);
+
+/**
+ * @brief Initializes and opens an output file for writing.
+ * 
+ * This function opens a file in write mode and attaches the writer to it;
+ * render_document() writes the PostScript headers and prolog, or the image.
+ * 
+ * @param[in] outfile The name of the output file.
+ * @param[out] writer The writer to attach to the file.
+ * @return FILE* Pointer to the opened file, or NULL if it could not be opened.
+ */
+FILE* initialize_postscript(const char *outfile, PsWriter *writer);
+
+/**
+ * @brief Generates a PostScript file for visualizing a job's function.
+ * 
+ * This function handles the entire process of initializing the PostScript file, 
+ * calculating ranges, drawing grid lines, plotting the function, and adding
+ * axes. The page streams to the file without being held in memory; PGM and
+ * PNG output is held as a bitmap until it is encoded (see render_document()).
+ * 
+ * @param[in] job The job with function, output file and ranges.
+ * @param[in] options Rendering options.
+ * @return int Returns 0 on success, or an error code:
+ * - 1: Memory allocation failed.
+ * - 3: Unable to create/write to the output file.
+ */
+int generate_postscript(const PlotJob *job, const RenderOptions *options);
+
+/**
+ * @brief Renders a job's page into memory.
+ *
+ * @param[in] job The job.
+ * @param[in] program The job's function compiled for its x range.
+ * @param[in] options Rendering options.
+ * @param[out] buffer Zeroed buffer receiving the page; the caller frees its data.
+ * @param[out] stats Receives the figures of the render, may be NULL.
+ * @return int Returns 0 on success, 1 if memory allocation failed.
+ */
+int render_page(const PlotJob *job, const Program *program, const RenderOptions *options, PsBuffer *buffer, RenderStats *stats);
+
+/**
+ * @brief Writes a rendered page to a file.
+ *
+ * @param[in] outfile The output file name.
+ * @param[in] data The page.
+ * @param[in] length The number of bytes in data.
+ * @return int Returns 0 on success, 3 if the file cannot be written.
+ */
+int write_page(const char *outfile, const char *data, size_t length);
+
+/**
+ * @brief Renders the job's plot to its output file.
+ *
+ * With a cache, a page stored under the job's key is copied to the output
+ * file without parsing, sampling or formatting, and newly rendered pages are
+ * stored for later jobs.
+ *
+ * @param[in] job The job.
+ * @param[in] options Rendering options.
+ * @param[in,out] cache The on-disk render cache, or NULL.
+ * @return int Returns 0 on success, or the error code of generate_postscript().
+ */
+int run_job(const PlotJob *job, const RenderOptions *options, struct DiskCache *cache);
+
+/**
+ * @brief Profiles the job's expression and prints the profile to a stream.
+ *
+ * The expression is evaluated as parsed, before simplification, at as many
+ * evenly spaced points over the job's x range as a plot with the given
+ * oversampling would sample.
+ *
+ * @param[in] job The job.
+ * @param[in] options Rendering options; only the oversampling is used.
+ * @param[in] folded Nonzero for folded stacks, zero for an annotated tree.
+ * @param[in] out The stream to print to.
+ * @return int Returns 0 on success, 1 if memory allocation failed.
+ */
+int profile_job(const PlotJob *job, const RenderOptions *options, int folded, FILE *out);
+
+/**
+ * @brief Frees the strings owned by a job.
+ *
+ * @param[in,out] job The job.
+ */
+void free_job(PlotJob *job);
+
+#endif /* JOB_H */
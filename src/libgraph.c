@@ -0,0 +1,234 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libgraph.h"
+#include "parser.h"
+#include "post_script.h"
+#include "ps_writer.h"
+#include "sampler.h"
+#include "bytecode.h"
+#include "interval.h"
+
+#define DEFAULT_MIN -10.0   /* Bounds of the ranges used until graph_set_range() */
+#define DEFAULT_MAX 10.0
+#define BOUND_DEPTH 10      /* Bisections of the x range used by graph_bounds() */
+
+struct GraphContext {
+    ExprTree *tree;             /* Parsed expression, NULL before graph_parse() */
+    Program *program;           /* Function compiled for the x range, NULL until needed */
+    double x_min;
+    double x_max;
+    double y_min;
+    double y_max;
+    int calc_x_range;
+    int calc_y_range;
+    RenderOptions options;
+    long error_position;        /* Offset of the last expression error, -1 if none */
+    char error_message[PARSE_ERROR_SIZE];
+};
+
+/*
+ * Records the outcome of a call; the message is cleared on success.
+ */
+static GraphStatus set_status(GraphContext *graph, GraphStatus status, long position, const char *format, ...) {
+    va_list args;
+    graph->error_position = position;
+    graph->error_message[0] = '\0';
+    if (format) {
+        va_start(args, format);
+        vsnprintf(graph->error_message, sizeof(graph->error_message), format, args);
+        va_end(args);
+    }
+    return status;
+}
+
+/* The program depends on the function and the x range */
+static void drop_program(GraphContext *graph) {
+    free_program(graph->program);
+    graph->program = NULL;
+}
+
+GraphContext* graph_create(void) {
+    GraphContext *graph = (GraphContext*)calloc(1, sizeof(GraphContext));
+    if (graph == NULL) return NULL;
+    init_render_options(&graph->options);
+    graph_auto_range(graph);
+    graph->error_position = -1;
+    return graph;
+}
+
+void graph_destroy(GraphContext *graph) {
+    if (graph == NULL) return;
+    free_program(graph->program);
+    free_tree(graph->tree);
+    free(graph);
+}
+
+/*
+ * Parses the caller's text in place; error offsets already point into it.
+ */
+GraphStatus graph_parse(GraphContext *graph, const char *expr) {
+    ParseError error;
+    ExprTree *tree;
+    int status = parse_text(expr, strlen(expr), &tree, &error);
+
+    if (status == PARSE_NO_MEMORY) {
+        return set_status(graph, GRAPH_ERROR_MEMORY, -1, "Memory allocation failed");
+    }
+    if (status != PARSE_OK) {
+        return set_status(graph, GRAPH_ERROR_EXPRESSION, (long)error.position, "%s", error.message);
+    }
+
+    free_tree(graph->tree);
+    graph->tree = tree;
+    drop_program(graph);
+    return set_status(graph, GRAPH_OK, -1, NULL);
+}
+
+GraphStatus graph_compile(GraphContext *graph) {
+    if (graph->tree == NULL) {
+        return set_status(graph, GRAPH_ERROR_STATE, -1, "No expression has been parsed");
+    }
+    if (graph->program == NULL) {
+        graph->program = compile_for_render(graph->tree, graph->x_min, graph->x_max, &graph->options);
+        if (graph->program == NULL) {
+            return set_status(graph, GRAPH_ERROR_MEMORY, -1, "Memory allocation failed");
+        }
+    }
+    return set_status(graph, GRAPH_OK, -1, NULL);
+}
+
+GraphStatus graph_deduplicated(GraphContext *graph, size_t *count) {
+    GraphStatus status = graph_compile(graph);
+    if (status == GRAPH_OK) *count = graph->program->deduplicated;
+    return status;
+}
+
+GraphStatus graph_set_range(GraphContext *graph, double x_min, double x_max, double y_min, double y_max) {
+    if (!(isfinite(x_min) && isfinite(x_max) && x_min < x_max) ||
+        !(isfinite(y_min) && isfinite(y_max) && y_min < y_max)) {
+        return set_status(graph, GRAPH_ERROR_RANGE, -1, "Invalid range %g:%g:%g:%g", x_min, x_max, y_min, y_max);
+    }
+    if (x_min != graph->x_min || x_max != graph->x_max) drop_program(graph);
+    graph->x_min = x_min;
+    graph->x_max = x_max;
+    graph->y_min = y_min;
+    graph->y_max = y_max;
+    graph->calc_x_range = 0;
+    graph->calc_y_range = 0;
+    return set_status(graph, GRAPH_OK, -1, NULL);
+}
+
+void graph_auto_range(GraphContext *graph) {
+    if (graph->x_min != DEFAULT_MIN || graph->x_max != DEFAULT_MAX) drop_program(graph);
+    graph->x_min = DEFAULT_MIN;
+    graph->x_max = DEFAULT_MAX;
+    graph->y_min = DEFAULT_MIN;
+    graph->y_max = DEFAULT_MAX;
+    graph->calc_x_range = 1;
+    graph->calc_y_range = 1;
+}
+
+GraphStatus graph_set_oversampling(GraphContext *graph, int oversampling) {
+    if (oversampling < 1 || oversampling > MAX_OVERSAMPLING) {
+        return set_status(graph, GRAPH_ERROR_OPTION, -1, "Oversampling must be between 1 and %d", MAX_OVERSAMPLING);
+    }
+    graph->options.oversampling = oversampling;
+    return set_status(graph, GRAPH_OK, -1, NULL);
+}
+
+GraphStatus graph_set_adaptive(GraphContext *graph, int adaptive, double tolerance) {
+    if (!(tolerance >= MIN_TOLERANCE && tolerance <= MAX_TOLERANCE)) {
+        return set_status(graph, GRAPH_ERROR_OPTION, -1, "Tolerance must be between %g and %g", MIN_TOLERANCE, MAX_TOLERANCE);
+    }
+    graph->options.adaptive = adaptive != 0;
+    graph->options.tolerance = tolerance;
+    return set_status(graph, GRAPH_OK, -1, NULL);
+}
+
+GraphStatus graph_set_simplify(GraphContext *graph, double simplify) {
+    if (!(simplify >= 0.0 && simplify <= MAX_SIMPLIFY)) {
+        return set_status(graph, GRAPH_ERROR_OPTION, -1, "Simplification must be between 0 and %g", MAX_SIMPLIFY);
+    }
+    graph->options.simplify = simplify;
+    return set_status(graph, GRAPH_OK, -1, NULL);
+}
+
+GraphStatus graph_set_threads(GraphContext *graph, int threads) {
+    if (threads < 1 || threads > MAX_SAMPLER_THREADS) {
+        return set_status(graph, GRAPH_ERROR_OPTION, -1, "Thread count must be between 1 and %d", MAX_SAMPLER_THREADS);
+    }
+    graph->options.threads = threads;
+    return set_status(graph, GRAPH_OK, -1, NULL);
+}
+
+void graph_set_jit(GraphContext *graph, int jit) {
+    /* Recompile so the program matches the setting */
+    if ((jit != 0) != graph->options.jit) drop_program(graph);
+    graph->options.jit = jit != 0;
+}
+
+GraphStatus graph_bounds(GraphContext *graph, double *y_min, double *y_max) {
+    GraphStatus status = graph_compile(graph);
+    if (status != GRAPH_OK) return status;
+
+    Interval bound = bound_program(graph->program, graph->x_min, graph->x_max, BOUND_DEPTH);
+    if (interval_is_empty(bound)) {
+        return set_status(graph, GRAPH_ERROR_RANGE, -1, "The function is undefined over %g:%g", graph->x_min, graph->x_max);
+    }
+    *y_min = bound.lo;
+    *y_max = bound.hi;
+    return set_status(graph, GRAPH_OK, -1, NULL);
+}
+
+void graph_set_derivative(GraphContext *graph, int derivative) {
+    if ((derivative != 0) != graph->options.derivative) drop_program(graph);
+    graph->options.derivative = derivative != 0;
+}
+
+GraphStatus graph_render(GraphContext *graph, GraphWriteFn write, void *user) {
+    GraphStatus status = graph_compile(graph);
+    if (status != GRAPH_OK) return status;
+
+    PsWriter *writer = (PsWriter*)malloc(sizeof(PsWriter));
+    if (writer == NULL) return set_status(graph, GRAPH_ERROR_MEMORY, -1, "Memory allocation failed");
+
+    ps_init(writer, write, user);
+    int failed = render_document(writer, graph->program, graph->x_min, graph->x_max, graph->y_min, graph->y_max,
+                                 graph->calc_x_range, graph->calc_y_range, &graph->options, NULL);
+    int written = ps_flush(writer);
+    free(writer);
+
+    if (failed) return set_status(graph, GRAPH_ERROR_MEMORY, -1, "Memory allocation failed");
+    if (!written) return set_status(graph, GRAPH_ERROR_OUTPUT, -1, "Writing the page failed");
+    return set_status(graph, GRAPH_OK, -1, NULL);
+}
+
+GraphStatus graph_render_buffer(GraphContext *graph, char **data, size_t *length) {
+    PsBuffer buffer = { NULL, 0, 0 };
+    GraphStatus status = graph_render(graph, ps_buffer_sink, &buffer);
+
+    /* The buffer sink only fails when it cannot grow */
+    if (status == GRAPH_ERROR_OUTPUT) status = set_status(graph, GRAPH_ERROR_MEMORY, -1, "Memory allocation failed");
+    if (status != GRAPH_OK) {
+        free(buffer.data);
+        return status;
+    }
+    *data = buffer.data;
+    *length = buffer.length;
+    return GRAPH_OK;
+}
+
+void graph_free_buffer(char *data) {
+    free(data);
+}
+
+const char* graph_error_message(const GraphContext *graph) {
+    return graph->error_message;
+}
+
+long graph_error_position(const GraphContext *graph) {
+    return graph->error_position;
+}
@@ -0,0 +1,248 @@
+#ifndef LIBGRAPH_H
+#define LIBGRAPH_H
+
+#include <stddef.h>
+
+/**
+ * @file libgraph.h
+ * @brief Embeddable API for parsing, compiling and rendering function plots.
+ *
+ * All state lives in a GraphContext: the library has no globals, never
+ * exits and never prints. Each context may be used by one thread at a time,
+ * and any number of contexts may render concurrently. Failures are returned
+ * as GraphStatus codes, with a message and, for expressions, the byte offset
+ * of the error available from the context.
+ *
+ *     GraphContext *graph = graph_create();
+ *     if (graph_parse(graph, "sin(x) * x") != GRAPH_OK) {
+ *         printf("%s at %ld\n", graph_error_message(graph), graph_error_position(graph));
+ *     }
+ *     char *page;
+ *     size_t length;
+ *     if (graph_render_buffer(graph, &page, &length) == GRAPH_OK) {
+ *         ...
+ *         graph_free_buffer(page);
+ *     }
+ *     graph_destroy(graph);
+ */
+
+/**
+ * @brief Result of a library call; the values match the exit codes of the command line.
+ */
+typedef enum {
+    GRAPH_OK = 0,                   /**< Success */
+    GRAPH_ERROR_MEMORY = 1,         /**< Memory allocation failed */
+    GRAPH_ERROR_EXPRESSION = 2,     /**< The expression is invalid */
+    GRAPH_ERROR_OUTPUT = 3,         /**< The output callback reported a failure */
+    GRAPH_ERROR_RANGE = 4,          /**< The range is empty or not finite */
+    GRAPH_ERROR_OPTION = 5,         /**< An option value is out of bounds */
+    GRAPH_ERROR_STATE = 6           /**< No expression has been parsed */
+} GraphStatus;
+
+/**
+ * @brief Opaque rendering context holding an expression, its ranges and options.
+ */
+typedef struct GraphContext GraphContext;
+
+/**
+ * @brief Receives a block of the rendered page.
+ *
+ * @param[in] user The pointer given to graph_render().
+ * @param[in] data The bytes to write.
+ * @param[in] length The number of bytes.
+ * @return int Returns 1 on success, 0 to report a failure; no further blocks follow.
+ */
+typedef int (*GraphWriteFn)(void *user, const char *data, size_t length);
+
+/**
+ * @brief Creates a context with automatic ranges and the default options.
+ *
+ * @return GraphContext* Returns the context, or NULL if memory allocation failed.
+ */
+GraphContext* graph_create(void);
+
+/**
+ * @brief Frees a context and everything it holds.
+ *
+ * @param[in] graph The context (may be NULL).
+ */
+void graph_destroy(GraphContext *graph);
+
+/**
+ * @brief Parses an expression and makes it the context's function.
+ *
+ * Whitespace is ignored. On failure the previous function is kept, and the
+ * error position is the byte offset into 'expr' where the problem was found.
+ *
+ * @param[in,out] graph The context.
+ * @param[in] expr The expression, e.g. "sin(x) * x".
+ * @return GraphStatus Returns GRAPH_OK, GRAPH_ERROR_EXPRESSION or GRAPH_ERROR_MEMORY.
+ */
+GraphStatus graph_parse(GraphContext *graph, const char *expr);
+
+/**
+ * @brief Compiles the function for the current x range ahead of rendering.
+ *
+ * Rendering compiles on demand, so calling this is only needed to separate
+ * compilation cost or errors from rendering. The program is reused by later
+ * renders until the function or the x range changes.
+ *
+ * @param[in,out] graph The context.
+ * @return GraphStatus Returns GRAPH_OK, GRAPH_ERROR_STATE or GRAPH_ERROR_MEMORY.
+ */
+GraphStatus graph_compile(GraphContext *graph);
+
+/**
+ * @brief Reports how many nodes compilation merged into identical subexpressions.
+ *
+ * Compiles the function first if needed (see graph_compile()).
+ *
+ * @param[in,out] graph The context.
+ * @param[out] count Receives the number of nodes shared instead of evaluated again.
+ * @return GraphStatus Returns GRAPH_OK, GRAPH_ERROR_STATE or GRAPH_ERROR_MEMORY.
+ */
+GraphStatus graph_deduplicated(GraphContext *graph, size_t *count);
+
+/**
+ * @brief Fixes both axes to the given ranges.
+ *
+ * @param[in,out] graph The context.
+ * @param[in] x_min The minimum x-coordinate.
+ * @param[in] x_max The maximum x-coordinate.
+ * @param[in] y_min The minimum y-coordinate.
+ * @param[in] y_max The maximum y-coordinate.
+ * @return GraphStatus Returns GRAPH_OK, or GRAPH_ERROR_RANGE if a range is empty or not finite.
+ */
+GraphStatus graph_set_range(GraphContext *graph, double x_min, double x_max, double y_min, double y_max);
+
+/**
+ * @brief Returns to automatic ranges: x over [-10, 10], y from the samples.
+ *
+ * @param[in,out] graph The context.
+ */
+void graph_auto_range(GraphContext *graph);
+
+/**
+ * @brief Sets the number of samples evaluated per device column.
+ *
+ * @param[in,out] graph The context.
+ * @param[in] oversampling Samples per column, from 1 to 4096.
+ * @return GraphStatus Returns GRAPH_OK or GRAPH_ERROR_OPTION.
+ */
+GraphStatus graph_set_oversampling(GraphContext *graph, int oversampling);
+
+/**
+ * @brief Switches between fixed-step and adaptive sampling.
+ *
+ * @param[in,out] graph The context.
+ * @param[in] adaptive Nonzero to refine samples where the curve bends.
+ * @param[in] tolerance Deviation from a straight segment allowed by adaptive
+ *            sampling, from 0.001 to 100 device units.
+ * @return GraphStatus Returns GRAPH_OK or GRAPH_ERROR_OPTION.
+ */
+GraphStatus graph_set_adaptive(GraphContext *graph, int adaptive, double tolerance);
+
+/**
+ * @brief Sets the distance within which the plotted path is straightened.
+ *
+ * @param[in,out] graph The context.
+ * @param[in] simplify Distance from 0 to 10 device units; 0 only drops duplicate points.
+ * @return GraphStatus Returns GRAPH_OK or GRAPH_ERROR_OPTION.
+ */
+GraphStatus graph_set_simplify(GraphContext *graph, double simplify);
+
+/**
+ * @brief Sets the number of threads evaluating samples, the calling thread included.
+ *
+ * @param[in,out] graph The context.
+ * @param[in] threads Number of threads, from 1 to 256.
+ * @return GraphStatus Returns GRAPH_OK or GRAPH_ERROR_OPTION.
+ */
+GraphStatus graph_set_threads(GraphContext *graph, int threads);
+
+/**
+ * @brief Enables evaluation with native x86-64 code.
+ *
+ * The native code gives the same results as the interpreter; machines
+ * without support keep using the interpreter.
+ *
+ * @param[in,out] graph The context.
+ * @param[in] jit Nonzero to compile expressions to native code.
+ */
+void graph_set_jit(GraphContext *graph, int jit);
+
+/**
+ * @brief Plots the derivative of the function instead of the function.
+ *
+ * The derivative is computed exactly alongside the function with dual
+ * numbers, not by finite differences. It is NaN wherever the function is.
+ *
+ * @param[in,out] graph The context.
+ * @param[in] derivative Nonzero to plot f'(x).
+ */
+void graph_set_derivative(GraphContext *graph, int derivative);
+
+/**
+ * @brief Computes guaranteed bounds of the function over the x range without sampling.
+ *
+ * The bounds come from interval arithmetic over a recursively bisected
+ * range: every value the function takes for x in the range is NaN or lies
+ * within them. They may be wider than the values actually reached, and are
+ * infinite when the function may overflow.
+ *
+ * @param[in,out] graph The context.
+ * @param[out] y_min Pointer receiving the lower bound.
+ * @param[out] y_max Pointer receiving the upper bound.
+ * @return GraphStatus Returns GRAPH_OK, GRAPH_ERROR_STATE, GRAPH_ERROR_MEMORY,
+ *         or GRAPH_ERROR_RANGE if the function is undefined over the whole range.
+ */
+GraphStatus graph_bounds(GraphContext *graph, double *y_min, double *y_max);
+
+/**
+ * @brief Renders the page as PostScript and passes it to a callback in blocks.
+ *
+ * @param[in,out] graph The context.
+ * @param[in] write The callback receiving the page.
+ * @param[in] user Passed to the callback with every block.
+ * @return GraphStatus Returns GRAPH_OK, GRAPH_ERROR_STATE, GRAPH_ERROR_MEMORY
+ *         or GRAPH_ERROR_OUTPUT.
+ */
+GraphStatus graph_render(GraphContext *graph, GraphWriteFn write, void *user);
+
+/**
+ * @brief Renders the page as PostScript into a newly allocated buffer.
+ *
+ * @param[in,out] graph The context.
+ * @param[out] data Pointer receiving the page, not null-terminated; release
+ *             it with graph_free_buffer().
+ * @param[out] length Pointer receiving the number of bytes in the page.
+ * @return GraphStatus Returns GRAPH_OK, GRAPH_ERROR_STATE or GRAPH_ERROR_MEMORY.
+ */
+GraphStatus graph_render_buffer(GraphContext *graph, char **data, size_t *length);
+
+/**
+ * @brief Frees a page returned by graph_render_buffer().
+ *
+ * @param[in] data The page (may be NULL).
+ */
+void graph_free_buffer(char *data);
+
+/**
+ * @brief Describes the error of the last failed call on the context.
+ *
+ * @param[in] graph The context.
+ * @return const char* Returns the message, or "" if the last call succeeded.
+ *         It stays valid until the next call on the context.
+ */
+const char* graph_error_message(const GraphContext *graph);
+
+/**
+ * @brief Returns where in the expression the last failed graph_parse() found its error.
+ *
+ * @param[in] graph The context.
+ * @return long Returns the byte offset into the expression, or -1 if the last
+ *         error does not refer to a position.
+ */
+long graph_error_position(const GraphContext *graph);
+
+#endif /* LIBGRAPH_H */
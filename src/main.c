@@ -4,99 +4,170 @@
 #include "utils.h"
 #include "parser.h"
 #include "post_script.h"
+#include "sampler.h"
+#include "job.h"
+#include "batch.h"
+#include "options.h"
+#include "serve.h"
+#include "cache.h"
 
-#define MAX_EXPR_LENGTH 256
+#define MAX_CACHE_MB (1 << 20)
+
+/**
+ * @brief How the program was asked to run besides rendering a single plot.
+ */
+typedef struct {
+    const char *manifest;       /**< Manifest given with --batch, or NULL */
+    int serve;                  /**< Set by --serve or --socket */
+    const char *socket_path;    /**< Socket given with --socket, or NULL to serve stdin/stdout */
+    const char *cache_dir;      /**< Directory of the on-disk render cache, or NULL */
+    int cache_mb;               /**< Size limit of the render cache in MiB */
+    const char *profile;        /**< Profile format given with --profile ("tree" or "folded"), or NULL */
+} RunMode;
 
 /**
  * @brief Parses the command line arguments and validates the input function.
  *
  * This function checks the provided command line parameters, validates the 
  * mathematical function, sets default or user-provided domain/range, and 
- * prepares the output file.
+ * prepares the output file. In batch and server mode the plots come from the
+ * manifest or the requests instead, and no positional arguments are expected.
+ * With --expr-file the function is read from a file or standard input and
+ * the positional arguments start at the output file. --profile prints a
+ * per-node profile of the function to standard output after rendering.
  *
  * @param[in] argc Number of arguments passed from the command line.
  * @param[in] argv Array of strings containing command-line arguments.
- * @param[out] func Pointer to a string holding the cleaned and validated 
- *                  mathematical function.
- * @param[out] outfile Pointer to a string holding the output file name.
- * @param[out] x_min Pointer to the lower bound of the x-axis domain.
- * @param[out] x_max Pointer to the upper bound of the x-axis domain.
- * @param[out] y_min Pointer to the lower bound of the y-axis range.
- * @param[out] y_max Pointer to the upper bound of the y-axis range.
- * @param[out] calc_x_range Flag indicating if the x range was set by the user.
- * @param[out] calc_y_range Flag indicating if the y range was set by the user.
+ * @param[out] job The plot to render: parsed function, output
+ *                 file and the default or user-provided ranges.
+ * @param[out] options Rendering options set by command line flags.
+ * @param[out] mode The batch or server mode selected, if any.
  *
  * @return int Returns 0 on success, or an error code:
  * - 1: Insufficient arguments.
  * - 2: Invalid mathematical function.
  * - 3: Unable to create/write to the output file.
  * - 4: Invalid format for range specification.
+ * - 5: Invalid option value, or an unreadable expression file.
  */
-int parse_args(int argc, char *argv[], char **func, char **outfile,
-               double *x_min, double *x_max, double *y_min, double *y_max,
-               int *calc_x_range, int *calc_y_range) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <function> <output file> [x_min:x_max:y_min:y_max]\n", 
-                argv[0]);
-        return 1;
+int parse_args(int argc, char *argv[], PlotJob *job, RenderOptions *options, RunMode *mode) {
+    char *positional[3];
+    int positional_count = 0;
+    const char *expr_file = NULL;
+    int status;
+
+    init_render_options(options);
+    init_job(job);
+
+    /* GRAPH_STATS turns the report on without changing the command line: 1 for stderr, or a file */
+    const char *stats_env = getenv("GRAPH_STATS");
+    if (stats_env != NULL && *stats_env != '\0' && strcmp(stats_env, "0") != 0) {
+        options->stats_path = strcmp(stats_env, "1") == 0 ? "-" : stats_env;
     }
+    mode->manifest = NULL;
+    mode->serve = 0;
+    mode->socket_path = NULL;
+    mode->cache_dir = NULL;
+    mode->cache_mb = DEFAULT_CACHE_MB;
+    mode->profile = NULL;
 
-    *func = NULL;
+    /* Separate options from the positional arguments */
+    for (int i = 1; i < argc; i++) {
+        int option = parse_render_option(options, argc, argv, &i);
+        if (option < 0) {
+            return 5;
+        } else if (option > 0) {
+            continue;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if (i + 1 >= argc || !parse_int_option(argv[i + 1], 1, MAX_SAMPLER_THREADS, &options->threads)) {
+                fprintf(stderr, "Error: -j expects an integer between 1 and %d.\n", MAX_SAMPLER_THREADS);
+                return 5;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options->stats_path = "-";
+        } else if (strcmp(argv[i], "--stats-file") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stats-file expects a file name.\n");
+                return 5;
+            }
+            options->stats_path = argv[++i];
+        } else if (strcmp(argv[i], "--expr-file") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --expr-file expects a file name or '-'.\n");
+                return 5;
+            }
+            expr_file = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            if (i + 1 >= argc || (strcmp(argv[i + 1], "tree") != 0 && strcmp(argv[i + 1], "folded") != 0)) {
+                fprintf(stderr, "Error: --profile expects 'tree' or 'folded'.\n");
+                return 5;
+            }
+            mode->profile = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --batch expects a manifest file.\n");
+                return 5;
+            }
+            mode->manifest = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            mode->serve = 1;
+        } else if (strcmp(argv[i], "--socket") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --socket expects a socket path.\n");
+                return 5;
+            }
+            mode->serve = 1;
+            mode->socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache-dir") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --cache-dir expects a directory.\n");
+                return 5;
+            }
+            mode->cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--cache-size") == 0) {
+            if (i + 1 >= argc || !parse_int_option(argv[i + 1], 0, MAX_CACHE_MB, &mode->cache_mb)) {
+                fprintf(stderr, "Error: --cache-size expects a size in MiB between 0 and %d.\n", MAX_CACHE_MB);
+                return 5;
+            }
+            i++;
+        } else if (positional_count < 3) {
+            positional[positional_count++] = argv[i];
+        }
+    }
+
+    if (mode->manifest != NULL || mode->serve) {
+        return 0;
+    }
 
-    /* Allocate memory for the cleaned function */
-    char *cleaned_func = (char *)malloc(MAX_EXPR_LENGTH * sizeof(char));
-    if (cleaned_func == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed.\n");
+    /* The function comes from the file instead of the first positional argument */
+    int first = expr_file != NULL ? 0 : 1;
+    if (positional_count < first + 1) {
+        fprintf(stderr, "Usage: %s [-j N] [--oversample N] [--adaptive [--tolerance T]] [--simplify T] [--jit] [--derivative] [--format ps|pgm|png [--raster-size N]] [--stats | --stats-file FILE] [--profile tree|folded] <function> <output file> [x_min:x_max:y_min:y_max]\n"
+                        "       %s [-j N] [render options] --expr-file <path | -> <output file> [x_min:x_max:y_min:y_max]\n"
+                        "       %s [-j N] [render options] [--stats | --stats-file FILE] [--cache-dir DIR] [--cache-size MB] --batch <manifest>\n"
+                        "       %s [-j N] [render options] [--cache-size MB] --serve | --socket <path>\n",
+                argv[0], argv[0], argv[0], argv[0]);
         return 1;
     }
 
-    /* Remove whitespace and validate the function */
-    remove_whitespace(cleaned_func, argv[1]);
-    *func = cleaned_func;
+    /* Parse and validate the function */
+    status = expr_file != NULL ? set_job_function_file(job, expr_file) : set_job_function(job, positional[0]);
+    if (status != 0) return status;
 
-    if (!validate_expression(*func)) {
-        fprintf(stderr, "Error: Invalid function provided.\n");
-        free(cleaned_func);
-        *func = NULL;
-        return 2;
-    }
+    status = set_job_outfile(job, positional[first]);
+    if (status != 0) return status;
 
-    *outfile = argv[2];
-    FILE *test_file = fopen(*outfile, "w");
+    FILE *test_file = fopen(job->outfile, "w");
     if (test_file == NULL) {
-        fprintf(stderr, "Error: Cannot create/write to file '%s'.\n", *outfile);
-        free(cleaned_func);
-        *func = NULL;
+        fprintf(stderr, "Error: Cannot create/write to file '%s'.\n", job->outfile);
         return 3;
     }
     fclose(test_file);
 
-    /* Set default ranges */
-    *calc_x_range = 1;
-    *calc_y_range = 1;
-    *x_min = -10.0;
-    *x_max = 10.0;
-    *y_min = -10.0;
-    *y_max = 10.0;
-
     /* Optional: Parse user-provided range */
-    if (argc >= 4) {
-        double temp_x_min, temp_x_max, temp_y_min, temp_y_max;
-        int matched_values = sscanf(argv[3], "%lf:%lf:%lf:%lf", 
-                                    &temp_x_min, &temp_x_max, &temp_y_min, &temp_y_max);
-        if (matched_values == 4) {
-            *x_min = temp_x_min;
-            *x_max = temp_x_max;
-            *y_min = temp_y_min;
-            *y_max = temp_y_max;
-            *calc_x_range = 0;
-            *calc_y_range = 0;
-        } else {
-            fprintf(stderr, "Error: Invalid format for range. Expected x_min:x_max:y_min:y_max\n");
-            free(cleaned_func);
-            *func = NULL;
-            return 4;
-        }
+    if (positional_count >= first + 2) {
+        return set_job_range(job, positional[first + 1]);
     }
 
     return 0;
@@ -106,7 +177,8 @@ int parse_args(int argc, char *argv[], char **func, char **outfile,
  * @brief Entry point of the program.
  *
  * Parses arguments, validates the input function, and generates a PostScript
- * file representing the mathematical graph of the function.
+ * file representing the mathematical graph of the function, renders every
+ * plot of a manifest in batch mode, or serves plot requests in server mode.
  *
  * @param[in] argc Number of arguments passed from the command line.
  * @param[in] argv Array of strings containing command-line arguments.
@@ -114,30 +186,42 @@ int parse_args(int argc, char *argv[], char **func, char **outfile,
  * @return int Returns EXIT_SUCCESS (0) on success, or an error code on failure.
  */
 int main(int argc, char *argv[]) {
-    char *func = NULL, *outfile;
-    double x_min, x_max, y_min, y_max;
-    int calc_x_range, calc_y_range;
-    int parse_args_status;
+    PlotJob job;
+    RenderOptions options;
+    RunMode mode;
+    int status;
 
     /* Parse command-line arguments */
-    parse_args_status = parse_args(argc, argv, &func, &outfile, 
-                                   &x_min, &x_max, &y_min, &y_max, 
-                                   &calc_x_range, &calc_y_range);
-    if (parse_args_status != 0) {
-        if (func) {
-            free(func);
+    status = parse_args(argc, argv, &job, &options, &mode);
+    if (status == 0) {
+        size_t cache_limit = (size_t)mode.cache_mb << 20;
+        DiskCache disk_cache;
+        DiskCache *cache = NULL;
+
+        if (mode.cache_dir != NULL && !mode.serve) {
+            if (init_disk_cache(&disk_cache, mode.cache_dir, cache_limit)) {
+                cache = &disk_cache;
+            } else {
+                fprintf(stderr, "Error: Cannot use cache directory '%s'; rendering without cache.\n", mode.cache_dir);
+            }
         }
-        return parse_args_status;
-    }
 
-    /* Generate PostScript file for the mathematical function */
-    generate_postscript(outfile, func, x_min, x_max, y_min, y_max, 
-                        calc_x_range, calc_y_range);
+        if (mode.manifest != NULL) {
+            status = run_batch(mode.manifest, &options, cache);
+        } else if (mode.serve) {
+            status = run_server(mode.socket_path, &options, cache_limit);
+        } else {
+            /* Generate PostScript file for the mathematical function */
+            status = run_job(&job, &options, cache);
+            if (status == 0 && mode.profile != NULL) {
+                status = profile_job(&job, &options, strcmp(mode.profile, "folded") == 0, stdout);
+            }
+        }
+        if (cache) free_disk_cache(cache);
+    }
 
     /* Free dynamically allocated memory */
-    if (func) {
-        free(func);
-    }
+    free_job(&job);
 
-    return EXIT_SUCCESS;
+    return status == 0 ? EXIT_SUCCESS : status;
 }
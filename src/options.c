@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "options.h"
+
+int parse_int_option(const char *text, long min, long max, int *value) {
+    char *end;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || parsed < min || parsed > max) {
+        return 0;
+    }
+    *value = (int)parsed;
+    return 1;
+}
+
+int parse_double_option(const char *text, double min, double max, double *value) {
+    char *end;
+    double parsed = strtod(text, &end);
+    if (end == text || *end != '\0' || !(parsed >= min && parsed <= max)) {
+        return 0;
+    }
+    *value = parsed;
+    return 1;
+}
+
+/*
+ * Matches argv[*index] against the rendering options and consumes its value.
+ */
+int parse_render_option(RenderOptions *options, int argc, char *argv[], int *index) {
+    int i = *index;
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(argv[i], "--oversample") == 0) {
+        if (value == NULL || !parse_int_option(value, 1, MAX_OVERSAMPLING, &options->oversampling)) {
+            fprintf(stderr, "Error: --oversample expects an integer between 1 and %d.\n", MAX_OVERSAMPLING);
+            return -1;
+        }
+    } else if (strcmp(argv[i], "--adaptive") == 0) {
+        options->adaptive = 1;
+        return 1;
+    } else if (strcmp(argv[i], "--jit") == 0) {
+        options->jit = 1;
+        return 1;
+    } else if (strcmp(argv[i], "--derivative") == 0) {
+        options->derivative = 1;
+        return 1;
+    } else if (strcmp(argv[i], "--tolerance") == 0) {
+        if (value == NULL || !parse_double_option(value, MIN_TOLERANCE, MAX_TOLERANCE, &options->tolerance)) {
+            fprintf(stderr, "Error: --tolerance expects a number between %g and %g.\n", MIN_TOLERANCE, MAX_TOLERANCE);
+            return -1;
+        }
+    } else if (strcmp(argv[i], "--simplify") == 0) {
+        if (value == NULL || !parse_double_option(value, 0.0, MAX_SIMPLIFY, &options->simplify)) {
+            fprintf(stderr, "Error: --simplify expects a number between 0 and %g.\n", MAX_SIMPLIFY);
+            return -1;
+        }
+    } else if (strcmp(argv[i], "--format") == 0) {
+        if (value != NULL && strcmp(value, "ps") == 0) options->format = FORMAT_PS;
+        else if (value != NULL && strcmp(value, "pgm") == 0) options->format = FORMAT_PGM;
+        else if (value != NULL && strcmp(value, "png") == 0) options->format = FORMAT_PNG;
+        else {
+            fprintf(stderr, "Error: --format expects 'ps', 'pgm' or 'png'.\n");
+            return -1;
+        }
+    } else if (strcmp(argv[i], "--raster-size") == 0) {
+        if (value == NULL || !parse_int_option(value, MIN_RASTER_SIZE, MAX_RASTER_SIZE, &options->raster_size)) {
+            fprintf(stderr, "Error: --raster-size expects an integer between %d and %d.\n", MIN_RASTER_SIZE, MAX_RASTER_SIZE);
+            return -1;
+        }
+    } else {
+        return 0;
+    }
+    (*index)++;
+    return 1;
+}
@@ -0,0 +1,47 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "post_script.h"
+
+/**
+ * @brief Parses an integer option value within the given bounds.
+ *
+ * @param[in] text The argument to parse.
+ * @param[in] min The smallest accepted value.
+ * @param[in] max The largest accepted value.
+ * @param[out] value Pointer receiving the parsed value.
+ *
+ * @return int Returns 1 if the whole argument is a valid integer in range, otherwise 0.
+ */
+int parse_int_option(const char *text, long min, long max, int *value);
+
+/**
+ * @brief Parses a floating point option value within the given bounds.
+ *
+ * @param[in] text The argument to parse.
+ * @param[in] min The smallest accepted value.
+ * @param[in] max The largest accepted value.
+ * @param[out] value Pointer receiving the parsed value.
+ *
+ * @return int Returns 1 if the whole argument is a valid number in range, otherwise 0.
+ */
+int parse_double_option(const char *text, double min, double max, double *value);
+
+/**
+ * @brief Parses one rendering option and its value, if it takes one.
+ *
+ * Recognizes --oversample N, --adaptive, --tolerance T, --simplify T, --jit,
+ * --derivative, --format ps|pgm|png and --raster-size N.
+ * The same options are accepted on the command line and in server requests.
+ *
+ * @param[in,out] options The options to update.
+ * @param[in] argc Number of arguments.
+ * @param[in] argv The arguments.
+ * @param[in,out] index Index of the option; advanced past its value when one is used.
+ *
+ * @return int Returns 1 if the option was applied, 0 if argv[*index] is not a
+ *             rendering option, or -1 if its value is invalid (reported on stderr).
+ */
+int parse_render_option(RenderOptions *options, int argc, char *argv[], int *index);
+
+#endif /* OPTIONS_H */
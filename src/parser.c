@@ -1,372 +1,582 @@
 #include <math.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include "parser.h"
+#include "bytecode.h"
 #include "utils.h"
 
-#define MAX_VALUE 1e6
 #define TRUE 1
 #define FALSE 0
 
-/* 
- * Validates the mathematical expression, ensuring proper syntax, balanced 
- * parentheses, and the presence of the variable 'x'.
+/*
+ * Stores the position and message of a parse error.
  */
-int validate_expression(const char *expr) {
-    int variable_found = FALSE;
-    int paren_count = 0;
+static void set_parse_error(ParseError *error, size_t position, const char *format, ...) {
+    va_list args;
+    error->position = position;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+}
 
-    while (*expr) {
-        if (is_valid_character(*expr)) {
-            if (*expr == 'x') {
-                variable_found = TRUE;
-            }
-        } else if (isalpha(*expr)) {
-            if (!handle_function(&expr, &paren_count, &variable_found)) {
-                return FALSE;
-            }
-        } else if (*expr == '(' || *expr == ')') {
-            if (!handle_parentheses(*expr, &paren_count)) {
-                return FALSE;
-            }
-        } else {
-            report_invalid_character(*expr);
-            return FALSE;
-        }
-        expr++;
-    }
+/* Pending item on the parser's stack */
+typedef enum {
+    MARK_OPERATOR,      /* Binary operator waiting for its right operand */
+    MARK_NEGATE,        /* Unary minus waiting for its factor */
+    MARK_PAREN,         /* Open '(' */
+    MARK_FUNCTION,      /* Open "name(" */
+    MARK_ABS            /* Open '|' */
+} MarkKind;
+
+typedef struct {
+    unsigned char kind;     /* MarkKind */
+    unsigned char op;       /* Operator character or FunctionId */
+    uint32_t position;      /* Offset of the token that pushed the mark, for error messages */
+} Mark;
+
+/* State of one parse: the tree being built and the two explicit stacks */
+typedef struct {
+    ExprTree *tree;
+    Mark *marks;
+    size_t mark_count;
+    size_t mark_capacity;
+    NodeId *operands;
+    size_t operand_count;
+    size_t operand_capacity;
+    int failed;             /* Set when memory allocation failed */
+} Parser;
+
+/* Grows a stack array to hold one more element */
+static int reserve(void **items, size_t *capacity, size_t count, size_t size) {
+    if (count < *capacity) return TRUE;
+    size_t grown = *capacity ? *capacity * 2 : 64;
+    void *resized = realloc(*items, grown * size);
+    if (resized == NULL) return FALSE;
+    *items = resized;
+    *capacity = grown;
+    return TRUE;
+}
 
-    if (paren_count != 0) {
-        report_unmatched_parenthesis();
-        return FALSE;
+static void push_mark(Parser *parser, MarkKind kind, unsigned char op, size_t position) {
+    if (!reserve((void**)&parser->marks, &parser->mark_capacity, parser->mark_count, sizeof(Mark))) {
+        parser->failed = TRUE;
+        return;
     }
+    Mark *mark = &parser->marks[parser->mark_count++];
+    mark->kind = (unsigned char)kind;
+    mark->op = op;
+    mark->position = position < UINT32_MAX ? (uint32_t)position : UINT32_MAX;
+}
 
-    if (!variable_found) {
-        fprintf(stderr, "Error: No variable 'x' found in the expression.\n");
-        return FALSE;
+static void push_operand(Parser *parser, NodeId node) {
+    if (node == NO_NODE ||
+        !reserve((void**)&parser->operands, &parser->operand_capacity, parser->operand_count, sizeof(NodeId))) {
+        parser->failed = TRUE;
+        return;
     }
+    parser->operands[parser->operand_count++] = node;
+}
 
-    return TRUE;
+/* '+' and '-' bind looser than '*', '/' and '^', which share one level */
+static int precedence(unsigned char operator) {
+    return operator == '+' || operator == '-' ? 1 : 2;
 }
 
-/* 
- * Checks whether the given character is valid in a mathematical expression.
+/*
+ * Combines the operands of the pending binary operators that bind at least
+ * as tightly as 'level', left to right.
  */
-int is_valid_character(char c) {
-    return isdigit(c) || c == '.' || c == ' ' || c == 'x' || 
-           c == '+' || c == '-' || c == '*' || c == '/' || c == '^' || c == '|';
+static void reduce(Parser *parser, int level) {
+    while (!parser->failed && parser->mark_count > 0) {
+        const Mark *top = &parser->marks[parser->mark_count - 1];
+        if (top->kind != MARK_OPERATOR || precedence(top->op) < level) return;
+        NodeId right = parser->operands[--parser->operand_count];
+        NodeId left = parser->operands[--parser->operand_count];
+        parser->mark_count--;
+        push_operand(parser, create_operator_node(parser->tree, (char)top->op, left, right));
+    }
 }
 
-/* 
- * Parses and validates a mathematical function (e.g., sin, cos, log) in the expression.
- * Ensures the function is followed by parentheses and checks for nested arguments.
+/*
+ * Pushes a finished factor, applying the unary minuses written before it,
+ * innermost first.
  */
-int handle_function(const char **expr, int *paren_count, int *variable_found) {
-    const char *start = *expr;
-    const char *functions[] = {"sin", "cos", "tan", "ln", "log", "exp", 
-                               "asin", "acos", "atan", "sinh", "cosh", "tanh", "abs"};
-    int func_len = 0;
-
-    /* Determine the length of the function name */
-    while (isalpha(**expr)) {
-        (*expr)++;
+static void finish_factor(Parser *parser, NodeId node) {
+    while (node != NO_NODE && parser->mark_count > 0 && parser->marks[parser->mark_count - 1].kind == MARK_NEGATE) {
+        parser->mark_count--;
+        NodeId minus_one = create_const_node(parser->tree, -1);
+        node = minus_one == NO_NODE ? NO_NODE : create_operator_node(parser->tree, '*', minus_one, node);
     }
-    func_len = *expr - start;
-
-    /* Validate function name */
-    int is_valid = FALSE;
-    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
-        if (strncmp(start, functions[i], func_len) == 0 && functions[i][func_len] == '\0') {
-            is_valid = TRUE;
-            break;
+    push_operand(parser, node);
+}
+
+/*
+ * Converts a numeric literal: "0x" followed by hexadecimal digits, a zero
+ * followed by octal digits, or decimal digits with an optional fraction.
+ * Returns the number of bytes used, 0 if there is no number at 'text'.
+ */
+static size_t scan_number(const char *text, size_t length, double *value) {
+    char local[64];
+    char *digits = local;
+    size_t used = 0;
+    int base = 10;
+
+    if (length > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X') && isxdigit((unsigned char)text[2])) {
+        base = 16;
+        used = 2;
+        while (used < length && isxdigit((unsigned char)text[used])) used++;
+    } else if (length > 1 && text[0] == '0' && isdigit((unsigned char)text[1])) {
+        base = 8;
+        while (used < length && text[used] >= '0' && text[used] <= '7') used++;
+    } else {
+        size_t digit_count = 0;
+        while (used < length && isdigit((unsigned char)text[used])) used++;
+        digit_count = used;
+        if (used < length && text[used] == '.') {
+            used++;
+            while (used < length && isdigit((unsigned char)text[used])) used++;
+            digit_count = used - 1;
         }
+        if (digit_count == 0) return 0;
     }
 
-    if (!is_valid) {
-        fprintf(stderr, "Error: Invalid function in expression: \"%.*s\".\n", func_len, start);
-        return FALSE;
+    /* The text need not be terminated, so the literal is converted from a copy */
+    if (used >= sizeof(local)) {
+        digits = (char*)malloc(used + 1);
+        if (digits == NULL) return 0;
     }
+    memcpy(digits, text, used);
+    digits[used] = '\0';
+    *value = base == 10 ? strtod(digits, NULL) : (double)strtol(digits, NULL, base);
+    if (digits != local) free(digits);
+    return used;
+}
 
-    /* Ensure function is followed by '(' */
-    if (**expr != '(') {
-        fprintf(stderr, "Error: Function \"%.*s\" must be followed by '('.\n", func_len, start);
-        return FALSE;
-    }
+/* Perfect hash of the supported function names, see lookup_function() */
+#define FUNCTION_HASH(name, length) \
+    ((((unsigned char)(name)[0] + (unsigned char)(name)[(length) - 1]) * 4 + \
+      (unsigned char)(name)[1] * 13 + (length)) & 15)
 
-    (*expr)++;
-    (*paren_count)++;
-
-    /* Parse function arguments */
-    while (**expr && **expr != ')') {
-        if (**expr == '(') {
-            (*paren_count)++;
-        } else if (**expr == ')') {
-            (*paren_count)--;
-        } else if (**expr == 'x') {
-            *variable_found = TRUE;
+/*
+ * Parses and validates an expression in one pass over the text. Operators
+ * and open groups wait on an explicit stack rather than the C stack, so the
+ * nesting depth is limited only by memory.
+ */
+int parse_text(const char *text, size_t length, ExprTree **tree, ParseError *error) {
+    Parser parser = { NULL, NULL, 0, 0, NULL, 0, 0, FALSE };
+    int expect_operand = TRUE;
+    int variable_found = FALSE;
+    int status = PARSE_OK;
+    size_t position = 0;
+
+    *tree = NULL;
+    parser.tree = create_tree(length / 4 + 16);
+    if (parser.tree == NULL) parser.failed = TRUE;
+
+    while (!parser.failed && status == PARSE_OK) {
+        while (position < length && isspace((unsigned char)text[position])) position++;
+        if (position == length) break;
+        char c = text[position];
+
+        if (expect_operand) {
+            double value;
+            size_t used;
+            if (c == '-' || c == '(' || c == '|') {
+                push_mark(&parser, c == '-' ? MARK_NEGATE : c == '(' ? MARK_PAREN : MARK_ABS, 0, position);
+                position++;
+            } else if (c == 'x') {
+                variable_found = TRUE;
+                finish_factor(&parser, create_var_node(parser.tree));
+                expect_operand = FALSE;
+                position++;
+            } else if ((used = scan_number(text + position, length - position, &value)) > 0) {
+                finish_factor(&parser, create_const_node(parser.tree, value));
+                expect_operand = FALSE;
+                position += used;
+            } else if (isalpha((unsigned char)c)) {
+                size_t name = position;
+                while (position < length && isalpha((unsigned char)text[position])) position++;
+                FunctionId function = lookup_function(text + name, position - name);
+                int name_length = position - name > 32 ? 32 : (int)(position - name);
+                while (position < length && isspace((unsigned char)text[position])) position++;
+                if (function == FUNC_UNKNOWN) {
+                    set_parse_error(error, name, "Invalid function in expression: \"%.*s\"", name_length, text + name);
+                    status = PARSE_INVALID;
+                } else if (position == length || text[position] != '(') {
+                    set_parse_error(error, position, "Function \"%.*s\" must be followed by '('", name_length, text + name);
+                    status = PARSE_INVALID;
+                } else {
+                    push_mark(&parser, MARK_FUNCTION, (unsigned char)function, position);
+                    position++;
+                }
+            } else if (c == '.' || strchr("+*/^)", c)) {
+                set_parse_error(error, position, "Expected a number, 'x', a function or '(' before '%c'", c);
+                status = PARSE_INVALID;
+            } else {
+                set_parse_error(error, position, "Invalid character '%c' in expression", c);
+                status = PARSE_INVALID;
+            }
+        } else if (c == '+' || c == '-' || c == '*' || c == '/' || c == '^') {
+            reduce(&parser, precedence((unsigned char)c));
+            push_mark(&parser, MARK_OPERATOR, (unsigned char)c, position);
+            expect_operand = TRUE;
+            position++;
+        } else if (c == ')' || c == '|') {
+            /* Closes the innermost group, which must be of the matching kind */
+            reduce(&parser, 1);
+            const Mark *top = parser.mark_count > 0 ? &parser.marks[parser.mark_count - 1] : NULL;
+            int matched = top && (c == '|' ? top->kind == MARK_ABS : top->kind == MARK_PAREN || top->kind == MARK_FUNCTION);
+            if (!matched) {
+                set_parse_error(error, position, c == '|' ? "Unmatched '|'" : "Unmatched closing parenthesis");
+                status = PARSE_INVALID;
+            } else if (!parser.failed) {
+                NodeId node = parser.operands[--parser.operand_count];
+                parser.mark_count--;
+                if (top->kind == MARK_FUNCTION) node = create_function_node(parser.tree, (FunctionId)top->op, node);
+                if (top->kind == MARK_ABS) node = create_function_node(parser.tree, FUNC_ABS, node);
+                finish_factor(&parser, node);
+                position++;
+            }
+        } else if (isalnum((unsigned char)c) || c == '.' || c == '(') {
+            set_parse_error(error, position, "Expected an operator before '%c'", c);
+            status = PARSE_INVALID;
+        } else {
+            set_parse_error(error, position, "Invalid character '%c' in expression", c);
+            status = PARSE_INVALID;
         }
-        (*expr)++;
     }
 
-    if (**expr != ')') {
-        fprintf(stderr, "Error: Unmatched opening parenthesis in function \"%.*s\".\n", func_len, start);
-        return FALSE;
+    if (!parser.failed && status == PARSE_OK) {
+        if (expect_operand) {
+            set_parse_error(error, length, "Expected a number, 'x', a function or '('");
+            status = PARSE_INVALID;
+        } else {
+            reduce(&parser, 1);
+        }
+    }
+    if (!parser.failed && status == PARSE_OK && parser.mark_count > 0) {
+        /* Points at the innermost group left open */
+        const Mark *open = &parser.marks[parser.mark_count - 1];
+        set_parse_error(error, open->position, open->kind == MARK_ABS ? "Unmatched '|'" : "Unmatched opening parenthesis");
+        status = PARSE_INVALID;
+    }
+    if (!parser.failed && status == PARSE_OK && !variable_found) {
+        set_parse_error(error, 0, "No variable 'x' found in the expression");
+        status = PARSE_INVALID;
+    }
+    if (parser.failed) {
+        set_parse_error(error, position, "Memory allocation failed");
+        status = PARSE_NO_MEMORY;
     }
 
-    (*paren_count)--; 
-    return TRUE;
-}
-
-/* 
- * Updates the parenthesis count and checks for unmatched parentheses.
- */
-int handle_parentheses(char c, int *paren_count) {
-    if (c == '(') {
-        (*paren_count)++;
-    } else if (c == ')') {
-        (*paren_count)--;
-        if (*paren_count < 0) {
-            fprintf(stderr, "Error: Unmatched closing parenthesis.\n");
-            return FALSE;
+    if (status == PARSE_OK) {
+        parser.tree->root = parser.operands[0];
+        /* Release the slack of the initial estimate */
+        if (parser.tree->count < parser.tree->capacity) {
+            Node *nodes = (Node*)realloc(parser.tree->nodes, parser.tree->count * sizeof(Node));
+            if (nodes != NULL) {
+                parser.tree->nodes = nodes;
+                parser.tree->capacity = parser.tree->count;
+            }
         }
+        *tree = parser.tree;
+    } else {
+        free_tree(parser.tree);
     }
-    return TRUE;
+    free(parser.marks);
+    free(parser.operands);
+    return status;
 }
 
 /* 
- * Reports an error for an invalid character encountered in the expression.
+ * Validates an expression by parsing it and discarding the tree.
  */
-void report_invalid_character(char c) {
-    fprintf(stderr, "Error: Invalid character '%c' in expression.\n", c);
+int validate_expression(const char *expr, ParseError *error) {
+    ExprTree *tree;
+    int status = parse_text(expr, strlen(expr), &tree, error);
+    free_tree(tree);
+    return status == PARSE_OK;
 }
 
 /* 
- * Reports an error for unmatched opening parentheses.
+ * Parses a complete expression string into a newly allocated tree.
  */
-void report_unmatched_parenthesis(void) {
-    fprintf(stderr, "Error: Unmatched opening parenthesis.\n");
+ExprTree* parse_tree(const char *expr) {
+    ExprTree *tree;
+    ParseError error;
+    parse_text(expr, strlen(expr), &tree, &error);
+    return tree;
 }
 
-/* 
- * Skips whitespace characters in the expression string.
- */
-void skip_whitespace(const char **expr) {
-    while (isspace(**expr)) {
-        (*expr)++;
+/* Names of the supported functions, indexed by FunctionId */
+static const char *function_names[] = {
+    "sin", "cos", "tan", "asin", "acos", "atan",
+    "sinh", "cosh", "tanh", "ln", "log", "exp", "abs"
+};
+
+/* Functions by FUNCTION_HASH() of their names; every name has its own slot */
+static const unsigned char function_slots[16] = {
+    FUNC_LN, FUNC_TANH, FUNC_LOG, FUNC_COSH, FUNC_ATAN, FUNC_SINH, FUNC_UNKNOWN, FUNC_ASIN,
+    FUNC_TAN, FUNC_UNKNOWN, FUNC_UNKNOWN, FUNC_ACOS, FUNC_SIN, FUNC_ABS, FUNC_COS, FUNC_EXP
+};
+
+/* Look up a function by name with one hash probe and one comparison */
+FunctionId lookup_function(const char *name, size_t length) {
+    if (length < 2 || length > 4) return FUNC_UNKNOWN;
+    FunctionId function = (FunctionId)function_slots[FUNCTION_HASH(name, length)];
+    if (function == FUNC_UNKNOWN || strlen(function_names[function]) != length ||
+        memcmp(name, function_names[function], length) != 0) {
+        return FUNC_UNKNOWN;
     }
+    return function;
 }
 
-/* 
- * Parses a numeric value (hexadecimal, octal, or decimal) from the expression.
- */
-Node* parse_number(const char **expr) {
-    skip_whitespace(expr);
-
-    if (**expr == '0' && ((*expr)[1] == 'x' || (*expr)[1] == 'X')) {
-        char* end;
-        long int value = strtol(*expr, &end, 16);
-        *expr = end;
-        return create_const_node((double)value);
-    }
+/* Get the name of a function */
+const char* function_name(FunctionId function) {
+    return function < FUNC_UNKNOWN ? function_names[function] : "?";
+}
+
+/* Create an empty tree with room for the given number of nodes */
+ExprTree* create_tree(size_t capacity) {
+    ExprTree* tree = (ExprTree*)malloc(sizeof(ExprTree));
+    if (tree == NULL) return NULL;
+    if (capacity > NO_NODE) capacity = NO_NODE;
 
-    if (**expr == '0' && isdigit((*expr)[1])) {
-        char* end;
-        long int value = strtol(*expr, &end, 8);
-        *expr = end;
-        return create_const_node((double)value);
+    tree->nodes = capacity ? (Node*)malloc(capacity * sizeof(Node)) : NULL;
+    if (capacity && tree->nodes == NULL) {
+        free(tree);
+        return NULL;
     }
+    tree->count = 0;
+    tree->capacity = (uint32_t)capacity;
+    tree->root = NO_NODE;
+    tree->deduplicated = 0;
+    return tree;
+}
 
-    char* end;
-    double value = strtod(*expr, &end);
-    *expr = end;
-    return create_const_node(value);
+/* Copy the used part of the node array into a new tree */
+ExprTree* copy_tree(const ExprTree *tree) {
+    ExprTree *copy = create_tree(tree->count);
+    if (copy == NULL) return NULL;
+    if (tree->count) memcpy(copy->nodes, tree->nodes, tree->count * sizeof(Node));
+    copy->count = tree->count;
+    copy->root = tree->root;
+    copy->deduplicated = tree->deduplicated;
+    return copy;
 }
 
-/* 
- * Parses a mathematical function and its arguments from the expression.
+/*
+ * Compares the trees node by node, field by field, since unused union bytes
+ * may differ.
  */
-Node* parse_function(const char **expr) {
-    skip_whitespace(expr);
-    char func[5] = {0};
-    int i = 0;
-
-    while (isalpha(**expr) && i < 4) {
-        func[i++] = *(*expr)++;
-    }
-    func[i] = '\0';
-
-    if (**expr == '(') {
-        (*expr)++;
-        Node* argument = parse_expression(expr);
-        if (**expr == ')') (*expr)++;
-        return create_function_node(func, argument);
+int trees_equal(const ExprTree *a, const ExprTree *b) {
+    if (a->count != b->count || a->root != b->root) return FALSE;
+    for (NodeId i = 0; i < a->count; i++) {
+        const Node *p = &a->nodes[i];
+        const Node *q = &b->nodes[i];
+        if (p->type != q->type || p->op != q->op) return FALSE;
+        if (p->type == CONST && memcmp(&p->data.value, &q->data.value, sizeof(double)) != 0) return FALSE;
+        if ((p->type == OPERATOR || p->type == FUNCTION) &&
+            (p->data.child.left != q->data.child.left || p->data.child.right != q->data.child.right)) {
+            return FALSE;
+        }
     }
-    return NULL;
+    return TRUE;
 }
 
 /* 
- * Parses a factor: a number, variable, function, or expression in parentheses.
+ * Appends a node to the tree's node array, doubling the array when full.
  */
-Node* parse_factor(const char **expr) {
-    skip_whitespace(expr);
-
-    if (**expr == '-') {
-        (*expr)++;
-        Node* node = parse_factor(expr);
-        return create_operator_node('*', create_const_node(-1), node);
+static NodeId append_node(ExprTree *tree, unsigned char type, unsigned char op) {
+    if (tree->count == tree->capacity) {
+        if (tree->capacity == NO_NODE) return NO_NODE;
+        uint64_t new_capacity = tree->capacity ? (uint64_t)tree->capacity * 2 : 16;
+        if (new_capacity > NO_NODE) new_capacity = NO_NODE;
+        Node* nodes = (Node*)realloc(tree->nodes, (size_t)new_capacity * sizeof(Node));
+        if (nodes == NULL) return NO_NODE;
+        tree->nodes = nodes;
+        tree->capacity = (uint32_t)new_capacity;
     }
+    NodeId id = tree->count++;
+    tree->nodes[id].type = type;
+    tree->nodes[id].op = op;
+    return id;
+}
+
+/* Create a node for a constant value */
+NodeId create_const_node(ExprTree *tree, double value) {
+    NodeId id = append_node(tree, CONST, 0);
+    if (id != NO_NODE) tree->nodes[id].data.value = value;
+    return id;
+}
+
+/* Create a node for a variable */
+NodeId create_var_node(ExprTree *tree) {
+    return append_node(tree, VAR, 'x');
+}
 
-    if (**expr == '|') {
-        (*expr)++;
-        Node* node = parse_expression(expr);
-        if (**expr == '|') (*expr)++;
-        return create_function_node("abs", node);
+/* Create a node for an operator */
+NodeId create_operator_node(ExprTree *tree, char operator, NodeId left, NodeId right) {
+    NodeId id = append_node(tree, OPERATOR, (unsigned char)operator);
+    if (id != NO_NODE) {
+        tree->nodes[id].data.child.left = left;
+        tree->nodes[id].data.child.right = right;
     }
+    return id;
+}
 
-    if (isdigit(**expr) || **expr == '.') {
-        return parse_number(expr);
-    } else if (**expr == 'x') {
-        (*expr)++;
-        return create_var_node();
-    } else if (isalpha(**expr)) {
-        return parse_function(expr);
-    } else if (**expr == '(') {
-        (*expr)++;
-        Node* node = parse_expression(expr);
-        if (**expr == ')') (*expr)++;
-        return node;
+/* Create a node for a function */
+NodeId create_function_node(ExprTree *tree, FunctionId function, NodeId argument) {
+    NodeId id = append_node(tree, FUNCTION, (unsigned char)function);
+    if (id != NO_NODE) {
+        tree->nodes[id].data.child.left = argument;
+        tree->nodes[id].data.child.right = NO_NODE;
     }
-    return NULL;
+    return id;
 }
 
 /* 
- * Parses terms involving multiplication, division, or exponentiation.
+ * Applies a binary operator to two evaluated operands.
  */
-Node* parse_term(const char **expr) {
-    skip_whitespace(expr);
-    Node* node = parse_factor(expr);
-
-    while (**expr == '^' || **expr == '*' || **expr == '/') {
-        char operator = *(*expr)++;
-        skip_whitespace(expr);
-        Node* right = parse_factor(expr);
-        node = create_operator_node(operator, node, right);
-    }
-    return node;
+double apply_operator(char operator, double left_val, double right_val) {
+    return run_operator(operator_opcode(operator), left_val, right_val);
 }
 
 /* 
- * Parses the full expression, handling addition and subtraction.
+ * Applies a function to an evaluated argument.
  */
-Node* parse_expression(const char **expr) {
-    skip_whitespace(expr);
-    Node* node = parse_term(expr);
-
-    while (**expr == '+' || **expr == '-') {
-        char operator = *(*expr)++;
-        skip_whitespace(expr);
-        Node* right = parse_term(expr);
-        node = create_operator_node(operator, node, right);
-    }
-    return node;
+double apply_function(FunctionId function, double arg_val) {
+    return run_function(function_opcode((unsigned char)function), arg_val);
 }
 
-/* Create a node for a constant value */
-Node* create_const_node(double value) {
-    Node* node = (Node*)malloc(sizeof(Node));
-    node->type = CONST;
-    node->value = value;
-    node->left = node->right = NULL;
-    return node;
+/* 
+ * Recursively evaluates the subtree rooted at the given node.
+ */
+static double evaluate_node(const ExprTree* tree, NodeId id, double x) {
+    if (id == NO_NODE) return create_nan();
+    const Node* root = &tree->nodes[id];
+
+    switch (root->type) {
+        case CONST:
+            return root->data.value;
+        case VAR:
+            return x;
+        case OPERATOR:
+            return apply_operator((char)root->op,
+                                  evaluate_node(tree, root->data.child.left, x),
+                                  evaluate_node(tree, root->data.child.right, x));
+        case FUNCTION:
+            return apply_function((FunctionId)root->op,
+                                  evaluate_node(tree, root->data.child.left, x));
+    }
+    return create_nan();
 }
 
-/* Create a node for a variable */
-Node* create_var_node() {
-    Node* node = (Node*)malloc(sizeof(Node));
-    node->type = VAR;
-    node->variable = 'x';
-    node->left = node->right = NULL;
-    return node;
+double evaluate(const ExprTree* tree, double x) {
+    if (!tree) return create_nan();
+    return evaluate_node(tree, tree->root, x);
 }
 
-/* Create a node for an operator */
-Node* create_operator_node(char operator, Node* left, Node* right) {
-    Node* node = (Node*)malloc(sizeof(Node));
-    node->type = OPERATOR;
-    node->operator = operator;
-    node->left = left;
-    node->right = right;
-    return node;
+/* 
+ * Evaluates the tree for many values of 'x' through the batch evaluator,
+ * falling back to evaluate() if the tree cannot be compiled.
+ */
+void evaluate_batch(const ExprTree* tree, const double *xs, double *ys, size_t n) {
+    Program* program = compile_tree(tree);
+    if (program == NULL) {
+        for (size_t i = 0; i < n; i++) {
+            ys[i] = evaluate(tree, xs[i]);
+        }
+        return;
+    }
+    evaluate_program_batch(program, xs, ys, n);
+    free_program(program);
 }
 
-/* Create a node for a function */
-Node* create_function_node(const char* function, Node* argument) {
-    Node* node = (Node*)malloc(sizeof(Node));
-    node->type = FUNCTION;
-    strncpy(node->function, function, 4);
-    node->function[4] = '\0';
-    node->left = argument;
-    node->right = NULL;
-    return node;
+/*
+ * Marks the nodes reachable from the root. Children always have smaller
+ * indices than their parents, so one backwards sweep suffices.
+ */
+unsigned char* mark_live_nodes(const ExprTree *tree) {
+    unsigned char *live = (unsigned char*)calloc(tree->count ? tree->count : 1, 1);
+    if (live == NULL) return NULL;
+    if (tree->root == NO_NODE) return live;
+
+    live[tree->root] = 1;
+    for (NodeId i = tree->root + 1; i-- > 0;) {
+        const Node *node = &tree->nodes[i];
+        if (!live[i] || (node->type != OPERATOR && node->type != FUNCTION)) continue;
+        if (node->data.child.left != NO_NODE) live[node->data.child.left] = 1;
+        if (node->type == OPERATOR && node->data.child.right != NO_NODE) live[node->data.child.right] = 1;
+    }
+    return live;
 }
 
-double evaluate(Node* root, double x) {
-    if (!root) return create_nan();
+/*
+ * Removes nodes that are no longer reachable from the root, keeping the
+ * remaining nodes in order.
+ */
+int prune_tree(ExprTree *tree) {
+    unsigned char *live = mark_live_nodes(tree);
+    NodeId *map = (NodeId*)malloc((tree->count ? tree->count : 1) * sizeof(NodeId));
+    if (live == NULL || map == NULL) {
+        free(live);
+        free(map);
+        return FALSE;
+    }
 
-    switch (root->type) {
-        case CONST:
-            return root->value;
-        case VAR:
-            return x;
-        case OPERATOR: {
-            double left_val = evaluate(root->left, x);
-            double right_val = evaluate(root->right, x);
-
-            if (!isfinite(left_val) || !isfinite(right_val)) return create_nan();
-
-            switch (root->operator) {
-                case '+': return left_val + right_val;
-                case '-': return left_val - right_val;
-                case '*': return left_val * right_val;
-                case '/': 
-                    if (fabs(right_val) < 1e-10) return create_nan();
-                    return left_val / right_val;
-                case '^': 
-                    if (left_val < 0 && floor(right_val) != right_val) return create_nan();
-                    double result = pow(left_val, right_val);
-                    return isfinite(result) && fabs(result) < MAX_VALUE ? result : create_nan();
+    NodeId count = 0;
+    for (NodeId i = 0; i < tree->count; i++) {
+        if (!live[i]) continue;
+        Node node = tree->nodes[i];
+        if (node.type == OPERATOR || node.type == FUNCTION) {
+            if (node.data.child.left != NO_NODE) node.data.child.left = map[node.data.child.left];
+            if (node.type == OPERATOR && node.data.child.right != NO_NODE) {
+                node.data.child.right = map[node.data.child.right];
             }
-            break;
         }
-        case FUNCTION: {
-            double arg_val = evaluate(root->left, x);
-            if (!isfinite(arg_val)) return create_nan();
-
-            /* Check longer function names first */
-            if (strcmp(root->function, "sinh") == 0) return sinh(arg_val);
-            if (strcmp(root->function, "cosh") == 0) return cosh(arg_val);
-            if (strcmp(root->function, "tanh") == 0) return tanh(arg_val);
-            if (strcmp(root->function, "asin") == 0) return asin(arg_val);
-            if (strcmp(root->function, "acos") == 0) return acos(arg_val);
-            if (strcmp(root->function, "atan") == 0) return atan(arg_val);
-            if (strcmp(root->function, "sin") == 0) return sin(arg_val);
-            if (strcmp(root->function, "cos") == 0) return cos(arg_val);
-            if (strcmp(root->function, "tan") == 0) return tan(arg_val);
-            if (strcmp(root->function, "log") == 0) return arg_val > 0 ? log10(arg_val) : create_nan();
-            if (strcmp(root->function, "exp") == 0) return exp(arg_val);
-            if (strcmp(root->function, "ln") == 0) return arg_val > 0 ? log(arg_val) : create_nan();
-            if (strcmp(root->function, "abs") == 0) return fabs(arg_val);
+        map[i] = count;
+        tree->nodes[count++] = node;
+    }
+    if (tree->root != NO_NODE) tree->root = map[tree->root];
+    tree->count = count;
+
+    free(live);
+    free(map);
+    return TRUE;
+}
+
+/*
+ * Children precede their parents, so one forward sweep sees every child's
+ * depth before it is needed.
+ */
+size_t tree_depth(const ExprTree *tree) {
+    if (tree == NULL || tree->root == NO_NODE) return 0;
+    uint32_t *depth = (uint32_t*)malloc(tree->count * sizeof(uint32_t));
+    if (depth == NULL) return 0;
+
+    for (NodeId i = 0; i < tree->count; i++) {
+        const Node *node = &tree->nodes[i];
+        uint32_t deepest = 0;
+        if (node->type == OPERATOR || node->type == FUNCTION) {
+            if (node->data.child.left != NO_NODE) deepest = depth[node->data.child.left];
+            if (node->data.child.right != NO_NODE && depth[node->data.child.right] > deepest) {
+                deepest = depth[node->data.child.right];
+            }
         }
+        depth[i] = deepest + 1;
     }
-    return create_nan();
+    size_t result = depth[tree->root];
+    free(depth);
+    return result;
 }
 
-/* Free the nodes in the expression tree */
-void free_tree(Node* root) {
-    if (!root) return;
-    free_tree(root->left);
-    free_tree(root->right);
-    free(root);
+/* Free the node array and the tree in one go */
+void free_tree(ExprTree* tree) {
+    if (!tree) return;
+    free(tree->nodes);
+    free(tree);
 }
@@ -1,145 +1,309 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+/** 
+ * @brief Largest magnitude accepted from an exponentiation before it is treated as NaN.
+ */
+#define MAX_VALUE 1e6
+
+/**
+ * @brief Smallest magnitude of a divisor; division by anything closer to zero gives NaN.
+ */
+#define MIN_DIVISOR 1e-10
+
 /** 
  * @brief Enum to specify the type of each node in the expression tree.
  */
 typedef enum { CONST, VAR, OPERATOR, FUNCTION } NodeType;
 
+/** 
+ * @brief Enum identifying the supported mathematical functions.
+ */
+typedef enum {
+    FUNC_SIN, FUNC_COS, FUNC_TAN, FUNC_ASIN, FUNC_ACOS, FUNC_ATAN,
+    FUNC_SINH, FUNC_COSH, FUNC_TANH, FUNC_LN, FUNC_LOG, FUNC_EXP, FUNC_ABS,
+    FUNC_UNKNOWN
+} FunctionId;
+
+/** 
+ * @brief Index of a node inside its tree's node array.
+ */
+typedef uint32_t NodeId;
+
+/** 
+ * @brief NodeId used for a missing child or a failed parse.
+ */
+#define NO_NODE UINT32_MAX
+
 /** 
  * @brief Structure to represent a node in the expression tree.
+ * 
+ * Nodes are stored by value in the node array of an ExprTree and refer to
+ * their children by index. Only the payload matching the node type is valid.
  */
 typedef struct Node {
-    NodeType type;      /**< Type of the node (CONST, VAR, OPERATOR, FUNCTION) */
-    double value;       /**< Constant value, if the node is of type CONST */
-    char variable;      /**< Variable character (assumed to be 'x') */
-    char operator;      /**< Operator character (+, -, *, /, ^) */
-    char function[5];   /**< Function name (e.g., "sin", "cos") */
-    struct Node *left;  /**< Pointer to the left child node */
-    struct Node *right; /**< Pointer to the right child node */
+    unsigned char type;     /**< Type of the node (CONST, VAR, OPERATOR, FUNCTION) */
+    unsigned char op;       /**< Operator character (+, -, *, /, ^) or FunctionId */
+    union {
+        double value;       /**< Constant value, if the node is of type CONST */
+        struct {
+            NodeId left;    /**< Left operand, or the argument of a function */
+            NodeId right;   /**< Right operand, NO_NODE for functions */
+        } child;
+    } data;
 } Node;
 
+/** 
+ * @brief Arena holding all nodes of one expression tree.
+ * 
+ * Nodes live in one contiguous array, so the whole tree is built without
+ * per-node allocations and released with a single free_tree() call.
+ * Children are always created before their parents, so every child has a
+ * smaller index than the nodes referring to it.
+ */
+typedef struct ExprTree {
+    Node *nodes;        /**< Contiguous node storage */
+    uint32_t count;     /**< Number of nodes in use */
+    uint32_t capacity;  /**< Number of allocated nodes */
+    NodeId root;        /**< Root of the expression, NO_NODE if empty */
+    uint32_t deduplicated; /**< Nodes merged into identical ones by share_subexpressions() */
+} ExprTree;
+
+/** 
+ * @brief Size of the message buffer of a ParseError, terminator included.
+ */
+#define PARSE_ERROR_SIZE 128
+
+/** 
+ * @brief Describes why an expression was rejected.
+ */
+typedef struct {
+    size_t position;                    /**< Byte offset of the error in the expression */
+    char message[PARSE_ERROR_SIZE];     /**< Human-readable description, without a trailing period */
+} ParseError;
+
+/** 
+ * @brief Result of parsing an expression.
+ */
+typedef enum {
+    PARSE_OK,           /**< The expression is valid and the tree was built */
+    PARSE_INVALID,      /**< The expression is malformed; see the ParseError */
+    PARSE_NO_MEMORY     /**< Memory allocation failed */
+} ParseStatus;
+
 /* Function declarations */
 
+/**
+ * @brief Validates a mathematical expression and builds its tree in one pass.
+ * 
+ * The text is tokenized and parsed in place: it need not be terminated,
+ * may be of any length and may contain whitespace between tokens. '+' and
+ * '-' bind looser than '*', '/' and '^', which share one level; all binary
+ * operators are left-associative and unary minus binds tightest. Pending
+ * operators and groups are kept on heap stacks, so neither the length nor
+ * the nesting depth is limited by the C stack, and the time is linear in
+ * the length of the text.
+ * 
+ * @param[in] text The expression text.
+ * @param[in] length Number of bytes of text.
+ * @param[out] tree Receives the parsed tree, or NULL if parsing failed.
+ * @param[out] error Receives the byte offset and description of the first error.
+ * @return int Returns a ParseStatus.
+ */
+int parse_text(const char *text, size_t length, ExprTree **tree, ParseError *error);
+
 /**
  * @brief Validates the mathematical expression for correctness.
  * 
+ * Nothing is printed; the reason for rejecting the expression is stored in
+ * 'error' instead.
+ * 
  * @param[in] expr The input mathematical expression as a string.
+ * @param[out] error Receives the position and description of the first error.
  * @return int Returns TRUE if the expression is valid, otherwise FALSE.
  */
-int validate_expression(const char *expr);
+int validate_expression(const char *expr, ParseError *error);
 
 /**
- * @brief Checks whether a character is valid in the mathematical expression.
+ * @brief Creates an empty expression tree.
  * 
- * @param[in] c The character to validate.
- * @return int Returns TRUE if the character is valid, otherwise FALSE.
+ * @param[in] capacity Number of nodes to reserve up front (may be 0).
+ * @return ExprTree* Returns the new tree, or NULL if memory allocation failed.
  */
-int is_valid_character(char c);
+ExprTree* create_tree(size_t capacity);
 
 /**
- * @brief Handles parsing and validation of functions like sin, cos, etc.
+ * @brief Parses a whole mathematical expression into a new expression tree.
  * 
- * @param[in,out] expr Pointer to the current position in the expression string.
- * @param[in,out] paren_count Pointer to track the balance of parentheses.
- * @param[in,out] variable_found Pointer to track if the variable 'x' is found.
- * @return int Returns TRUE if the function is valid, otherwise FALSE.
+ * @param[in] expr The input mathematical expression as a string.
+ * @return ExprTree* Returns the parsed tree, or NULL if the expression is
+ *         invalid or memory allocation failed.
  */
-int handle_function(const char **expr, int *paren_count, int *variable_found);
+ExprTree* parse_tree(const char *expr);
 
 /**
- * @brief Handles parentheses validation and balance tracking.
+ * @brief Creates an independent copy of an expression tree.
  * 
- * @param[in] c The current character ('(' or ')') being processed.
- * @param[in,out] paren_count Pointer to track the balance of parentheses.
- * @return int Returns TRUE if parentheses are balanced, otherwise FALSE.
+ * @param[in] tree Pointer to the expression tree.
+ * @return ExprTree* Returns the copy, or NULL if memory allocation failed.
  */
-int handle_parentheses(char c, int *paren_count);
+ExprTree* copy_tree(const ExprTree *tree);
 
 /**
- * @brief Reports an invalid character in the mathematical expression.
+ * @brief Checks whether two trees hold the same nodes in the same order.
+ * 
+ * Expressions that differ only in whitespace parse to equal trees.
  * 
- * @param[in] c The invalid character found in the expression.
+ * @param[in] a Pointer to the first tree.
+ * @param[in] b Pointer to the second tree.
+ * @return int Returns TRUE if the trees are equal, otherwise FALSE.
  */
-void report_invalid_character(char c);
+int trees_equal(const ExprTree *a, const ExprTree *b);
 
 /**
- * @brief Reports unmatched opening parentheses in the expression.
+ * @brief Looks up a function by name.
+ * 
+ * Uses a perfect hash of the supported names, so each lookup costs one
+ * probe and one comparison.
+ * 
+ * @param[in] name The function name (e.g., "sin", "cos").
+ * @param[in] length Number of characters in the name.
+ * @return FunctionId Returns the function, or FUNC_UNKNOWN for unsupported names.
  */
-void report_unmatched_parenthesis(void);
+FunctionId lookup_function(const char *name, size_t length);
 
 /**
- * @brief Parses a mathematical expression and constructs its expression tree.
+ * @brief Returns the name of a function.
  * 
- * @param[in,out] expr Pointer to the current position in the expression string.
- * @return Node* Returns a pointer to the root of the expression tree.
+ * @param[in] function The function identifier.
+ * @return const char* Returns the function name, or "?" for FUNC_UNKNOWN.
  */
-Node* parse_expression(const char** expr);
+const char* function_name(FunctionId function);
 
 /**
- * @brief Parses a term from the expression, handling multiplication, division, and exponentiation.
+ * @brief Creates a node representing a constant value.
  * 
- * @param[in,out] expr Pointer to the current position in the expression string.
- * @return Node* Returns a pointer to the parsed term node.
+ * @param[in,out] tree The tree to add the node to.
+ * @param[in] value The constant value to store in the node.
+ * @return NodeId Returns the index of the new node, or NO_NODE if memory allocation failed.
  */
-Node* parse_term(const char** expr);
+NodeId create_const_node(ExprTree *tree, double value);
 
 /**
- * @brief Parses a factor, which could be a number, variable, function, or subexpression.
+ * @brief Creates a node representing the variable 'x'.
  * 
- * @param[in,out] expr Pointer to the current position in the expression string.
- * @return Node* Returns a pointer to the parsed factor node.
+ * @param[in,out] tree The tree to add the node to.
+ * @return NodeId Returns the index of the new node, or NO_NODE if memory allocation failed.
  */
-Node* parse_factor(const char** expr);
+NodeId create_var_node(ExprTree *tree);
 
 /**
- * @brief Creates a node representing a constant value.
+ * @brief Creates a node representing an operator.
  * 
- * @param[in] value The constant value to store in the node.
- * @return Node* Returns a pointer to the newly created constant node.
+ * @param[in,out] tree The tree to add the node to.
+ * @param[in] operator The operator character (+, -, *, /, ^).
+ * @param[in] left Index of the left child node.
+ * @param[in] right Index of the right child node.
+ * @return NodeId Returns the index of the new node, or NO_NODE if memory allocation failed.
  */
-Node* create_const_node(double value);
+NodeId create_operator_node(ExprTree *tree, char operator, NodeId left, NodeId right);
 
 /**
- * @brief Creates a node representing the variable 'x'.
+ * @brief Creates a node representing a mathematical function.
  * 
- * @return Node* Returns a pointer to the newly created variable node.
+ * @param[in,out] tree The tree to add the node to.
+ * @param[in] function The function identifier.
+ * @param[in] argument Index of the argument node for the function.
+ * @return NodeId Returns the index of the new node, or NO_NODE if memory allocation failed.
  */
-Node* create_var_node(void);
+NodeId create_function_node(ExprTree *tree, FunctionId function, NodeId argument);
 
 /**
- * @brief Creates a node representing an operator.
+ * @brief Applies a binary operator to two evaluated operands.
+ * 
+ * Non-finite operands, division by a value closer to zero than
+ * MIN_DIVISOR, non-integer powers of negative numbers and powers reaching
+ * MAX_VALUE all yield NaN. The rules live in run_operator(), which this
+ * calls with the operator's opcode.
  * 
  * @param[in] operator The operator character (+, -, *, /, ^).
- * @param[in] left Pointer to the left child node.
- * @param[in] right Pointer to the right child node.
- * @return Node* Returns a pointer to the newly created operator node.
+ * @param[in] left_val Value of the left operand.
+ * @param[in] right_val Value of the right operand.
+ * @return double Returns the result, or NaN outside the operator's domain.
  */
-Node* create_operator_node(char operator, Node* left, Node* right);
+double apply_operator(char operator, double left_val, double right_val);
 
 /**
- * @brief Creates a node representing a mathematical function.
+ * @brief Applies a mathematical function to an evaluated argument.
+ *
+ * Calls run_function() with the function's opcode.
  * 
- * @param[in] function The function name (e.g., "sin", "cos").
- * @param[in] argument Pointer to the argument node for the function.
- * @return Node* Returns a pointer to the newly created function node.
+ * @param[in] function The function identifier.
+ * @param[in] arg_val Value of the argument.
+ * @return double Returns the result, or NaN outside the function's domain.
  */
-Node* create_function_node(const char* function, Node* argument);
+double apply_function(FunctionId function, double arg_val);
 
 /**
  * @brief Evaluates the expression tree for a given value of 'x'.
  * 
- * @param[in] root Pointer to the root of the expression tree.
+ * @param[in] tree Pointer to the expression tree.
  * @param[in] x The value of the variable 'x'.
  * @return double Returns the result of evaluating the expression tree.
  */
-double evaluate(Node* root, double x);
+double evaluate(const ExprTree* tree, double x);
+
+/**
+ * @brief Evaluates the expression tree for an array of 'x' values.
+ * 
+ * The tree is compiled once and evaluated block by block with vectorized
+ * operators, giving the same results as calling evaluate() for each value.
+ * 
+ * @param[in] tree Pointer to the expression tree.
+ * @param[in] xs Array of 'x' values.
+ * @param[out] ys Array receiving the results, may alias xs.
+ * @param[in] n Number of values in xs and ys.
+ */
+void evaluate_batch(const ExprTree* tree, const double *xs, double *ys, size_t n);
+
+/**
+ * @brief Marks the nodes of a tree that are reachable from its root.
+ * 
+ * @param[in] tree Pointer to the expression tree.
+ * @return unsigned char* Returns an array of tree->count flags, nonzero for
+ *         reachable nodes, to be released with free(), or NULL if memory
+ *         allocation failed.
+ */
+unsigned char* mark_live_nodes(const ExprTree* tree);
+
+/**
+ * @brief Computes the depth of a tree.
+ * 
+ * @param[in] tree Pointer to the expression tree.
+ * @return size_t Returns the number of nodes on the longest path from the
+ *         root to a leaf, 0 for an empty tree, or 0 if memory allocation failed.
+ */
+size_t tree_depth(const ExprTree *tree);
+
+/**
+ * @brief Removes the nodes that are not reachable from the root.
+ * 
+ * The remaining nodes keep their relative order, so children still precede
+ * their parents.
+ * 
+ * @param[in,out] tree Pointer to the expression tree.
+ * @return int Returns TRUE on success, FALSE if memory allocation failed.
+ */
+int prune_tree(ExprTree* tree);
 
 /**
- * @brief Frees the memory allocated for the expression tree.
+ * @brief Frees the expression tree and all of its nodes.
  * 
- * @param[in] root Pointer to the root of the expression tree.
+ * @param[in] tree Pointer to the expression tree (may be NULL).
  */
-void free_tree(Node* root);
+void free_tree(ExprTree* tree);
 
 #endif /* PARSER_H */
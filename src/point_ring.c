@@ -0,0 +1,80 @@
+#define _POSIX_C_SOURCE 200809L
+#include <sched.h>
+#include <stdlib.h>
+#include "point_ring.h"
+#include "utils.h"
+
+int point_ring_init(PointRing *ring, size_t capacity) {
+    ring->slots = (PathPoint*)malloc(capacity * sizeof(PathPoint));
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->cached_tail = 0;
+    ring->consumer_blocked = 0.0;
+    ring->tail = 0;
+    ring->cached_head = 0;
+    ring->producer_blocked = 0.0;
+    ring->closed = 0;
+    return ring->slots != NULL;
+}
+
+/*
+ * Reloads the consumer's position only when the ring looks full, and reads
+ * the clock only when it really is.
+ */
+void point_ring_push(PointRing *ring, const PathPoint *point) {
+    size_t tail = ring->tail;
+
+    if (tail - ring->cached_head > ring->mask) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail - ring->cached_head > ring->mask) {
+            double start = monotonic_seconds();
+            do {
+                sched_yield();
+                ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            } while (tail - ring->cached_head > ring->mask);
+            ring->producer_blocked += monotonic_seconds() - start;
+        }
+    }
+    ring->slots[tail & ring->mask] = *point;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void point_ring_close(PointRing *ring) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+/* Checks for new points, then for the end of the stream */
+static int ring_drained(PointRing *ring, size_t head) {
+    ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head != ring->cached_tail) return 0;
+    if (!__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) return -1;
+
+    /* Points pushed before the close are visible now */
+    ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return head == ring->cached_tail;
+}
+
+int point_ring_pop(PointRing *ring, PathPoint *point) {
+    size_t head = ring->head;
+
+    if (head == ring->cached_tail) {
+        int drained = ring_drained(ring, head);
+        if (drained < 0) {
+            double start = monotonic_seconds();
+            do {
+                sched_yield();
+                drained = ring_drained(ring, head);
+            } while (drained < 0);
+            ring->consumer_blocked += monotonic_seconds() - start;
+        }
+        if (drained) return 0;
+    }
+    *point = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void point_ring_free(PointRing *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
@@ -0,0 +1,87 @@
+#ifndef POINT_RING_H
+#define POINT_RING_H
+
+#include <stddef.h>
+
+/**
+ * @brief Number of points a ring holds unless asked otherwise; a power of two.
+ */
+#define POINT_RING_CAPACITY 1024
+
+/**
+ * @brief Point of a path in device space, passed from the plotter to the writer.
+ */
+typedef struct {
+    double x;       /**< The x coordinate in device units */
+    double y;       /**< The y coordinate in device units */
+    int move;       /**< Set if the point starts a new subpath */
+} PathPoint;
+
+/**
+ * @brief Bounded lock-free queue of points between one producer and one consumer thread.
+ *
+ * The producer owns 'tail' and the consumer owns 'head'; each publishes its
+ * index with a release store and reads the other's with an acquire load, so
+ * a point is fully written before the consumer can see it. Each side keeps
+ * its last view of the other's index and only reloads it when the ring
+ * looks full or empty, and the two indices live on separate cache lines, so
+ * the threads rarely touch each other's line. A side that finds the ring
+ * full or empty yields the processor until it changes and adds the time to
+ * its blocked total.
+ */
+typedef struct {
+    PathPoint *slots;           /**< Storage for 'capacity' points */
+    size_t mask;                /**< capacity - 1 */
+    char pad0[64];
+    size_t head;                /**< Count of points popped, written by the consumer only */
+    size_t cached_tail;         /**< Consumer's last view of tail */
+    double consumer_blocked;    /**< Seconds the consumer waited on an empty ring */
+    char pad1[64];
+    size_t tail;                /**< Count of points pushed, written by the producer only */
+    size_t cached_head;         /**< Producer's last view of head */
+    double producer_blocked;    /**< Seconds the producer waited on a full ring */
+    int closed;                 /**< Set by the producer once it pushed its last point */
+    char pad2[64];
+} PointRing;
+
+/**
+ * @brief Prepares an empty ring.
+ *
+ * @param[out] ring The ring to initialize.
+ * @param[in] capacity The number of points it holds; must be a power of two.
+ * @return int Returns 1 on success, 0 if memory allocation failed.
+ */
+int point_ring_init(PointRing *ring, size_t capacity);
+
+/**
+ * @brief Appends a point, waiting while the ring is full. Producer only.
+ *
+ * @param[in,out] ring The ring.
+ * @param[in] point The point to append.
+ */
+void point_ring_push(PointRing *ring, const PathPoint *point);
+
+/**
+ * @brief Tells the consumer no more points will be pushed. Producer only.
+ *
+ * @param[in,out] ring The ring.
+ */
+void point_ring_close(PointRing *ring);
+
+/**
+ * @brief Removes the oldest point, waiting while the ring is empty. Consumer only.
+ *
+ * @param[in,out] ring The ring.
+ * @param[out] point Receives the point.
+ * @return int Returns 1 if a point was removed, 0 once the ring is closed and drained.
+ */
+int point_ring_pop(PointRing *ring, PathPoint *point);
+
+/**
+ * @brief Frees the storage of a ring. Both threads must be done with it.
+ *
+ * @param[in,out] ring The ring.
+ */
+void point_ring_free(PointRing *ring);
+
+#endif /* POINT_RING_H */
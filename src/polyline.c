@@ -0,0 +1,130 @@
+#include <math.h>
+#include "polyline.h"
+
+#define PI 3.14159265358979323846
+#define DUPLICATE_DISTANCE 5e-4     /* Points closer than this round to the same output coordinate */
+
+/*
+ * Wraps an angle into (-PI, PI].
+ */
+static double wrap_angle(double angle) {
+    while (angle > PI) angle -= 2 * PI;
+    while (angle <= -PI) angle += 2 * PI;
+    return angle;
+}
+
+/*
+ * Starts an empty cone at the anchor.
+ */
+static void reset_cone(PolylineSimplifier *simplifier) {
+    simplifier->cone_empty = 1;
+    simplifier->cone_base = 0.0;
+    simplifier->cone_low = -PI;
+    simplifier->cone_high = PI;
+    simplifier->reach = 0.0;
+}
+
+/*
+ * Narrows the cone so that lines from the anchor pass within the tolerance
+ * of the given point.
+ */
+static void narrow_cone(PolylineSimplifier *simplifier, double x, double y) {
+    double dx = x - simplifier->anchor_x, dy = y - simplifier->anchor_y;
+    double distance = sqrt(dx * dx + dy * dy);
+    double direction = atan2(dy, dx);
+
+    if (distance > simplifier->reach) simplifier->reach = distance;
+    if (distance <= simplifier->tolerance) return;
+
+    if (simplifier->cone_empty) {
+        simplifier->cone_base = direction;
+        simplifier->cone_empty = 0;
+    }
+    double offset = wrap_angle(direction - simplifier->cone_base);
+    double spread = asin(simplifier->tolerance / distance);
+    if (offset - spread > simplifier->cone_low) simplifier->cone_low = offset - spread;
+    if (offset + spread < simplifier->cone_high) simplifier->cone_high = offset + spread;
+}
+
+/*
+ * Checks whether a line from the anchor to the given point passes within the
+ * tolerance of every dropped point and reaches at least as far as they do.
+ */
+static int inside_cone(const PolylineSimplifier *simplifier, double x, double y) {
+    double dx = x - simplifier->anchor_x, dy = y - simplifier->anchor_y;
+    if (sqrt(dx * dx + dy * dy) < simplifier->reach) return 0;
+    if (simplifier->cone_empty) return 1;
+
+    double offset = wrap_angle(atan2(dy, dx) - simplifier->cone_base);
+    return offset >= simplifier->cone_low && offset <= simplifier->cone_high;
+}
+
+/*
+ * Writes the pending point as the new anchor.
+ */
+static void emit_pending(PolylineSimplifier *simplifier) {
+    ps_lineto(simplifier->writer, simplifier->pending_x, simplifier->pending_y);
+    simplifier->points_out++;
+    simplifier->anchor_x = simplifier->pending_x;
+    simplifier->anchor_y = simplifier->pending_y;
+    simplifier->has_pending = 0;
+    reset_cone(simplifier);
+}
+
+void polyline_init(PolylineSimplifier *simplifier, PsWriter *writer, double tolerance) {
+    simplifier->writer = writer;
+    simplifier->tolerance = tolerance;
+    simplifier->open = 0;
+    simplifier->has_pending = 0;
+    simplifier->points_in = 0;
+    simplifier->points_out = 0;
+    simplifier->subpaths = 0;
+    reset_cone(simplifier);
+}
+
+/* End the current subpath and write the first point of the next one */
+void polyline_moveto(PolylineSimplifier *simplifier, double x, double y) {
+    polyline_finish(simplifier);
+    simplifier->points_in++;
+    simplifier->points_out++;
+    simplifier->subpaths++;
+    ps_moveto(simplifier->writer, x, y);
+    simplifier->open = 1;
+    simplifier->anchor_x = x;
+    simplifier->anchor_y = y;
+    reset_cone(simplifier);
+}
+
+/*
+ * Holds each point back until the next one shows whether it is a bend:
+ * the pending point is dropped if the line from the anchor to the new point
+ * still passes close enough to it and to everything dropped before.
+ */
+void polyline_lineto(PolylineSimplifier *simplifier, double x, double y) {
+    simplifier->points_in++;
+
+    double last_x = simplifier->has_pending ? simplifier->pending_x : simplifier->anchor_x;
+    double last_y = simplifier->has_pending ? simplifier->pending_y : simplifier->anchor_y;
+    if (fabs(x - last_x) < DUPLICATE_DISTANCE && fabs(y - last_y) < DUPLICATE_DISTANCE) return;
+
+    if (simplifier->has_pending) {
+        if (simplifier->tolerance > 0) {
+            narrow_cone(simplifier, simplifier->pending_x, simplifier->pending_y);
+            if (!inside_cone(simplifier, x, y)) {
+                /* The pending point is a bend; its cone restarts from the new anchor */
+                emit_pending(simplifier);
+            }
+        } else {
+            emit_pending(simplifier);
+        }
+    }
+    simplifier->pending_x = x;
+    simplifier->pending_y = y;
+    simplifier->has_pending = 1;
+}
+
+/* Write the last point of the subpath, which is never dropped */
+void polyline_finish(PolylineSimplifier *simplifier) {
+    if (simplifier->open && simplifier->has_pending) emit_pending(simplifier);
+    simplifier->open = 0;
+}
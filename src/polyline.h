@@ -0,0 +1,71 @@
+#ifndef POLYLINE_H
+#define POLYLINE_H
+
+#include <stddef.h>
+#include "ps_writer.h"
+
+/**
+ * @brief Streaming simplifier between the plotted points and the writer.
+ *
+ * Points that repeat the previous point in device space are dropped. A point
+ * is also dropped when the line from the last written point to the next one
+ * passes within the tolerance of it and of every point dropped since, which
+ * is checked incrementally by narrowing a cone of allowed directions (a
+ * streaming equivalent of Douglas-Peucker). Every subpath keeps its first and
+ * last point.
+ */
+typedef struct {
+    PsWriter *writer;       /**< Receives the simplified path */
+    double tolerance;       /**< Largest distance of a dropped point from the drawn line, 0 keeps all bends */
+    int open;               /**< Set while a subpath is in progress */
+    double anchor_x;        /**< Last point written in the current subpath */
+    double anchor_y;
+    int has_pending;        /**< Set if a point after the anchor is waiting to be written */
+    double pending_x;       /**< Last point received, not yet written */
+    double pending_y;
+    int cone_empty;         /**< Set while no point has narrowed the cone yet */
+    double cone_base;       /**< Direction the cone bounds are relative to, in radians */
+    double cone_low;        /**< Lowest allowed direction relative to cone_base */
+    double cone_high;       /**< Highest allowed direction relative to cone_base */
+    double reach;           /**< Largest distance from the anchor of a dropped point */
+    size_t points_in;       /**< Number of points received */
+    size_t points_out;      /**< Number of points written */
+    size_t subpaths;        /**< Number of subpaths started */
+} PolylineSimplifier;
+
+/**
+ * @brief Prepares a simplifier writing to the given writer.
+ *
+ * @param[out] simplifier The simplifier to initialize.
+ * @param[in] writer The writer receiving the simplified path.
+ * @param[in] tolerance Largest distance in device units a dropped point may have
+ *            from the drawn line; 0 only drops duplicates.
+ */
+void polyline_init(PolylineSimplifier *simplifier, PsWriter *writer, double tolerance);
+
+/**
+ * @brief Ends the current subpath and starts a new one at a point.
+ *
+ * @param[in,out] simplifier The simplifier.
+ * @param[in] x The x coordinate in device units.
+ * @param[in] y The y coordinate in device units.
+ */
+void polyline_moveto(PolylineSimplifier *simplifier, double x, double y);
+
+/**
+ * @brief Extends the current subpath to a point.
+ *
+ * @param[in,out] simplifier The simplifier.
+ * @param[in] x The x coordinate in device units.
+ * @param[in] y The y coordinate in device units.
+ */
+void polyline_lineto(PolylineSimplifier *simplifier, double x, double y);
+
+/**
+ * @brief Writes the pending end of the current subpath.
+ *
+ * @param[in,out] simplifier The simplifier.
+ */
+void polyline_finish(PolylineSimplifier *simplifier);
+
+#endif /* POLYLINE_H */
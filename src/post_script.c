@@ -2,66 +2,251 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "post_script.h"
 #include "parser.h"
+#include "bytecode.h"
+#include "simplify.h"
+#include "dag.h"
+#include "sampler.h"
+#include "ps_writer.h"
+#include "polyline.h"
 #include "utils.h"
+#include "jit.h"
+#include "point_ring.h"
+#include "raster.h"
 
 #define PI 3.14159265358979323846
 #define EPSILON 0.001
-#define Y_THRESHOLD 10.0  /* Threshold to skip large y-values for asymptotes */
+#define Y_THRESHOLD 10.0  /* Jump in points across the finest sampling step treated as an asymptote */
+#ifndef INFINITY
 #define INFINITY HUGE_VALF
+#endif
+#define DEFAULT_MIN -10    /* Lower bound of ranges that are not provided */
+#define DEFAULT_MAX 10     /* Upper bound of ranges that are not provided */
+#define CULL_MARGIN 1e-6   /* Fraction of the y range a culled block must lie beyond the window */
+
+/* Point of the graph in device space, with the index of its sample */
+typedef struct {
+    double x;
+    double y;
+    size_t index;
+} PlotPoint;
+
+/* Unbroken run of points within one device column */
+typedef struct {
+    int column;         /* Device column of the run, -1 if there is no run */
+    PlotPoint first;
+    PlotPoint low;
+    PlotPoint high;
+    PlotPoint last;
+} ColumnRun;
+
+/* Destination of the plotted points: the ring to the writer thread, or the simplifier directly */
+typedef struct {
+    PointRing *ring;
+    PolylineSimplifier *path;
+} PlotOutput;
 
 /* 
- * Generates the PostScript file by parsing the expression and plotting the graph.
+ * Fills render options with their default values.
  */
-void generate_postscript(const char *outfile, const char *func, double x_min, double x_max, double y_min, double y_max, int calc_x_range, int calc_y_range) {
-    FILE *ps_file = initialize_postscript(outfile);
-    Node* expression_tree = parse_expression(&func);
-    double step = 0.001;
+void init_render_options(RenderOptions *options) {
+    options->oversampling = DEFAULT_OVERSAMPLING;
+    options->adaptive = 0;
+    options->tolerance = DEFAULT_TOLERANCE;
+    options->threads = 1;
+    options->simplify = 0.0;
+    options->jit = 0;
+    options->derivative = 0;
+    options->stats_path = NULL;
+    options->format = FORMAT_PS;
+    options->raster_size = DEFAULT_RASTER_SIZE;
+}
 
-    /* Calculate ranges if necessary */
-    calculate_ranges(expression_tree, &x_min, &x_max, &y_min, &y_max, step, calc_x_range, calc_y_range);
+/*
+ * Samples the program adaptively: one sample per device column first, which
+ * also fixes the y scale when the y range comes from the samples, then
+ * refinement where the curve bends or breaks.
+ */
+static SampleBuffer* sample_adaptive(const Program *program, double x_min, double x_max, double y_min, double y_max,
+                                     int calc_y_range, const RenderOptions *options, size_t *evaluations) {
+    SampleBuffer *coarse = sample_program(program, x_min, x_max, PLOT_SIZE + 1, options->threads);
+    SampleBuffer *refined;
+    AdaptiveParams params;
+    double unused_min = x_min, unused_max = x_max;
 
-    /* Draw grid, axes, and the graph */
-    draw_grid(ps_file);
-    plot_graph(ps_file, expression_tree, x_min, x_max, y_min, y_max, step);
-    draw_axes_and_labels(ps_file, x_min, x_max, y_min, y_max);
+    if (coarse == NULL) return NULL;
 
-    /* Cleanup */
+    /* Without a user range the window is fixed, otherwise it grows with the samples */
+    calculate_ranges(coarse, &unused_min, &unused_max, &y_min, &y_max, 0, calc_y_range);
+    params.x_scale = PLOT_SIZE / (x_max - x_min);
+    params.y_scale = y_max > y_min ? PLOT_SIZE / (y_max - y_min) : 0.0;
+    params.y_min = calc_y_range ? y_min : -INFINITY;
+    params.y_max = calc_y_range ? y_max : INFINITY;
+    params.tolerance = options->tolerance;
+    params.min_step = 1.0 / options->oversampling;
+    params.break_jump = Y_THRESHOLD;
+    params.threads = options->threads;
+
+    refined = refine_samples(program, coarse, &params, evaluations);
+    *evaluations += coarse->count;
+    free_samples(coarse);
+    return refined;
+}
+
+/* 
+ * Simplifies and compiles a parsed expression for sampling over [x_min, x_max].
+ */
+Program* compile_expression(const ExprTree *tree, double x_min, double x_max) {
+    ExprTree* expression_tree = simplify_tree(tree, x_min, x_max);
+    Program* program = NULL;
+
+    if (expression_tree && share_subexpressions(expression_tree)) program = compile_tree(expression_tree);
     free_tree(expression_tree);
-    fclose(ps_file);
+    return program;
+}
+
+/*
+ * Compiles an expression and sets it up for the evaluation the options ask for.
+ */
+Program* compile_for_render(const ExprTree *tree, double x_min, double x_max, const RenderOptions *options) {
+    Program *program = compile_expression(tree, x_min, x_max);
+    if (program == NULL) return NULL;
+    program->derivative = options->derivative;
+    if (options->jit) jit_compile_program(program);
+    return program;
 }
 
 /* 
- * Opens and initializes the PostScript file for writing.
+ * Samples a compiled expression and draws the whole page after the prolog.
+ */
+int render_postscript(PsWriter *writer, const Program *program, double x_min, double x_max, double y_min, double y_max, int calc_x_range, int calc_y_range, const RenderOptions *options, RenderStats *stats) {
+    PolylineSimplifier path;
+    SampleBuffer* samples = NULL;
+    size_t sample_count = (size_t)PLOT_SIZE * (size_t)options->oversampling + 1;
+
+    if (calc_x_range) {
+        x_min = DEFAULT_MIN;
+        x_max = DEFAULT_MAX;
+    }
+
+    /* Sample once; the range computation and the plot share the samples */
+    double start = monotonic_seconds();
+    size_t evaluations = sample_count;
+    size_t culled = 0;
+    if (options->adaptive) {
+        evaluations = 0;
+        samples = sample_adaptive(program, x_min, x_max, y_min, y_max, calc_y_range, options, &evaluations);
+    } else {
+        /* Only a fixed window lets blocks outside it go unevaluated; NaN blocks are skipped either way */
+        double margin = (DEFAULT_MAX - DEFAULT_MIN) * CULL_MARGIN;
+        double window_min = calc_y_range ? DEFAULT_MIN - margin : -INFINITY;
+        double window_max = calc_y_range ? DEFAULT_MAX + margin : INFINITY;
+        samples = sample_visible(program, x_min, x_max, sample_count, window_min, window_max,
+                                 options->threads, &evaluations, &culled);
+    }
+    if (samples == NULL) return 1;
+    double sampled = monotonic_seconds();
+
+    /* Calculate ranges if necessary */
+    calculate_ranges(samples, &x_min, &x_max, &y_min, &y_max, calc_x_range, calc_y_range);
+    double ranged = monotonic_seconds();
+
+    /* Draw grid, axes, and the graph */
+    draw_grid(writer);
+    polyline_init(&path, writer, options->simplify);
+    plot_graph(&path, samples, x_min, x_max, y_min, y_max, stats);
+    draw_axes_and_labels(writer, x_min, x_max, y_min, y_max, options->derivative ? "f'(x)" : "f(x)");
+
+    if (stats) {
+        stats->evaluations = evaluations;
+        stats->fixed_samples = sample_count;
+        stats->points_in = path.points_in;
+        stats->points_out = path.points_out;
+        stats->subpaths = path.subpaths;
+        stats->sample_seconds = sampled - start;
+        stats->range_seconds = ranged - sampled;
+        stats->plot_seconds = monotonic_seconds() - ranged;
+        stats->samples = samples->count;
+        stats->nan_samples = 0;
+        stats->clipped_samples = 0;
+        stats->culled_samples = culled;
+        for (size_t i = 0; i < samples->count; i++) {
+            double y = samples->ys[i];
+            if (is_nan(y)) stats->nan_samples++;
+            else if (y < y_min || y > y_max) stats->clipped_samples++;
+        }
+        /* Culled samples are stored as NaN but were never found undefined */
+        stats->nan_samples -= culled;
+    }
+
+    free_samples(samples);
+    return 0;
+}
+
+/* Passes encoded image data on through the writer's own buffer and sink */
+static int writer_sink(void *context, const char *data, size_t length) {
+    PsWriter *writer = (PsWriter*)context;
+    ps_write(writer, data, length);
+    return !writer->failed;
+}
+
+/*
+ * Draws the page into a raster attached to the writer, then detaches it and
+ * writes the encoded image, or writes the prolog and the page as PostScript.
  */
-FILE* initialize_postscript(const char *outfile) {
-    FILE *ps_file = fopen(outfile, "w");
-    if (ps_file == NULL) {
-        fprintf(stderr, "Error opening file for writing: %s\n", outfile);
-        exit(1);
+int render_document(PsWriter *writer, const Program *program, double x_min, double x_max, double y_min, double y_max,
+                    int calc_x_range, int calc_y_range, const RenderOptions *options, RenderStats *stats) {
+    if (options->format == FORMAT_PS) {
+        write_prolog(writer);
+        return render_postscript(writer, program, x_min, x_max, y_min, y_max, calc_x_range, calc_y_range, options, stats);
+    }
+
+    Raster *raster = create_raster(options->raster_size);
+    if (raster == NULL) return 1;
+    writer->raster = raster;
+    int status = render_postscript(writer, program, x_min, x_max, y_min, y_max, calc_x_range, calc_y_range, options, stats);
+    writer->raster = NULL;
+
+    if (status == 0) {
+        int encoded = options->format == FORMAT_PGM ? write_raster_pgm(raster, writer_sink, writer)
+                                                    : write_raster_png(raster, writer_sink, writer);
+        /* A failing sink is reported by ps_flush(); anything else is memory */
+        if (!encoded && !writer->failed) status = 1;
     }
-    fprintf(ps_file, "%%!PS-Adobe-2.0\n");
-    fprintf(ps_file, "%%%%BoundingBox: 0 0 500 500\n");
-    return ps_file;
+    free_raster(raster);
+    return status;
+}
+
+/* 
+ * Writes the PostScript header and the prolog defining the short path operators.
+ */
+void write_prolog(PsWriter *writer) {
+    ps_puts(writer, "%!PS-Adobe-2.0\n");
+    ps_puts(writer, "%%BoundingBox: 0 0 500 500\n");
+    ps_puts(writer, "/m {moveto} bind def\n");
+    ps_puts(writer, "/r {rlineto} bind def\n");
+    ps_puts(writer, "/s {stroke} bind def\n");
+    ps_puts(writer, "/n {newpath} bind def\n");
 }
 
 /* 
  * Calculates the x and y ranges for the graph if not provided by the user.
  */
-void calculate_ranges(Node *expression_tree, double *x_min, double *x_max, double *y_min, double *y_max, double step, int calc_x_range, int calc_y_range) {
+void calculate_ranges(const SampleBuffer *samples, double *x_min, double *x_max, double *y_min, double *y_max, int calc_x_range, int calc_y_range) {
     if (calc_x_range) {
-        *x_min = -10;
-        *x_max = 10;
+        *x_min = DEFAULT_MIN;
+        *x_max = DEFAULT_MAX;
     }
     if (calc_y_range) {
-        *y_min = -10;
-        *y_max = 10;
+        *y_min = DEFAULT_MIN;
+        *y_max = DEFAULT_MAX;
     } else {
         *y_min = INFINITY;
         *y_max = -INFINITY;
-        for (double x = *x_min; x <= *x_max; x += step) {
-            double y = evaluate(expression_tree, x);
+        for (size_t i = 0; i < samples->count; i++) {
+            double y = samples->ys[i];
             if (!is_nan(y)) {
                 if (y < *y_min) *y_min = y;
                 if (y > *y_max) *y_max = y;
@@ -73,85 +258,176 @@ void calculate_ranges(Node *expression_tree, double *x_min, double *x_max, doubl
 /* 
  * Draws a light gray grid on the PostScript canvas.
  */
-void draw_grid(FILE *ps_file) {
-    fprintf(ps_file, "newpath\n");
-    fprintf(ps_file, "0.8 0.8 0.8 setrgbcolor\n");  /* Light gray grid lines */
+void draw_grid(PsWriter *writer) {
+    ps_puts(writer, "n\n");
+    ps_setrgbcolor(writer, 0.8, 0.8, 0.8);  /* Light gray grid lines */
     for (int i = 100; i <= 400; i += 30) {
         /* Vertical grid lines */
-        fprintf(ps_file, "%d 100 moveto\n", i);
-        fprintf(ps_file, "%d 400 lineto\n", i);
-        fprintf(ps_file, "stroke\n");
+        ps_moveto(writer, i, 100);
+        ps_lineto(writer, i, 400);
+        ps_puts(writer, "s\n");
 
         /* Horizontal grid lines */
-        fprintf(ps_file, "100 %d moveto\n", i);
-        fprintf(ps_file, "400 %d lineto\n", i);
-        fprintf(ps_file, "stroke\n");
+        ps_moveto(writer, 100, i);
+        ps_lineto(writer, 400, i);
+        ps_puts(writer, "s\n");
     }
 }
 
 /* 
- * Plots the graph of the mathematical function.
+ * Writes the points kept for a column run in sample order: the first point,
+ * the lowest and highest points, and the last point, skipping repeats.
  */
-void plot_graph(FILE *ps_file, Node *expression_tree, double x_min, double x_max, double y_min, double y_max, double step) {
-    fprintf(ps_file, "newpath\n");
-    fprintf(ps_file, "1 0 0 setrgbcolor\n"); /* Red color for the graph */
+static void flush_column_run(PlotOutput *output, ColumnRun *run, int *start_new_line) {
+    PlotPoint points[4];
+    int count = 0;
+
+    if (run->column < 0) return;
+
+    PlotPoint earlier = run->low.index < run->high.index ? run->low : run->high;
+    PlotPoint later = run->low.index < run->high.index ? run->high : run->low;
+    points[count++] = run->first;
+    if (earlier.index != points[count - 1].index) points[count++] = earlier;
+    if (later.index != points[count - 1].index) points[count++] = later;
+    if (run->last.index != points[count - 1].index) points[count++] = run->last;
+
+    for (int i = 0; i < count; i++) {
+        PathPoint point = { points[i].x, points[i].y, *start_new_line };
+        if (output->ring) {
+            point_ring_push(output->ring, &point);
+        } else if (point.move) {
+            polyline_moveto(output->path, point.x, point.y);
+        } else {
+            polyline_lineto(output->path, point.x, point.y);
+        }
+        *start_new_line = 0;
+    }
+    run->column = -1;
+}
+
+/* Writer stage of plot_graph(): feeds the points from the ring to the simplifier */
+static void* plot_writer(void *arg) {
+    PlotOutput *output = (PlotOutput*)arg;
+    PathPoint point;
 
-    double x_scale = 300.0 / (x_max - x_min);
-    double y_scale = 300.0 / (y_max - y_min);
+    while (point_ring_pop(output->ring, &point)) {
+        if (point.move) {
+            polyline_moveto(output->path, point.x, point.y);
+        } else {
+            polyline_lineto(output->path, point.x, point.y);
+        }
+    }
+    return NULL;
+}
+
+/* 
+ * Plots the graph of the mathematical function. This thread maps the samples
+ * to device space and aggregates them by column; a writer thread simplifies
+ * and writes the path.
+ */
+void plot_graph(PolylineSimplifier *path, const SampleBuffer *samples, double x_min, double x_max, double y_min, double y_max,
+                RenderStats *stats) {
+    PointRing ring;
+    PlotOutput output = { NULL, path };
+    pthread_t writer;
+
+    ps_puts(path->writer, "n\n");
+    ps_setrgbcolor(path->writer, 1, 0, 0); /* Red color for the graph */
+
+    if (point_ring_init(&ring, POINT_RING_CAPACITY)) {
+        output.ring = &ring;
+        if (pthread_create(&writer, NULL, plot_writer, &output) != 0) output.ring = NULL;
+    }
+
+    double x_scale = PLOT_SIZE / (x_max - x_min);
+    double y_scale = PLOT_SIZE / (y_max - y_min);
     double x_offset = 250 - (x_max - x_min) * x_scale / 2;
     double y_offset = 250 - (y_max - y_min) * y_scale / 2;
 
+    ColumnRun run;
+    run.column = -1;
     int start_new_line = 1;
-    for (double x = x_min; x <= x_max; x += step) {
-        double y = evaluate(expression_tree, x);
-        if (is_nan(y)) {
+    for (size_t i = 0; i < samples->count; i++) {
+        if (is_nan(samples->ys[i])) {
+            flush_column_run(&output, &run, &start_new_line);
             start_new_line = 1;
             continue;
         }
 
-        double ps_x = x_offset + (x - x_min) * x_scale;
-        double ps_y = y_offset + (y - y_min) * y_scale;
+        PlotPoint point;
+        point.x = x_offset + (samples->xs[i] - x_min) * x_scale;
+        point.y = y_offset + (samples->ys[i] - y_min) * y_scale;
+        point.index = i;
 
-        if (ps_x < 100 || ps_x > 400 || ps_y < 100 || ps_y > 400) {
+        if (point.x < PLOT_MIN || point.x > PLOT_MAX || point.y < PLOT_MIN || point.y > PLOT_MAX) {
+            flush_column_run(&output, &run, &start_new_line);
             start_new_line = 1;
             continue;
         }
 
-        if (start_new_line) {
-            fprintf(ps_file, "%lf %lf moveto\n", ps_x, ps_y);
-            start_new_line = 0;
-        } else {
-            fprintf(ps_file, "%lf %lf lineto\n", ps_x, ps_y);
+        int column = (int)(point.x - PLOT_MIN);
+        if (column != run.column) {
+            flush_column_run(&output, &run, &start_new_line);
+            run.column = column;
+            run.first = run.low = run.high = point;
+        }
+        if (point.y < run.low.y) run.low = point;
+        if (point.y > run.high.y) run.high = point;
+        run.last = point;
+    }
+    flush_column_run(&output, &run, &start_new_line);
+
+    if (stats) {
+        stats->plot_blocked_seconds = 0.0;
+        stats->writer_blocked_seconds = 0.0;
+    }
+    if (output.ring) {
+        point_ring_close(&ring);
+        pthread_join(writer, NULL);
+        if (stats) {
+            stats->plot_blocked_seconds = ring.producer_blocked;
+            stats->writer_blocked_seconds = ring.consumer_blocked;
         }
     }
-    fprintf(ps_file, "stroke\n");
+    point_ring_free(&ring);
+    polyline_finish(path);
+    ps_puts(path->writer, "s\n");
 }
 
 /* 
  * Draws the bounding box, axes, and labels on the PostScript canvas.
  */
-void draw_axes_and_labels(FILE *ps_file, double x_min, double x_max, double y_min, double y_max) {
+void draw_axes_and_labels(PsWriter *writer, double x_min, double x_max, double y_min, double y_max, const char *y_label) {
     double x_range = x_max - x_min;
     double y_range = y_max - y_min;
 
-    fprintf(ps_file, "newpath\n");
-    fprintf(ps_file, "0 0 0 setrgbcolor\n");
+    ps_puts(writer, "n\n");
+    ps_setrgbcolor(writer, 0, 0, 0);
 
     /* Bounding box */
-    fprintf(ps_file, "100 100 moveto\n400 100 lineto\n400 400 lineto\n100 400 lineto\n100 100 lineto\nstroke\n");
+    ps_moveto(writer, 100, 100);
+    ps_lineto(writer, 400, 100);
+    ps_lineto(writer, 400, 400);
+    ps_lineto(writer, 100, 400);
+    ps_lineto(writer, 100, 100);
+    ps_puts(writer, "s\n");
 
     /* X and Y axis labels */
-    fprintf(ps_file, "/Courier findfont 9 scalefont setfont\n");
-    fprintf(ps_file, "250 60 moveto (x) show\n");
-    fprintf(ps_file, "30 250 moveto\n90 rotate\n(f(x)) show\n-90 rotate\n");
+    ps_puts(writer, "/Courier findfont 9 scalefont setfont\n");
+    ps_puts(writer, "250 60 m (x) show\n");
+    ps_printf(writer, "30 250 m\n90 rotate\n(%s) show\n-90 rotate\n", y_label);
 
     for (int i = 100; i <= 400; i += 30) {
         /* X-axis ticks and labels */
-        fprintf(ps_file, "%d 90 moveto %d 110 lineto stroke\n", i, i);
-        fprintf(ps_file, "%d 80 moveto (%0.1f) show\n", i - 10, x_min + (i - 100) * x_range / 300.0);
+        ps_moveto(writer, i, 90);
+        ps_lineto(writer, i, 110);
+        ps_puts(writer, "s\n");
+        ps_printf(writer, "%d 80 m (%0.1f) show\n", i - 10, x_min + (i - 100) * x_range / 300.0);
 
         /* Y-axis ticks and labels */
-        fprintf(ps_file, "90 %d moveto 110 %d lineto stroke\n", i, i);
-        fprintf(ps_file, "50 %d moveto (%0.1f) show\n", i - 5, y_min + (i - 100) * y_range / 300.0);
+        ps_moveto(writer, 90, i);
+        ps_lineto(writer, 110, i);
+        ps_puts(writer, "s\n");
+        ps_printf(writer, "50 %d m (%0.1f) show\n", i - 5, y_min + (i - 100) * y_range / 300.0);
     }
 }
@@ -2,75 +2,258 @@
 #define POST_SCRIPT_H
 
 #include "parser.h"
+#include "sampler.h"
+#include "ps_writer.h"
+#include "polyline.h"
+#include "bytecode.h"
+
+/** 
+ * @brief Lower edge of the plot box on both axes, in PostScript points.
+ */
+#define PLOT_MIN 100
+
+/** 
+ * @brief Upper edge of the plot box on both axes, in PostScript points.
+ */
+#define PLOT_MAX 400
+
+/** 
+ * @brief Width and height of the plot box, one device column per point.
+ */
+#define PLOT_SIZE (PLOT_MAX - PLOT_MIN)
+
+/** 
+ * @brief Default number of samples evaluated per device column.
+ */
+#define DEFAULT_OVERSAMPLING 64
+
+/** 
+ * @brief Default deviation from a straight segment allowed by adaptive sampling, in device units.
+ */
+#define DEFAULT_TOLERANCE 0.25
+
+/** 
+ * @brief Largest accepted number of samples per device column.
+ */
+#define MAX_OVERSAMPLING 4096
+
+/** 
+ * @brief Smallest accepted adaptive sampling tolerance, in device units.
+ */
+#define MIN_TOLERANCE 1e-3
+
+/** 
+ * @brief Largest accepted adaptive sampling tolerance, in device units.
+ */
+#define MAX_TOLERANCE 100.0
+
+/** 
+ * @brief Largest accepted path simplification distance, in device units.
+ */
+#define MAX_SIMPLIFY 10.0
+
+/** 
+ * @brief Default width and height of raster output, in pixels; one pixel per point.
+ */
+#define DEFAULT_RASTER_SIZE 500
+
+/** 
+ * @brief Smallest accepted raster width and height, in pixels.
+ */
+#define MIN_RASTER_SIZE 16
+
+/** 
+ * @brief Largest accepted raster width and height, in pixels.
+ */
+#define MAX_RASTER_SIZE 8192
+
+/** 
+ * @brief Kind of file a page is written as.
+ */
+typedef enum {
+    FORMAT_PS,      /**< PostScript */
+    FORMAT_PGM,     /**< Binary PGM image */
+    FORMAT_PNG      /**< Grayscale PNG image */
+} OutputFormat;
+
+/** 
+ * @brief Options controlling how a graph is rendered.
+ */
+typedef struct {
+    int oversampling;   /**< Samples evaluated per device column of the plot box */
+    int adaptive;       /**< Refine samples by curvature instead of sampling at a fixed step */
+    double tolerance;   /**< Deviation from a straight segment allowed by adaptive sampling */
+    int threads;        /**< Number of threads evaluating samples */
+    double simplify;    /**< Distance within which the path is straightened, 0 only drops duplicates */
+    int jit;            /**< Evaluate with native code where supported (see jit_compile_program()) */
+    int derivative;     /**< Plot the derivative of the function instead of the function */
+    const char *stats_path; /**< Where the command line reports render statistics: NULL for nowhere, "-" for stderr, otherwise a file appended to */
+    OutputFormat format;    /**< Kind of file written by render_document() */
+    int raster_size;        /**< Width and height of PGM and PNG output in pixels */
+} RenderOptions;
+
+/** 
+ * @brief Figures describing how a page was rendered, for reporting by the caller.
+ */
+typedef struct {
+    size_t evaluations;     /**< Samples evaluated, excluding those culled by interval bounds */
+    size_t fixed_samples;   /**< Samples a fixed step at the oversampling rate would evaluate */
+    size_t points_in;       /**< Points passed to the path simplifier */
+    size_t points_out;      /**< Points written after simplification */
+    size_t subpaths;        /**< Subpaths of the plotted path; each other point written ends a segment */
+    size_t samples;         /**< Samples of the plotted buffer */
+    size_t nan_samples;     /**< Samples that are undefined, including those proved so by interval bounds */
+    size_t clipped_samples; /**< Defined samples outside the y range of the page */
+    size_t culled_samples;  /**< Samples left unevaluated for lying outside the y range; not counted as NaN or clipped */
+    double sample_seconds;  /**< Time spent evaluating samples */
+    double range_seconds;   /**< Time spent in calculate_ranges() */
+    double plot_seconds;    /**< Time spent drawing grid, graph, axes and labels */
+    double plot_blocked_seconds;    /**< Time plot_graph() waited for room in the ring to its writer thread */
+    double writer_blocked_seconds;  /**< Time the writer thread waited for points from plot_graph() */
+} RenderStats;
 
 /**
- * @brief Generates a PostScript file for visualizing a mathematical function.
+ * @brief Fills render options with their default values.
  * 
- * This function handles the entire process of initializing the PostScript file, 
- * calculating ranges, drawing grid lines, plotting the function, and adding axes.
+ * @param[out] options The options to initialize.
+ */
+void init_render_options(RenderOptions *options);
+
+/**
+ * @brief Simplifies and compiles a parsed expression.
  * 
- * @param[in] outfile The name of the output PostScript file.
- * @param[in] func The mathematical function as a string.
+ * The simplifier relies on the x range, so the program is only valid for
+ * sampling within [x_min, x_max].
+ * 
+ * @param[in] tree The parsed expression; it is not modified.
+ * @param[in] x_min The smallest 'x' the program will be evaluated at.
+ * @param[in] x_max The largest 'x' the program will be evaluated at.
+ * @return Program* Returns the compiled program, or NULL if memory allocation failed.
+ */
+Program* compile_expression(const ExprTree *tree, double x_min, double x_max);
+
+/**
+ * @brief Compiles an expression the way the render options ask for.
+ *
+ * Calls compile_expression(), makes the program evaluate the derivative
+ * when options->derivative is set, and attaches native code when
+ * options->jit is set.
+ *
+ * @param[in] tree The parsed expression; it is not modified.
+ * @param[in] x_min The smallest 'x' the program will be evaluated at.
+ * @param[in] x_max The largest 'x' the program will be evaluated at.
+ * @param[in] options The render options.
+ * @return Program* Returns the compiled program, or NULL if memory allocation failed.
+ */
+Program* compile_for_render(const ExprTree *tree, double x_min, double x_max, const RenderOptions *options);
+
+/**
+ * @brief Samples a compiled expression and draws the page to a writer.
+ * 
+ * Everything after the prolog is written: grid, graph, axes and labels. The
+ * caller attaches the writer to its output and writes the prolog first.
+ * Nothing is printed; the caller reports failures and statistics.
+ * 
+ * @param[in,out] writer The writer receiving the page.
+ * @param[in] program The expression compiled for the x range.
+ * @param[in] x_min The minimum x-coordinate of the range.
+ * @param[in] x_max The maximum x-coordinate of the range.
+ * @param[in] y_min The minimum y-coordinate of the range.
+ * @param[in] y_max The maximum y-coordinate of the range.
+ * @param[in] calc_x_range Flag to calculate x range automatically if set to 1.
+ * @param[in] calc_y_range Flag to calculate y range automatically if set to 1.
+ * @param[in] options Rendering options.
+ * @param[out] stats Receives the sampling and simplification figures, may be NULL.
+ * @return int Returns 0 on success, 1 if memory allocation failed.
+ */
+int render_postscript(PsWriter *writer, const Program *program, double x_min, double x_max, double y_min, double y_max, int calc_x_range, int calc_y_range, const RenderOptions *options, RenderStats *stats);
+
+/**
+ * @brief Samples a compiled expression and writes the whole file in the format the options ask for.
+ *
+ * For PostScript this is write_prolog() followed by render_postscript().
+ * For PGM and PNG the same drawing calls are rasterized into a bitmap of
+ * options->raster_size pixels (see Raster), leaving out the text labels,
+ * and the encoded image is written instead; its size does not depend on
+ * the number of samples or path points.
+ *
+ * @param[in,out] writer The writer attached to the output, with nothing written yet.
+ * @param[in] program The expression compiled for the x range.
  * @param[in] x_min The minimum x-coordinate of the range.
  * @param[in] x_max The maximum x-coordinate of the range.
  * @param[in] y_min The minimum y-coordinate of the range.
  * @param[in] y_max The maximum y-coordinate of the range.
  * @param[in] calc_x_range Flag to calculate x range automatically if set to 1.
  * @param[in] calc_y_range Flag to calculate y range automatically if set to 1.
+ * @param[in] options Rendering options.
+ * @param[out] stats Receives the sampling and simplification figures, may be NULL.
+ * @return int Returns 0 on success, 1 if memory allocation failed.
  */
-void generate_postscript(const char *outfile, const char *func, double x_min, double x_max, double y_min, double y_max, int calc_x_range, int calc_y_range);
+int render_document(PsWriter *writer, const Program *program, double x_min, double x_max, double y_min, double y_max,
+                    int calc_x_range, int calc_y_range, const RenderOptions *options, RenderStats *stats);
 
 /**
- * @brief Initializes and opens a PostScript file for writing.
+ * @brief Writes the PostScript header and the prolog.
  * 
- * This function opens a file in write mode and writes the required PostScript headers.
+ * The prolog defines the short operators used by the drawing functions:
+ * m (moveto), r (rlineto), s (stroke) and n (newpath).
  * 
- * @param[in] outfile The name of the output PostScript file.
- * @return FILE* Pointer to the opened file. Exits the program on failure.
+ * @param[in,out] writer The writer receiving the prolog.
  */
-FILE* initialize_postscript(const char *outfile);
+void write_prolog(PsWriter *writer);
 
 /**
  * @brief Calculates the x and y ranges for the graph if not provided by the user.
  * 
- * If the ranges are to be calculated, this function evaluates the expression over a step size
- * and determines the minimum and maximum y-values for the given x range.
+ * If the ranges are to be calculated, this function scans the samples of the
+ * expression and determines the minimum and maximum y-values for the x range.
  * 
- * @param[in] expression_tree Pointer to the root of the parsed expression tree.
+ * @param[in] samples The samples of the expression over the x range.
  * @param[in,out] x_min Pointer to the minimum x-coordinate.
  * @param[in,out] x_max Pointer to the maximum x-coordinate.
  * @param[in,out] y_min Pointer to the minimum y-coordinate.
  * @param[in,out] y_max Pointer to the maximum y-coordinate.
- * @param[in] step The step size used to sample points for range calculation.
  * @param[in] calc_x_range Flag to calculate x range automatically if set to 1.
  * @param[in] calc_y_range Flag to calculate y range automatically if set to 1.
  */
-void calculate_ranges(Node *expression_tree, double *x_min, double *x_max, double *y_min, double *y_max, double step, int calc_x_range, int calc_y_range);
+void calculate_ranges(const SampleBuffer *samples, double *x_min, double *x_max, double *y_min, double *y_max, int calc_x_range, int calc_y_range);
 
 /**
  * @brief Draws light gray grid lines on the PostScript canvas.
  * 
  * This function draws vertical and horizontal grid lines on a predefined bounding box.
  * 
- * @param[in,out] ps_file Pointer to the PostScript file being written.
+ * @param[in,out] writer The writer of the PostScript file.
  */
-void draw_grid(FILE *ps_file);
+void draw_grid(PsWriter *writer);
 
 /**
  * @brief Plots the mathematical function on the PostScript canvas.
  * 
- * This function evaluates the mathematical function at evenly spaced points and 
- * connects these points with lines to form the graph.
+ * This function connects the samples of the mathematical function with lines
+ * to form the graph. Within each device column only the first, lowest,
+ * highest and last point of every unbroken run of samples is drawn (M4
+ * aggregation), which renders the same as drawing every sample while keeping
+ * the output size bounded by the plot width. The points then pass through
+ * the simplifier, which drops duplicates and, with a tolerance, points the
+ * path can be straightened across.
+ *
+ * The simplifier and the writer run on a thread of their own, fed through a
+ * PointRing, so mapping samples to device space overlaps with formatting
+ * and writing the output. If the thread cannot be started everything runs
+ * on the caller's thread. The writer is only used by that thread until
+ * plot_graph() returns.
  * 
- * @param[in,out] ps_file Pointer to the PostScript file being written.
- * @param[in] expression_tree Pointer to the root of the parsed expression tree.
+ * @param[in,out] path The simplifier writing the path to the PostScript file.
+ * @param[in] samples The samples of the expression over the x range.
  * @param[in] x_min The minimum x-coordinate of the range.
  * @param[in] x_max The maximum x-coordinate of the range.
  * @param[in] y_min The minimum y-coordinate of the range.
  * @param[in] y_max The maximum y-coordinate of the range.
- * @param[in] step The step size for sampling x values.
+ * @param[out] stats Receives the time each side waited on the other, may be NULL.
  */
-void plot_graph(FILE *ps_file, Node *expression_tree, double x_min, double x_max, double y_min, double y_max, double step);
+void plot_graph(PolylineSimplifier *path, const SampleBuffer *samples, double x_min, double x_max, double y_min, double y_max,
+                RenderStats *stats);
 
 /**
  * @brief Draws axes, bounding box, and axis labels on the PostScript canvas.
@@ -78,12 +261,13 @@ void plot_graph(FILE *ps_file, Node *expression_tree, double x_min, double x_max
  * This function includes ticks and labels for both the x-axis and y-axis based
  * on the calculated or provided ranges.
  * 
- * @param[in,out] ps_file Pointer to the PostScript file being written.
+ * @param[in,out] writer The writer of the PostScript file.
  * @param[in] x_min The minimum x-coordinate of the range.
  * @param[in] x_max The maximum x-coordinate of the range.
  * @param[in] y_min The minimum y-coordinate of the range.
  * @param[in] y_max The maximum y-coordinate of the range.
+ * @param[in] y_label The label of the y-axis, e.g. "f(x)".
  */
-void draw_axes_and_labels(FILE *ps_file, double x_min, double x_max, double y_min, double y_max);
+void draw_axes_and_labels(PsWriter *writer, double x_min, double x_max, double y_min, double y_max, const char *y_label);
 
 #endif /* POST_SCRIPT_H */
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "utils.h"
+
+#define CALIBRATION_ROUNDS 1000     /* Back-to-back counter readings taken to measure their cost */
+#define LABEL_SIZE 32               /* Longest node label, terminator included */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define COST_UNIT "cycles"
+
+/* Time stamp counter of the processor */
+static uint64_t read_counter(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+#else
+#define COST_UNIT "ns"
+
+static uint64_t read_counter(void) {
+    return (uint64_t)(monotonic_seconds() * 1e9);
+}
+#endif
+
+/* Lowest cost of two readings with nothing in between */
+static uint64_t counter_overhead(void) {
+    uint64_t lowest = UINT64_MAX;
+    for (int i = 0; i < CALIBRATION_ROUNDS; i++) {
+        uint64_t start = read_counter();
+        uint64_t cost = read_counter() - start;
+        if (cost < lowest) lowest = cost;
+    }
+    return lowest;
+}
+
+/*
+ * Lists the reachable nodes once, in index order, so every evaluation can
+ * sweep them without recursion.
+ */
+TreeProfile* create_profile(const ExprTree *tree) {
+    TreeProfile *profile = (TreeProfile*)calloc(1, sizeof(TreeProfile));
+    unsigned char *live = tree->count ? mark_live_nodes(tree) : NULL;
+    size_t count = tree->count ? tree->count : 1;
+
+    if (profile == NULL || (tree->count && live == NULL)) {
+        free(profile);
+        free(live);
+        return NULL;
+    }
+    profile->tree = tree;
+    profile->nodes = (NodeProfile*)calloc(count, sizeof(NodeProfile));
+    profile->order = (NodeId*)malloc(count * sizeof(NodeId));
+    profile->values = (double*)malloc(count * sizeof(double));
+    if (profile->nodes == NULL || profile->order == NULL || profile->values == NULL) {
+        free(live);
+        free_profile(profile);
+        return NULL;
+    }
+    for (NodeId i = 0; i < tree->count; i++) {
+        if (live[i]) profile->order[profile->order_count++] = i;
+    }
+    free(live);
+
+    profile->overhead = counter_overhead();
+    profile->unit = COST_UNIT;
+    return profile;
+}
+
+/* Value of a child, NaN where evaluate() would find none */
+static double child_value(const TreeProfile *profile, NodeId child) {
+    return child == NO_NODE ? create_nan() : profile->values[child];
+}
+
+/*
+ * Sweeps the nodes children first, reading the counter around each one.
+ */
+double evaluate_profiled(TreeProfile *profile, double x) {
+    const ExprTree *tree = profile->tree;
+    if (tree->root == NO_NODE) return create_nan();
+
+    for (uint32_t k = 0; k < profile->order_count; k++) {
+        NodeId id = profile->order[k];
+        const Node *node = &tree->nodes[id];
+        double value;
+
+        uint64_t start = read_counter();
+        switch (node->type) {
+            case CONST:
+                value = node->data.value;
+                break;
+            case VAR:
+                value = x;
+                break;
+            case OPERATOR:
+                value = apply_operator((char)node->op, child_value(profile, node->data.child.left),
+                                       child_value(profile, node->data.child.right));
+                break;
+            case FUNCTION:
+                value = apply_function((FunctionId)node->op, child_value(profile, node->data.child.left));
+                break;
+            default:
+                value = create_nan();
+                break;
+        }
+        uint64_t cost = read_counter() - start;
+
+        NodeProfile *figures = &profile->nodes[id];
+        figures->calls++;
+        figures->cost += cost > profile->overhead ? cost - profile->overhead : 0;
+        if (is_nan(value)) figures->nans++;
+        profile->values[id] = value;
+    }
+    profile->samples++;
+    return profile->values[tree->root];
+}
+
+/* Short name of a node: its operator, function, variable or constant */
+static void node_label(const Node *node, char *label) {
+    switch (node->type) {
+        case CONST:
+            snprintf(label, LABEL_SIZE, "%g", node->data.value);
+            break;
+        case VAR:
+            snprintf(label, LABEL_SIZE, "x");
+            break;
+        case OPERATOR:
+            snprintf(label, LABEL_SIZE, "%c", node->op);
+            break;
+        default:
+            snprintf(label, LABEL_SIZE, "%s", function_name((FunctionId)node->op));
+            break;
+    }
+}
+
+/* Node waiting to be visited by a depth-first walk */
+typedef struct {
+    NodeId id;
+    uint32_t depth;
+} WalkEntry;
+
+/*
+ * Calls 'visit' for every node reachable from the root in depth-first
+ * order, left child first, with an explicit stack so deep trees are fine.
+ * Returns 0 if memory allocation failed.
+ */
+static int walk_tree(const ExprTree *tree, void (*visit)(NodeId id, uint32_t depth, void *context), void *context) {
+    if (tree->root == NO_NODE) return 1;
+
+    /* A tree has fewer pending nodes than nodes; a DAG may revisit shared ones */
+    size_t capacity = tree->count + 1, count = 0;
+    WalkEntry *stack = (WalkEntry*)malloc(capacity * sizeof(WalkEntry));
+    if (stack == NULL) return 0;
+
+    stack[count].id = tree->root;
+    stack[count++].depth = 0;
+    while (count > 0) {
+        WalkEntry entry = stack[--count];
+        const Node *node = &tree->nodes[entry.id];
+        visit(entry.id, entry.depth, context);
+        if (node->type != OPERATOR && node->type != FUNCTION) continue;
+
+        NodeId children[2] = { node->data.child.right, node->data.child.left };
+        for (int c = 0; c < 2; c++) {
+            if (children[c] == NO_NODE) continue;
+            if (count == capacity) {
+                WalkEntry *grown = (WalkEntry*)realloc(stack, capacity * 2 * sizeof(WalkEntry));
+                if (grown == NULL) {
+                    free(stack);
+                    return 0;
+                }
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[count].id = children[c];
+            stack[count++].depth = entry.depth + 1;
+        }
+    }
+    free(stack);
+    return 1;
+}
+
+/* State of write_profile_tree() while walking */
+typedef struct {
+    FILE *out;
+    const TreeProfile *profile;
+    const uint64_t *inclusive;
+    double total;
+} TreePrinter;
+
+static void print_tree_node(NodeId id, uint32_t depth, void *context) {
+    TreePrinter *printer = (TreePrinter*)context;
+    const NodeProfile *figures = &printer->profile->nodes[id];
+    char label[LABEL_SIZE];
+
+    node_label(&printer->profile->tree->nodes[id], label);
+    fprintf(printer->out, "%12llu %12llu %12.1f %7.2f%% %7.2f%%  %*s%s\n",
+            (unsigned long long)figures->calls, (unsigned long long)figures->nans,
+            figures->calls ? (double)figures->cost / figures->calls : 0.0,
+            100.0 * figures->cost / printer->total, 100.0 * printer->inclusive[id] / printer->total,
+            (int)(2 * depth), "", label);
+}
+
+/*
+ * Adds up the cost of every subtree in index order, then prints the nodes
+ * depth first.
+ */
+int write_profile_tree(FILE *out, const TreeProfile *profile) {
+    const ExprTree *tree = profile->tree;
+    uint64_t *inclusive = (uint64_t*)calloc(tree->count ? tree->count : 1, sizeof(uint64_t));
+    uint64_t total = 0;
+
+    if (inclusive == NULL) return 0;
+    for (uint32_t k = 0; k < profile->order_count; k++) {
+        NodeId id = profile->order[k];
+        const Node *node = &tree->nodes[id];
+        inclusive[id] = profile->nodes[id].cost;
+        if (node->type == OPERATOR || node->type == FUNCTION) {
+            if (node->data.child.left != NO_NODE) inclusive[id] += inclusive[node->data.child.left];
+            if (node->data.child.right != NO_NODE) inclusive[id] += inclusive[node->data.child.right];
+        }
+        total += profile->nodes[id].cost;
+    }
+
+    fprintf(out, "# %llu evaluations, %llu %s in %u nodes\n", (unsigned long long)profile->samples,
+            (unsigned long long)total, profile->unit, (unsigned)profile->order_count);
+    fprintf(out, "%12s %12s %12s %8s %8s  %s\n", "calls", "nan", profile->unit, "self", "total", "node");
+
+    TreePrinter printer = { out, profile, inclusive, total > 0 ? (double)total : 1.0 };
+    int ok = walk_tree(tree, print_tree_node, &printer);
+    free(inclusive);
+    return ok;
+}
+
+/* State of write_profile_folded() while walking: the labels on the path to the current node */
+typedef struct {
+    FILE *out;
+    const TreeProfile *profile;
+    char *path;
+    size_t *ends;           /* Length of path up to each depth */
+    size_t capacity;
+    int failed;
+} FoldedPrinter;
+
+static void print_folded_node(NodeId id, uint32_t depth, void *context) {
+    FoldedPrinter *printer = (FoldedPrinter*)context;
+    char label[LABEL_SIZE];
+    size_t start = depth ? printer->ends[depth - 1] : 0;
+
+    if (printer->failed) return;
+    node_label(&printer->profile->tree->nodes[id], label);
+    size_t needed = start + strlen(label) + 2;
+    if (needed > printer->capacity) {
+        size_t capacity = printer->capacity * 2 > needed ? printer->capacity * 2 : needed;
+        char *grown = (char*)realloc(printer->path, capacity);
+        if (grown == NULL) {
+            printer->failed = 1;
+            return;
+        }
+        printer->path = grown;
+        printer->capacity = capacity;
+    }
+    if (depth) printer->path[start++] = ';';
+    strcpy(printer->path + start, label);
+    printer->ends[depth] = start + strlen(label);
+
+    uint64_t cost = printer->profile->nodes[id].cost;
+    if (cost > 0) fprintf(printer->out, "%s %llu\n", printer->path, (unsigned long long)cost);
+}
+
+int write_profile_folded(FILE *out, const TreeProfile *profile) {
+    const ExprTree *tree = profile->tree;
+    FoldedPrinter printer = { out, profile, NULL, NULL, 0, 0 };
+
+    printer.ends = (size_t*)malloc((tree->count ? tree->count : 1) * sizeof(size_t));
+    printer.capacity = 256;
+    printer.path = (char*)malloc(printer.capacity);
+    int ok = printer.ends != NULL && printer.path != NULL && walk_tree(tree, print_folded_node, &printer) &&
+             !printer.failed;
+    free(printer.ends);
+    free(printer.path);
+    return ok;
+}
+
+void free_profile(TreeProfile *profile) {
+    if (profile == NULL) return;
+    free(profile->nodes);
+    free(profile->order);
+    free(profile->values);
+    free(profile);
+}
@@ -0,0 +1,92 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "parser.h"
+
+/**
+ * @brief Figures gathered for one node by the profiling evaluator.
+ */
+typedef struct {
+    uint64_t calls;     /**< Times the node was evaluated */
+    uint64_t nans;      /**< Evaluations that returned NaN */
+    uint64_t cost;      /**< Time spent in the node itself, children excluded, in the profile's unit */
+} NodeProfile;
+
+/**
+ * @brief Per-node profile of an expression tree.
+ *
+ * Time is read with the processor's cycle counter where available and the
+ * monotonic clock otherwise; 'unit' names which. The cost of reading the
+ * counter is measured when the profile is created and subtracted from
+ * every reading.
+ */
+typedef struct {
+    const ExprTree *tree;   /**< The profiled tree, borrowed */
+    NodeProfile *nodes;     /**< One entry per node of the tree */
+    NodeId *order;          /**< Reachable nodes, children before parents */
+    uint32_t order_count;   /**< Number of entries in order */
+    double *values;         /**< Scratch value of every node during one evaluation */
+    uint64_t overhead;      /**< Cost of one counter reading, subtracted from each node */
+    uint64_t samples;       /**< Number of evaluations of the whole tree */
+    const char *unit;       /**< "cycles" or "ns" */
+} TreeProfile;
+
+/**
+ * @brief Creates an empty profile for a tree.
+ *
+ * @param[in] tree The tree to profile; it must outlive the profile and not change.
+ * @return TreeProfile* Returns the profile, or NULL if memory allocation failed.
+ */
+TreeProfile* create_profile(const ExprTree *tree);
+
+/**
+ * @brief Evaluates the tree for a given value of 'x', timing every node.
+ *
+ * Returns exactly what evaluate() returns. Each reachable node is evaluated
+ * once per call, children before parents, and its calls, NaN results and
+ * own cost are added to the profile.
+ *
+ * @param[in,out] profile The profile.
+ * @param[in] x The value of the variable 'x'.
+ * @return double Returns the result of evaluating the expression tree.
+ */
+double evaluate_profiled(TreeProfile *profile, double x);
+
+/**
+ * @brief Prints the tree annotated with the figures of every node.
+ *
+ * Every node gets one line, indented by its depth, with its calls, NaN
+ * results, own cost per call, and its share of the total cost with and
+ * without its children. Nodes shared by several parents are listed under
+ * each of them.
+ *
+ * @param[in] out The stream to print to.
+ * @param[in] profile The profile.
+ * @return int Returns 1 on success, 0 if memory allocation failed; the
+ *         output may then be incomplete. Nothing is printed to stderr.
+ */
+int write_profile_tree(FILE *out, const TreeProfile *profile);
+
+/**
+ * @brief Prints the profile as folded stacks for flame graph tools.
+ *
+ * Every node with a nonzero own cost gives one line: the labels of the
+ * nodes from the root down to it separated by ';', a space, and the cost.
+ *
+ * @param[in] out The stream to print to.
+ * @param[in] profile The profile.
+ * @return int Returns 1 on success, 0 if memory allocation failed; the
+ *         output may then be incomplete. Nothing is printed to stderr.
+ */
+int write_profile_folded(FILE *out, const TreeProfile *profile);
+
+/**
+ * @brief Frees a profile; the tree is not freed.
+ *
+ * @param[in] profile The profile (may be NULL).
+ */
+void free_profile(TreeProfile *profile);
+
+#endif /* PROFILE_H */
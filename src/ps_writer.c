@@ -0,0 +1,167 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ps_writer.h"
+
+#define PS_SCALE 1000.0         /* 10^PS_DECIMALS */
+#define PS_MAX_NUMBER 32        /* Longest formatted number, sign and separator included */
+
+/* Prepare an empty buffer for the sink */
+void ps_init(PsWriter *writer, PsSink sink, void *context) {
+    writer->length = 0;
+    writer->sink = sink;
+    writer->context = context;
+    writer->failed = 0;
+    writer->written = 0;
+    writer->pen_x = 0;
+    writer->pen_y = 0;
+    writer->raster = NULL;
+}
+
+/* Write a block to a stdio stream */
+int ps_file_sink(void *context, const char *data, size_t length) {
+    return fwrite(data, 1, length, (FILE*)context) == length;
+}
+
+/* Append a block to a memory buffer, doubling its size as needed */
+int ps_buffer_sink(void *context, const char *data, size_t length) {
+    PsBuffer *buffer = (PsBuffer*)context;
+    if (buffer->capacity - buffer->length < length) {
+        size_t capacity = buffer->capacity ? buffer->capacity : PS_BUFFER_SIZE;
+        while (capacity - buffer->length < length) capacity *= 2;
+        char *grown = (char*)realloc(buffer->data, capacity);
+        if (grown == NULL) return 0;
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 1;
+}
+
+/* Pass the buffer to the sink and empty it */
+int ps_flush(PsWriter *writer) {
+    if (writer->length > 0 && !writer->failed) {
+        if (writer->sink(writer->context, writer->buffer, writer->length)) {
+            writer->written += writer->length;
+        } else {
+            writer->failed = 1;
+        }
+    }
+    writer->length = 0;
+    return !writer->failed;
+}
+
+/* Copy bytes into the buffer, flushing whenever it fills up */
+void ps_write(PsWriter *writer, const char *data, size_t length) {
+    if (writer->raster) return;
+    while (length > 0) {
+        if (writer->length == PS_BUFFER_SIZE) ps_flush(writer);
+        size_t room = PS_BUFFER_SIZE - writer->length;
+        size_t chunk = length < room ? length : room;
+        memcpy(writer->buffer + writer->length, data, chunk);
+        writer->length += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+/* Append a string without its terminator */
+void ps_puts(PsWriter *writer, const char *text) {
+    ps_write(writer, text, strlen(text));
+}
+
+/* Format into a temporary line, then copy it into the buffer */
+void ps_printf(PsWriter *writer, const char *format, ...) {
+    char line[256];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (length < 0) return;
+    ps_write(writer, line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+}
+
+/*
+ * Rounds a coordinate to the fixed-point grid.
+ */
+static long long to_fixed(double value) {
+    return llround(value * PS_SCALE);
+}
+
+/*
+ * Formats a fixed-point value followed by a space, without trailing zeros:
+ * 1500 becomes "1.5 ", -3 becomes "-0.003 ". Returns the number of bytes written.
+ */
+static size_t format_fixed(char *out, long long value) {
+    char digits[24];
+    size_t length = 0, count = 0;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    unsigned long long integer = magnitude / (unsigned long long)PS_SCALE;
+    unsigned int fraction = (unsigned int)(magnitude % (unsigned long long)PS_SCALE);
+
+    if (value < 0) out[length++] = '-';
+    do {
+        digits[count++] = (char)('0' + integer % 10);
+        integer /= 10;
+    } while (integer > 0);
+    while (count > 0) out[length++] = digits[--count];
+
+    if (fraction != 0) {
+        int decimals = PS_DECIMALS;
+        while (fraction % 10 == 0) {
+            fraction /= 10;
+            decimals--;
+        }
+        out[length++] = '.';
+        for (int i = decimals - 1; i >= 0; i--) {
+            out[length + i] = (char)('0' + fraction % 10);
+            fraction /= 10;
+        }
+        length += decimals;
+    }
+    out[length++] = ' ';
+    return length;
+}
+
+/*
+ * Writes a pair of fixed-point numbers followed by an operator.
+ */
+static void write_pair(PsWriter *writer, long long x, long long y, const char *op, size_t op_length) {
+    char text[2 * PS_MAX_NUMBER + 8];
+    size_t length = format_fixed(text, x);
+    length += format_fixed(text + length, y);
+    memcpy(text + length, op, op_length);
+    ps_write(writer, text, length + op_length);
+}
+
+/* Absolute move; also resets the pen the relative offsets start from */
+void ps_moveto(PsWriter *writer, double x, double y) {
+    writer->pen_x = to_fixed(x);
+    writer->pen_y = to_fixed(y);
+    if (!writer->raster) write_pair(writer, writer->pen_x, writer->pen_y, "m\n", 2);
+}
+
+/* Line to the rounded position, as an offset from the rounded current point */
+void ps_lineto(PsWriter *writer, double x, double y) {
+    long long fixed_x = to_fixed(x), fixed_y = to_fixed(y);
+    if (writer->raster) {
+        raster_line(writer->raster, writer->pen_x / PS_SCALE, writer->pen_y / PS_SCALE,
+                    fixed_x / PS_SCALE, fixed_y / PS_SCALE);
+    } else {
+        write_pair(writer, fixed_x - writer->pen_x, fixed_y - writer->pen_y, "r\n", 2);
+    }
+    writer->pen_x = fixed_x;
+    writer->pen_y = fixed_y;
+}
+
+void ps_setrgbcolor(PsWriter *writer, double red, double green, double blue) {
+    if (writer->raster) {
+        raster_set_color(writer->raster, red, green, blue);
+    } else {
+        ps_printf(writer, "%g %g %g setrgbcolor\n", red, green, blue);
+    }
+}
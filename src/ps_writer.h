@@ -0,0 +1,155 @@
+#ifndef PS_WRITER_H
+#define PS_WRITER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "raster.h"
+
+/**
+ * @brief Size of the output buffer of a PostScript writer, in bytes.
+ */
+#define PS_BUFFER_SIZE 65536
+
+/**
+ * @brief Number of decimals coordinates are written with.
+ *
+ * A thousandth of a point is far below the pixel size of any output device,
+ * so coordinates render the same as with full precision.
+ */
+#define PS_DECIMALS 3
+
+/**
+ * @brief Receives a block of output when the writer's buffer is flushed.
+ *
+ * @param[in] context The context given to ps_init().
+ * @param[in] data The bytes to write.
+ * @param[in] length The number of bytes.
+ * @return int Returns 1 on success, 0 if the data could not be written.
+ */
+typedef int (*PsSink)(void *context, const char *data, size_t length);
+
+/**
+ * @brief Buffered PostScript output with compact path operators.
+ *
+ * Coordinates are rounded to PS_DECIMALS decimals and kept as integers, so
+ * the relative offsets written by ps_lineto() add up exactly to the absolute
+ * positions they stand for. Coordinates are expected to lie on the page.
+ * While a raster is attached, paths are drawn into it instead and nothing
+ * is written, so the same drawing code renders either.
+ */
+typedef struct {
+    char buffer[PS_BUFFER_SIZE];    /**< Bytes not yet passed to the sink */
+    size_t length;                  /**< Number of bytes in the buffer */
+    PsSink sink;                    /**< Receives the buffered bytes */
+    void *context;                  /**< Passed to the sink */
+    int failed;                     /**< Set once the sink reported an error */
+    size_t written;                 /**< Bytes passed to the sink so far */
+    long long pen_x;                /**< Current point in units of 10^-PS_DECIMALS points */
+    long long pen_y;                /**< Current point in units of 10^-PS_DECIMALS points */
+    Raster *raster;                 /**< Receives the paths instead of the output while set, NULL by default */
+} PsWriter;
+
+/**
+ * @brief Prepares a writer that passes its output to a sink.
+ *
+ * @param[out] writer The writer to initialize.
+ * @param[in] sink The function receiving the output.
+ * @param[in] context Passed to the sink with every block.
+ */
+void ps_init(PsWriter *writer, PsSink sink, void *context);
+
+/**
+ * @brief Sink writing to a stdio stream, given as the context.
+ *
+ * @param[in] context The FILE* to write to.
+ * @param[in] data The bytes to write.
+ * @param[in] length The number of bytes.
+ * @return int Returns 1 on success, 0 on a write error.
+ */
+int ps_file_sink(void *context, const char *data, size_t length);
+
+/**
+ * @brief Growable memory block receiving output through ps_buffer_sink().
+ */
+typedef struct {
+    char *data;         /**< Output written so far, not null-terminated */
+    size_t length;      /**< Number of bytes in data */
+    size_t capacity;    /**< Allocated size of data */
+} PsBuffer;
+
+/**
+ * @brief Sink appending to a PsBuffer, given as the context.
+ *
+ * @param[in] context The PsBuffer* to append to; zero it before first use
+ *            and free its data afterwards.
+ * @param[in] data The bytes to append.
+ * @param[in] length The number of bytes.
+ * @return int Returns 1 on success, 0 if memory allocation failed.
+ */
+int ps_buffer_sink(void *context, const char *data, size_t length);
+
+/**
+ * @brief Appends raw bytes to the output.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] data The bytes to append.
+ * @param[in] length The number of bytes.
+ */
+void ps_write(PsWriter *writer, const char *data, size_t length);
+
+/**
+ * @brief Appends a null-terminated string to the output.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] text The string to append.
+ */
+void ps_puts(PsWriter *writer, const char *text);
+
+/**
+ * @brief Appends printf-style formatted text to the output.
+ *
+ * Meant for the few lines that are not coordinates, such as labels.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] format The printf format string.
+ */
+void ps_printf(PsWriter *writer, const char *format, ...);
+
+/**
+ * @brief Starts a new subpath at an absolute position ("x y m").
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] x The x coordinate in points.
+ * @param[in] y The y coordinate in points.
+ */
+void ps_moveto(PsWriter *writer, double x, double y);
+
+/**
+ * @brief Extends the current subpath to a position, written relative to the
+ * current point ("dx dy r").
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] x The x coordinate in points.
+ * @param[in] y The y coordinate in points.
+ */
+void ps_lineto(PsWriter *writer, double x, double y);
+
+/**
+ * @brief Sets the color of the paths drawn next ("r g b setrgbcolor").
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] red The red component, from 0 to 1.
+ * @param[in] green The green component, from 0 to 1.
+ * @param[in] blue The blue component, from 0 to 1.
+ */
+void ps_setrgbcolor(PsWriter *writer, double red, double green, double blue);
+
+/**
+ * @brief Passes all buffered output to the sink.
+ *
+ * @param[in,out] writer The writer.
+ * @return int Returns 1 if all output so far was written, 0 after any write error.
+ */
+int ps_flush(PsWriter *writer);
+
+#endif /* PS_WRITER_H */
@@ -0,0 +1,372 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raster.h"
+
+#define WINDOW_SIZE 32768       /* Largest distance deflate can refer back */
+#define HASH_BITS 15            /* Bits of the hash of three bytes starting a match */
+#define MAX_CHAIN 32            /* Earlier positions tried per match search */
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define ADLER_BASE 65521
+#define ADLER_BLOCK 5552        /* Bytes summed before the Adler-32 sums can overflow */
+
+/* First length of each deflate length code 257..285, and its extra bits */
+static const unsigned short length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/* First distance of each deflate distance code 0..29, and its extra bits */
+static const unsigned short distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* Growable byte buffer that deflate writes its bits into, least significant first */
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    uint32_t bits;      /* Bits not yet stored */
+    int count;          /* Number of bits in 'bits' */
+    int failed;         /* Set once memory allocation failed */
+} BitWriter;
+
+Raster* create_raster(int size) {
+    Raster *raster = (Raster*)malloc(sizeof(Raster));
+    if (raster == NULL) return NULL;
+    raster->pixels = (unsigned char*)malloc((size_t)size * (size_t)size);
+    if (raster->pixels == NULL) {
+        free(raster);
+        return NULL;
+    }
+    memset(raster->pixels, 255, (size_t)size * (size_t)size);
+    raster->size = size;
+    raster->scale = (double)size / RASTER_PAGE_SIZE;
+    raster->ink = 0;
+    return raster;
+}
+
+/* Rec. 601 luma, as PostScript's own setrgbcolor-to-gray conversion */
+void raster_set_color(Raster *raster, double red, double green, double blue) {
+    double gray = 0.299 * red + 0.587 * green + 0.114 * blue;
+    raster->ink = (unsigned char)lround(255.0 * (gray < 0.0 ? 0.0 : gray > 1.0 ? 1.0 : gray));
+}
+
+/* Moves a pixel towards the ink by the share of it the line covers */
+static void blend_pixel(Raster *raster, int column, int row, double coverage) {
+    if (column < 0 || row < 0 || column >= raster->size || row >= raster->size || coverage <= 0.0) return;
+    unsigned char *pixel = &raster->pixels[(size_t)row * raster->size + column];
+    double value = *pixel + (raster->ink - *pixel) * (coverage > 1.0 ? 1.0 : coverage);
+    *pixel = (unsigned char)(value + 0.5);
+}
+
+/* Wu's pixels along the major axis 'u' and minor axis 'v', transposed when 'steep' */
+static void plot_wu(Raster *raster, int steep, int u, double v, double coverage) {
+    int whole = (int)floor(v);
+    double fraction = v - whole;
+    if (steep) {
+        blend_pixel(raster, whole, u, (1.0 - fraction) * coverage);
+        blend_pixel(raster, whole + 1, u, fraction * coverage);
+    } else {
+        blend_pixel(raster, u, whole, (1.0 - fraction) * coverage);
+        blend_pixel(raster, u, whole + 1, fraction * coverage);
+    }
+}
+
+/* Fills a row or column of pixels between two pixel centres */
+static void fill_span(Raster *raster, int vertical, int fixed, int from, int to) {
+    if (from > to) {
+        int swap = from;
+        from = to;
+        to = swap;
+    }
+    if (fixed < 0 || fixed >= raster->size) return;
+    if (from < 0) from = 0;
+    if (to >= raster->size) to = raster->size - 1;
+    for (int i = from; i <= to; i++) {
+        raster->pixels[vertical ? (size_t)i * raster->size + fixed : (size_t)fixed * raster->size + i] = raster->ink;
+    }
+}
+
+/*
+ * Maps the page to pixel coordinates, whose integers are pixel centres,
+ * then walks the major axis one pixel at a time.
+ */
+void raster_line(Raster *raster, double x0, double y0, double x1, double y1) {
+    double u0 = x0 * raster->scale, v0 = (RASTER_PAGE_SIZE - y0) * raster->scale;
+    double u1 = x1 * raster->scale, v1 = (RASTER_PAGE_SIZE - y1) * raster->scale;
+
+    /* Grid lines, ticks and the box land on pixel centres at integer scales */
+    if (u0 == floor(u0) && v0 == floor(v0) && u1 == floor(u1) && v1 == floor(v1) && (u0 == u1 || v0 == v1)) {
+        if (v0 == v1) fill_span(raster, 0, (int)v0, (int)u0, (int)u1);
+        else fill_span(raster, 1, (int)u0, (int)v0, (int)v1);
+        return;
+    }
+
+    int steep = fabs(v1 - v0) > fabs(u1 - u0);
+    double swap;
+    if (steep) {
+        swap = u0; u0 = v0; v0 = swap;
+        swap = u1; u1 = v1; v1 = swap;
+    }
+    if (u0 > u1) {
+        swap = u0; u0 = u1; u1 = swap;
+        swap = v0; v0 = v1; v1 = swap;
+    }
+    double gradient = u1 > u0 ? (v1 - v0) / (u1 - u0) : 0.0;
+
+    /* Ends cover their pixel by the part of it the line reaches */
+    int first = (int)floor(u0 + 0.5);
+    int last = (int)floor(u1 + 0.5);
+    double first_v = v0 + gradient * (first - u0);
+    double last_v = v1 + gradient * (last - u1);
+    plot_wu(raster, steep, first, first_v, 1.0 - (u0 + 0.5 - floor(u0 + 0.5)));
+    if (last != first) plot_wu(raster, steep, last, last_v, u1 + 0.5 - floor(u1 + 0.5));
+
+    /* Only the part of the line over the raster is walked */
+    int from = first + 1 > 0 ? first + 1 : 0;
+    int to = last - 1 < raster->size - 1 ? last - 1 : raster->size - 1;
+    for (int u = from; u <= to; u++) {
+        plot_wu(raster, steep, u, first_v + gradient * (u - first), 1.0);
+    }
+}
+
+/*
+ * Writes the header, then the pixels in one block.
+ */
+int write_raster_pgm(const Raster *raster, RasterSink sink, void *context) {
+    char header[64];
+    int length = snprintf(header, sizeof(header), "P5\n%d %d\n255\n", raster->size, raster->size);
+    return sink(context, header, (size_t)length) &&
+           sink(context, (const char*)raster->pixels, (size_t)raster->size * (size_t)raster->size);
+}
+
+/* Makes room for at least 'extra' more bytes */
+static int reserve_bytes(BitWriter *writer, size_t extra) {
+    if (writer->failed) return 0;
+    if (writer->capacity - writer->length >= extra) return 1;
+    size_t capacity = writer->capacity ? writer->capacity : 4096;
+    while (capacity - writer->length < extra) capacity *= 2;
+    unsigned char *grown = (unsigned char*)realloc(writer->data, capacity);
+    if (grown == NULL) {
+        writer->failed = 1;
+        return 0;
+    }
+    writer->data = grown;
+    writer->capacity = capacity;
+    return 1;
+}
+
+static void put_byte(BitWriter *writer, unsigned char byte) {
+    if (reserve_bytes(writer, 1)) writer->data[writer->length++] = byte;
+}
+
+/* Appends up to 16 bits, least significant first */
+static void put_bits(BitWriter *writer, uint32_t value, int count) {
+    writer->bits |= value << writer->count;
+    writer->count += count;
+    while (writer->count >= 8) {
+        put_byte(writer, (unsigned char)writer->bits);
+        writer->bits >>= 8;
+        writer->count -= 8;
+    }
+}
+
+/* Huffman codes are stored most significant bit first */
+static void put_code(BitWriter *writer, uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+    put_bits(writer, reversed, length);
+}
+
+/* Codes a literal/length symbol with the fixed Huffman code of RFC 1951 */
+static void put_symbol(BitWriter *writer, int symbol) {
+    if (symbol < 144) put_code(writer, 0x30 + symbol, 8);
+    else if (symbol < 256) put_code(writer, 0x190 + symbol - 144, 9);
+    else if (symbol < 280) put_code(writer, symbol - 256, 7);
+    else put_code(writer, 0xC0 + symbol - 280, 8);
+}
+
+static void put_match(BitWriter *writer, int length, int distance) {
+    int code = 28;
+    while (length_base[code] > length) code--;
+    put_symbol(writer, 257 + code);
+    put_bits(writer, (uint32_t)(length - length_base[code]), length_extra[code]);
+
+    code = 29;
+    while (distance_base[code] > distance) code--;
+    put_code(writer, (uint32_t)code, 5);
+    put_bits(writer, (uint32_t)(distance - distance_base[code]), distance_extra[code]);
+}
+
+static uint32_t hash_bytes(const unsigned char *data) {
+    uint32_t value = ((uint32_t)data[0] << 16) | ((uint32_t)data[1] << 8) | data[2];
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/*
+ * Compresses into a single fixed-Huffman block. Every position is entered
+ * in a hash chain; a match is the longest of the first MAX_CHAIN earlier
+ * positions with the same three bytes, taken greedily.
+ */
+static void deflate_data(BitWriter *writer, const unsigned char *data, size_t length) {
+    int32_t *head = (int32_t*)malloc(((size_t)1 << HASH_BITS) * sizeof(int32_t));
+    int32_t *previous = (int32_t*)malloc(WINDOW_SIZE * sizeof(int32_t));
+
+    if (head == NULL || previous == NULL) {
+        free(head);
+        free(previous);
+        writer->failed = 1;
+        return;
+    }
+    memset(head, 0xFF, ((size_t)1 << HASH_BITS) * sizeof(int32_t));
+
+    put_bits(writer, 1, 1);     /* Last block */
+    put_bits(writer, 1, 2);     /* Fixed Huffman codes */
+
+    size_t i = 0;
+    while (i < length) {
+        int best = 0, distance = 0;
+        if (i + MIN_MATCH <= length) {
+            int32_t candidate = head[hash_bytes(data + i)];
+            size_t limit = length - i < MAX_MATCH ? length - i : MAX_MATCH;
+            for (int chain = 0; chain < MAX_CHAIN && candidate >= 0 && i - (size_t)candidate <= WINDOW_SIZE; chain++) {
+                size_t match = 0;
+                while (match < limit && data[candidate + match] == data[i + match]) match++;
+                if ((int)match > best) {
+                    best = (int)match;
+                    distance = (int)(i - (size_t)candidate);
+                    if (match == limit) break;
+                }
+                int32_t next = previous[candidate & (WINDOW_SIZE - 1)];
+                if (next >= candidate) break;   /* The slot was reused by a later position */
+                candidate = next;
+            }
+        }
+
+        size_t step = best >= MIN_MATCH ? (size_t)best : 1;
+        if (best >= MIN_MATCH) put_match(writer, best, distance);
+        else put_symbol(writer, data[i]);
+        for (size_t end = i + step; i < end; i++) {
+            if (i + MIN_MATCH > length) continue;
+            uint32_t hash = hash_bytes(data + i);
+            previous[i & (WINDOW_SIZE - 1)] = head[hash];
+            head[hash] = (int32_t)i;
+        }
+    }
+    put_symbol(writer, 256);    /* End of block */
+    if (writer->count > 0) put_bits(writer, 0, 8 - writer->count);
+
+    free(head);
+    free(previous);
+}
+
+static uint32_t adler32(const unsigned char *data, size_t length) {
+    uint32_t a = 1, b = 0;
+    while (length > 0) {
+        size_t block = length < ADLER_BLOCK ? length : ADLER_BLOCK;
+        length -= block;
+        while (block-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return (b << 16) | a;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static uint32_t update_crc(const uint32_t *table, uint32_t crc, const unsigned char *data, size_t length) {
+    for (size_t i = 0; i < length; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+/* Writes a chunk: length, type, data and the CRC-32 of type and data */
+static int write_chunk(RasterSink sink, void *context, const uint32_t *crc_table, const char *type,
+                       const unsigned char *data, size_t length) {
+    unsigned char header[8], trailer[4];
+    put_u32(header, (uint32_t)length);
+    memcpy(header + 4, type, 4);
+
+    uint32_t crc = update_crc(crc_table, 0xFFFFFFFFu, header + 4, 4);
+    crc = update_crc(crc_table, crc, data, length) ^ 0xFFFFFFFFu;
+    put_u32(trailer, crc);
+    return sink(context, (const char*)header, 8) && (length == 0 || sink(context, (const char*)data, length)) &&
+           sink(context, (const char*)trailer, 4);
+}
+
+/*
+ * Lays the rows out with their filter bytes, wraps the deflated rows in a
+ * zlib stream and writes the IHDR, IDAT and IEND chunks.
+ */
+int write_raster_png(const Raster *raster, RasterSink sink, void *context) {
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    size_t row_bytes = (size_t)raster->size + 1;
+    size_t length = row_bytes * (size_t)raster->size;
+    unsigned char *rows = (unsigned char*)malloc(length);
+    BitWriter writer = { NULL, 0, 0, 0, 0, 0 };
+    uint32_t crc_table[256];
+
+    if (rows == NULL) return 0;
+    for (int y = 0; y < raster->size; y++) {
+        rows[y * row_bytes] = 0;    /* No filter */
+        memcpy(rows + y * row_bytes + 1, raster->pixels + (size_t)y * raster->size, (size_t)raster->size);
+    }
+
+    put_byte(&writer, 0x78);    /* Deflate, 32 KiB window */
+    put_byte(&writer, 0x01);    /* No dictionary, fastest level; makes the header a multiple of 31 */
+    deflate_data(&writer, rows, length);
+    if (reserve_bytes(&writer, 4)) {
+        put_u32(writer.data + writer.length, adler32(rows, length));
+        writer.length += 4;
+    }
+    free(rows);
+    if (writer.failed) {
+        free(writer.data);
+        return 0;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) crc = crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+        crc_table[n] = crc;
+    }
+
+    unsigned char header[13];
+    put_u32(header, (uint32_t)raster->size);
+    put_u32(header + 4, (uint32_t)raster->size);
+    header[8] = 8;      /* Bits per sample */
+    header[9] = 0;      /* Grayscale */
+    header[10] = 0;     /* Deflate */
+    header[11] = 0;     /* Adaptive filtering */
+    header[12] = 0;     /* Not interlaced */
+
+    int ok = sink(context, (const char*)signature, sizeof(signature)) &&
+             write_chunk(sink, context, crc_table, "IHDR", header, sizeof(header)) &&
+             write_chunk(sink, context, crc_table, "IDAT", writer.data, writer.length) &&
+             write_chunk(sink, context, crc_table, "IEND", NULL, 0);
+    free(writer.data);
+    return ok;
+}
+
+void free_raster(Raster *raster) {
+    if (raster == NULL) return;
+    free(raster->pixels);
+    free(raster);
+}
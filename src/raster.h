@@ -0,0 +1,96 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stddef.h>
+
+/**
+ * @brief Width and height of the PostScript page a raster covers, in points.
+ */
+#define RASTER_PAGE_SIZE 500
+
+/**
+ * @brief Receives a block of encoded image data; same contract as PsSink.
+ */
+typedef int (*RasterSink)(void *context, const char *data, size_t length);
+
+/**
+ * @brief Square 8-bit grayscale bitmap of the page, white where nothing was drawn.
+ *
+ * Rows are stored top to bottom; page coordinates have their origin at the
+ * bottom left, as in PostScript, and are scaled by size / RASTER_PAGE_SIZE.
+ */
+typedef struct Raster {
+    int size;               /**< Width and height in pixels */
+    double scale;           /**< Pixels per point */
+    unsigned char *pixels;  /**< size * size gray levels, 0 black and 255 white */
+    unsigned char ink;      /**< Gray level lines are drawn with */
+} Raster;
+
+/**
+ * @brief Creates a white raster of the page.
+ *
+ * @param[in] size The width and height in pixels.
+ * @return Raster* Returns the raster, or NULL if memory allocation failed.
+ */
+Raster* create_raster(int size);
+
+/**
+ * @brief Sets the color of the lines drawn next, converted to its luma.
+ *
+ * @param[in,out] raster The raster.
+ * @param[in] red The red component, from 0 to 1.
+ * @param[in] green The green component, from 0 to 1.
+ * @param[in] blue The blue component, from 0 to 1.
+ */
+void raster_set_color(Raster *raster, double red, double green, double blue);
+
+/**
+ * @brief Draws a one-pixel line between two points of the page.
+ *
+ * Lines along a row or column between pixel centres are filled directly;
+ * all others are drawn antialiased with Xiaolin Wu's algorithm, which
+ * steps along the major axis like Bresenham's and splits each step
+ * between the two nearest pixels of the minor axis. Parts outside the
+ * raster are clipped.
+ *
+ * @param[in,out] raster The raster.
+ * @param[in] x0 The x coordinate of the start in points.
+ * @param[in] y0 The y coordinate of the start in points.
+ * @param[in] x1 The x coordinate of the end in points.
+ * @param[in] y1 The y coordinate of the end in points.
+ */
+void raster_line(Raster *raster, double x0, double y0, double x1, double y1);
+
+/**
+ * @brief Writes the raster as a binary (P5) PGM image.
+ *
+ * @param[in] raster The raster.
+ * @param[in] sink The function receiving the image.
+ * @param[in] context Passed to the sink.
+ * @return int Returns 1 on success, 0 if the sink failed.
+ */
+int write_raster_pgm(const Raster *raster, RasterSink sink, void *context);
+
+/**
+ * @brief Writes the raster as a grayscale PNG image.
+ *
+ * The image data is compressed with a built-in deflate encoder: LZ77 over
+ * a 32 KiB window with hash chains, coded with the fixed Huffman codes, so
+ * no library is needed. Rows are stored unfiltered; runs of white and rows
+ * repeating the one above are what LZ77 finds anyway.
+ *
+ * @param[in] raster The raster.
+ * @param[in] sink The function receiving the image.
+ * @param[in] context Passed to the sink.
+ * @return int Returns 1 on success, 0 if the sink failed or memory allocation failed.
+ */
+int write_raster_png(const Raster *raster, RasterSink sink, void *context);
+
+/**
+ * @brief Frees a raster.
+ *
+ * @param[in] raster The raster (may be NULL).
+ */
+void free_raster(Raster *raster);
+
+#endif /* RASTER_H */
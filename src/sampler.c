@@ -0,0 +1,435 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sampler.h"
+#include "interval.h"
+#include "utils.h"
+
+#define PARALLEL_CHUNK 4096   /* Samples claimed by a worker thread at a time */
+#define CULL_BLOCK 256        /* Samples below which blocks are not bounded any further */
+
+#define BRACKET_RESOLUTION 1e-3   /* Width in device units at which transitions are located */
+#define MAX_ADAPTIVE_SAMPLES (1 << 22)  /* Hard limit on the size of a refined buffer */
+
+/* State of a sample relative to the visible window */
+typedef enum { SAMPLE_VISIBLE, SAMPLE_OUTSIDE, SAMPLE_UNDEFINED } SampleState;
+
+/* A sample of the refined curve */
+typedef struct {
+    double x;
+    double y;
+} SamplePoint;
+
+/* Interval between two samples, given by their indices in the point store */
+typedef struct {
+    size_t left;
+    size_t right;
+} SampleInterval;
+
+/* Growable storage used while refining */
+typedef struct {
+    SamplePoint *points;
+    size_t point_count;
+    size_t point_capacity;
+    SampleInterval *intervals;
+    size_t interval_count;
+    size_t interval_capacity;
+} RefineState;
+
+/*
+ * Allocates the buffer and computes the sample positions from their indices.
+ */
+SampleBuffer* create_samples(double x_min, double x_max, size_t count) {
+    SampleBuffer *samples = (SampleBuffer*)calloc(1, sizeof(SampleBuffer));
+    if (samples == NULL) return NULL;
+
+    samples->count = count;
+    if (count == 0) return samples;
+
+    samples->xs = (double*)malloc(samples->count * sizeof(double));
+    samples->ys = (double*)malloc(samples->count * sizeof(double));
+    if (samples->xs == NULL || samples->ys == NULL) {
+        free_samples(samples);
+        return NULL;
+    }
+    double step = count > 1 ? (x_max - x_min) / (double)(count - 1) : 0.0;
+    for (size_t i = 0; i < count; i++) {
+        samples->xs[i] = x_min + (double)i * step;
+    }
+    if (count > 1) samples->xs[count - 1] = x_max;
+    return samples;
+}
+
+/* Contiguous run of samples to evaluate */
+typedef struct {
+    size_t first;
+    size_t count;
+} SampleSpan;
+
+/* Work shared by the threads evaluating runs of one array of samples */
+typedef struct {
+    const Program *program;
+    const double *xs;
+    double *ys;
+    const SampleSpan *spans;
+    size_t span_count;
+    size_t span;            /* Run being claimed */
+    size_t next;            /* First sample of the run not yet claimed by a thread */
+    pthread_mutex_t lock;
+} ParallelJob;
+
+/*
+ * Worker loop: claims chunks of samples until none are left. Each sample is
+ * evaluated independently, so the results do not depend on which thread
+ * evaluated which chunk.
+ */
+static void* evaluate_worker(void *arg) {
+    ParallelJob *job = (ParallelJob*)arg;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        while (job->span < job->span_count && job->next == job->spans[job->span].count) {
+            job->span++;
+            job->next = 0;
+        }
+        if (job->span == job->span_count) {
+            pthread_mutex_unlock(&job->lock);
+            return NULL;
+        }
+        size_t left = job->spans[job->span].count - job->next;
+        size_t first = job->spans[job->span].first + job->next;
+        size_t count = left < PARALLEL_CHUNK ? left : PARALLEL_CHUNK;
+        job->next += count;
+        pthread_mutex_unlock(&job->lock);
+
+        evaluate_program_batch(job->program, job->xs + first, job->ys + first, count);
+    }
+}
+
+/*
+ * Evaluates runs of an array of samples in place on up to 'threads'
+ * threads, the calling thread included. Falls back to the calling thread
+ * alone when there are few samples or threads cannot be started.
+ */
+static void evaluate_spans(const Program *program, const double *xs, double *ys,
+                           const SampleSpan *spans, size_t span_count, size_t total, int threads) {
+    ParallelJob job;
+    pthread_t workers[MAX_SAMPLER_THREADS];
+    int started = 0;
+
+    if (threads > MAX_SAMPLER_THREADS) threads = MAX_SAMPLER_THREADS;
+    if (threads <= 1 || total <= PARALLEL_CHUNK) {
+        for (size_t i = 0; i < span_count; i++) {
+            evaluate_program_batch(program, xs + spans[i].first, ys + spans[i].first, spans[i].count);
+        }
+        return;
+    }
+
+    job.program = program;
+    job.xs = xs;
+    job.ys = ys;
+    job.spans = spans;
+    job.span_count = span_count;
+    job.span = 0;
+    job.next = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, evaluate_worker, &job) == 0) {
+        started++;
+    }
+    evaluate_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+}
+
+/* Evaluates a whole array of samples */
+static void evaluate_parallel(const Program *program, const double *xs, double *ys, size_t count, int threads) {
+    SampleSpan span = { 0, count };
+    evaluate_spans(program, xs, ys, &span, 1, count, threads);
+}
+
+/* Evaluate one chunk of the buffer in a single batch */
+void sample_chunk(const Program *program, SampleBuffer *samples, size_t first, size_t count) {
+    evaluate_program_batch(program, samples->xs + first, samples->ys + first, count);
+}
+
+/* Allocate and evaluate all samples of a range */
+SampleBuffer* sample_program(const Program *program, double x_min, double x_max, size_t count, int threads) {
+    SampleBuffer *samples = create_samples(x_min, x_max, count);
+    if (samples == NULL) return NULL;
+    evaluate_parallel(program, samples->xs, samples->ys, samples->count, threads);
+    return samples;
+}
+
+/* Runs left to evaluate after culling, merged where they touch */
+typedef struct {
+    SampleSpan *spans;
+    size_t count;
+    size_t capacity;
+    size_t samples;         /* Samples in all runs */
+    size_t culled;          /* Samples skipped for lying outside the window rather than being undefined */
+    int failed;             /* Set when the run list could not grow */
+} SpanList;
+
+/*
+ * Appends a run, extending the last one when they are adjacent.
+ */
+static void push_span(SpanList *list, size_t first, size_t count) {
+    list->samples += count;
+    if (list->count > 0 && list->spans[list->count - 1].first + list->spans[list->count - 1].count == first) {
+        list->spans[list->count - 1].count += count;
+        return;
+    }
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        SampleSpan *spans = (SampleSpan*)realloc(list->spans, capacity * sizeof(SampleSpan));
+        if (spans == NULL) {
+            list->failed = 1;
+            return;
+        }
+        list->spans = spans;
+        list->capacity = capacity;
+    }
+    list->spans[list->count].first = first;
+    list->spans[list->count].count = count;
+    list->count++;
+}
+
+/*
+ * Sets the samples of a block to NaN when interval bounds prove them NaN or
+ * outside [y_min, y_max], bisecting blocks that may still hold such runs,
+ * and lists the samples left to evaluate.
+ */
+static void cull_block(const Program *program, SampleBuffer *samples, size_t first, size_t count,
+                       double y_min, double y_max, SpanList *list) {
+    Interval bound = evaluate_program_interval(program, samples->xs[first], samples->xs[first + count - 1]);
+
+    if (interval_is_empty(bound) || bound.hi < y_min || bound.lo > y_max) {
+        for (size_t i = first; i < first + count; i++) samples->ys[i] = create_nan();
+        if (!interval_is_empty(bound)) list->culled += count;
+        return;
+    }
+    /* Nothing inside can be culled once every value is defined and visible */
+    if (count <= CULL_BLOCK || (!bound.partial && bound.lo >= y_min && bound.hi <= y_max)) {
+        push_span(list, first, count);
+        return;
+    }
+
+    size_t half = count / 2;
+    cull_block(program, samples, first, half, y_min, y_max, list);
+    cull_block(program, samples, first + half, count - half, y_min, y_max, list);
+}
+
+/* Cull blocks first, then evaluate the remaining runs in place */
+SampleBuffer* sample_visible(const Program *program, double x_min, double x_max, size_t count,
+                             double y_min, double y_max, int threads, size_t *evaluations, size_t *culled) {
+    SampleBuffer *samples = create_samples(x_min, x_max, count);
+    SpanList list = { NULL, 0, 0, 0, 0, 0 };
+
+    if (samples == NULL) return NULL;
+    if (count > 0) cull_block(program, samples, 0, count, y_min, y_max, &list);
+    if (list.failed) {
+        free(list.spans);
+        free_samples(samples);
+        return NULL;
+    }
+    evaluate_spans(program, samples->xs, samples->ys, list.spans, list.count, list.samples, threads);
+    *evaluations = list.samples;
+    *culled = list.culled;
+    free(list.spans);
+    return samples;
+}
+
+/*
+ * Classifies a value as visible, outside the window or undefined.
+ */
+static SampleState sample_state(double y, const AdaptiveParams *params) {
+    if (is_nan(y)) return SAMPLE_UNDEFINED;
+    return y >= params->y_min && y <= params->y_max ? SAMPLE_VISIBLE : SAMPLE_OUTSIDE;
+}
+
+/*
+ * Appends a point to the store.
+ */
+static int push_point(RefineState *state, double x, double y) {
+    if (state->point_count == state->point_capacity) {
+        size_t capacity = state->point_capacity ? state->point_capacity * 2 : 1024;
+        SamplePoint *points = (SamplePoint*)realloc(state->points, capacity * sizeof(SamplePoint));
+        if (points == NULL) return 0;
+        state->points = points;
+        state->point_capacity = capacity;
+    }
+    state->points[state->point_count].x = x;
+    state->points[state->point_count].y = y;
+    state->point_count++;
+    return 1;
+}
+
+/*
+ * Appends an interval to a level's interval list.
+ */
+static int push_interval(SampleInterval **intervals, size_t *count, size_t *capacity, size_t left, size_t right) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+        SampleInterval *grown = (SampleInterval*)realloc(*intervals, new_capacity * sizeof(SampleInterval));
+        if (grown == NULL) return 0;
+        *intervals = grown;
+        *capacity = new_capacity;
+    }
+    (*intervals)[*count].left = left;
+    (*intervals)[*count].right = right;
+    (*count)++;
+    return 1;
+}
+
+/*
+ * Orders points by 'x' for qsort().
+ */
+static int compare_points(const void *a, const void *b) {
+    double xa = ((const SamplePoint*)a)->x, xb = ((const SamplePoint*)b)->x;
+    return (xa > xb) - (xa < xb);
+}
+
+/*
+ * Decides whether an interval needs a midpoint sample. Returns 1 to evaluate
+ * the midpoint, 2 to insert a path break at the midpoint, 0 if the interval
+ * is final.
+ */
+static int needs_midpoint(const SamplePoint *a, const SamplePoint *b, const AdaptiveParams *params) {
+    SampleState sa = sample_state(a->y, params), sb = sample_state(b->y, params);
+    double device_width = (b->x - a->x) * params->x_scale;
+
+    if (sa != sb) {
+        /* Transition between states, bisected to locate it */
+        return device_width > BRACKET_RESOLUTION;
+    }
+    if (sa != SAMPLE_VISIBLE) {
+        return 0;
+    }
+    if (device_width > params->min_step) {
+        return 1;
+    }
+    /* A jump that survives bisection down to the bracket width is an asymptote */
+    if (fabs(b->y - a->y) * params->y_scale <= params->break_jump) return 0;
+    return device_width > BRACKET_RESOLUTION ? 1 : 2;
+}
+
+/*
+ * Refines level by level: every interval that needs a midpoint gets one,
+ * the new midpoints are evaluated in one batch, and the resulting halves form
+ * the next level unless the midpoint shows the interval was already straight.
+ */
+SampleBuffer* refine_samples(const Program *program, const SampleBuffer *initial,
+                             const AdaptiveParams *params, size_t *evaluations) {
+    RefineState state;
+    SampleInterval *next = NULL;
+    size_t next_count = 0, next_capacity = 0;
+    double *xs = NULL, *ys = NULL;
+    size_t *pending = NULL;
+    int ok = 1;
+
+    memset(&state, 0, sizeof(state));
+    *evaluations = 0;
+
+    for (size_t i = 0; ok && i < initial->count; i++) {
+        ok = push_point(&state, initial->xs[i], initial->ys[i]);
+        if (ok && i > 0) {
+            ok = push_interval(&state.intervals, &state.interval_count, &state.interval_capacity, i - 1, i);
+        }
+    }
+
+    while (ok && state.interval_count > 0) {
+        size_t batch = 0;
+        size_t first_new = state.point_count;
+
+        /* On failure the old blocks stay in place and are freed below */
+        double *grown_xs = (double*)realloc(xs, state.interval_count * sizeof(double));
+        if (grown_xs != NULL) xs = grown_xs;
+        double *grown_ys = (double*)realloc(ys, state.interval_count * sizeof(double));
+        if (grown_ys != NULL) ys = grown_ys;
+        size_t *grown_pending = (size_t*)realloc(pending, state.interval_count * sizeof(size_t));
+        if (grown_pending != NULL) pending = grown_pending;
+        if (grown_xs == NULL || grown_ys == NULL || grown_pending == NULL) {
+            ok = 0;
+            break;
+        }
+
+        /* Collect the midpoints of this level */
+        for (size_t i = 0; i < state.interval_count && ok; i++) {
+            SampleInterval interval = state.intervals[i];
+            SamplePoint a = state.points[interval.left], b = state.points[interval.right];
+            int action = state.point_count < MAX_ADAPTIVE_SAMPLES
+                       ? needs_midpoint(&a, &b, params) : 0;
+            double mid = a.x + (b.x - a.x) / 2;
+
+            if (action == 1) {
+                xs[batch] = mid;
+                pending[batch++] = i;
+            } else if (action == 2) {
+                ok = push_point(&state, mid, create_nan());
+            }
+        }
+        if (!ok || batch == 0) break;
+
+        evaluate_parallel(program, xs, ys, batch, params->threads);
+        *evaluations += batch;
+        first_new = state.point_count;
+
+        /* Split the intervals whose midpoint is not on the chord */
+        next_count = 0;
+        for (size_t j = 0; j < batch && ok; j++) {
+            SampleInterval interval = state.intervals[pending[j]];
+            size_t mid = first_new + j;
+            ok = push_point(&state, xs[j], ys[j]);
+            if (!ok) break;
+
+            SamplePoint a = state.points[interval.left], b = state.points[interval.right];
+            SampleState sa = sample_state(a.y, params), sb = sample_state(b.y, params);
+            if (sa == SAMPLE_VISIBLE && sb == SAMPLE_VISIBLE && sample_state(ys[j], params) == SAMPLE_VISIBLE) {
+                double chord = (a.y + b.y) / 2;
+                if (fabs(ys[j] - chord) * params->y_scale <= params->tolerance) continue;
+            }
+            ok = push_interval(&next, &next_count, &next_capacity, interval.left, mid) &&
+                 push_interval(&next, &next_count, &next_capacity, mid, interval.right);
+        }
+
+        /* The next level becomes the current one */
+        SampleInterval *swap = state.intervals;
+        size_t swap_capacity = state.interval_capacity;
+        state.intervals = next;
+        state.interval_count = next_count;
+        state.interval_capacity = next_capacity;
+        next = swap;
+        next_capacity = swap_capacity;
+    }
+
+    SampleBuffer *samples = NULL;
+    if (ok) {
+        qsort(state.points, state.point_count, sizeof(SamplePoint), compare_points);
+        samples = create_samples(0.0, 0.0, state.point_count);
+    }
+    if (samples != NULL) {
+        for (size_t i = 0; i < state.point_count; i++) {
+            samples->xs[i] = state.points[i].x;
+            samples->ys[i] = state.points[i].y;
+        }
+    }
+
+    free(state.points);
+    free(state.intervals);
+    free(next);
+    free(xs);
+    free(ys);
+    free(pending);
+    return samples;
+}
+
+/* Free the sample arrays and the buffer */
+void free_samples(SampleBuffer *samples) {
+    if (!samples) return;
+    free(samples->xs);
+    free(samples->ys);
+    free(samples);
+}
@@ -0,0 +1,131 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stddef.h>
+#include "bytecode.h"
+
+/**
+ * @brief Largest number of threads used to evaluate samples.
+ */
+#define MAX_SAMPLER_THREADS 256
+
+/**
+ * @brief Samples of a function in increasing order of 'x'.
+ */
+typedef struct {
+    double *xs;     /**< Sampled 'x' values */
+    double *ys;     /**< Function values at xs, NaN where undefined */
+    size_t count;   /**< Number of samples */
+} SampleBuffer;
+
+/**
+ * @brief Allocates a buffer of evenly spaced samples covering [x_min, x_max].
+ *
+ * Sample i lies at x_min + i * (x_max - x_min) / (count - 1), computed from
+ * the index rather than by accumulating a step, so every sample can be
+ * reproduced independently and the buffer can be filled in separate chunks.
+ * The samples are not evaluated yet; see sample_chunk() and sample_program().
+ *
+ * @param[in] x_min The first 'x' value.
+ * @param[in] x_max The last 'x' value.
+ * @param[in] count The number of samples.
+ * @return SampleBuffer* Returns the buffer, or NULL if memory allocation failed.
+ */
+SampleBuffer* create_samples(double x_min, double x_max, size_t count);
+
+/**
+ * @brief Evaluates a contiguous chunk of samples.
+ *
+ * @param[in] program The compiled expression.
+ * @param[in,out] samples The buffer to fill.
+ * @param[in] first Index of the first sample of the chunk.
+ * @param[in] count Number of samples in the chunk.
+ */
+void sample_chunk(const Program *program, SampleBuffer *samples, size_t first, size_t count);
+
+/**
+ * @brief Samples a compiled expression over [x_min, x_max].
+ *
+ * With more than one thread the samples are split into chunks that worker
+ * threads claim in turn. Every sample keeps its index, so the buffer is
+ * identical to the one a single thread would produce.
+ *
+ * @param[in] program The compiled expression.
+ * @param[in] x_min The first 'x' value.
+ * @param[in] x_max The last 'x' value.
+ * @param[in] count The number of samples.
+ * @param[in] threads The number of threads to evaluate on, including the caller.
+ * @return SampleBuffer* Returns the evaluated samples, or NULL if memory allocation failed.
+ */
+SampleBuffer* sample_program(const Program *program, double x_min, double x_max, size_t count, int threads);
+
+/**
+ * @brief Samples a compiled expression over [x_min, x_max], skipping samples that cannot be seen.
+ *
+ * The samples are bounded block by block with evaluate_program_interval(),
+ * bisecting blocks down to a few hundred samples. Blocks proved to be NaN
+ * throughout, or to lie entirely below y_min or above y_max, are set to NaN
+ * without being evaluated; the other samples are evaluated as by
+ * sample_program(). Pass -INFINITY and INFINITY to cull only undefined blocks.
+ *
+ * @param[in] program The compiled expression.
+ * @param[in] x_min The first 'x' value.
+ * @param[in] x_max The last 'x' value.
+ * @param[in] count The number of samples.
+ * @param[in] y_min Values below this are treated as invisible.
+ * @param[in] y_max Values above this are treated as invisible.
+ * @param[in] threads The number of threads to evaluate on, including the caller.
+ * @param[out] evaluations Pointer receiving the number of samples evaluated.
+ * @param[out] culled Pointer receiving the number of samples set to NaN for
+ *             lying outside the window; they may well be defined. Samples of
+ *             blocks proved undefined are not included.
+ * @return SampleBuffer* Returns the samples, or NULL if memory allocation failed.
+ */
+SampleBuffer* sample_visible(const Program *program, double x_min, double x_max, size_t count,
+                             double y_min, double y_max, int threads, size_t *evaluations, size_t *culled);
+
+/**
+ * @brief Device mapping, visible window and accuracy settings for adaptive sampling.
+ */
+typedef struct {
+    double x_scale;     /**< Device units per unit of 'x' */
+    double y_scale;     /**< Device units per unit of 'y' */
+    double y_min;       /**< Bottom edge of the visible window */
+    double y_max;       /**< Top edge of the visible window */
+    double tolerance;   /**< Largest deviation of a curve from its chord, in device units */
+    double min_step;    /**< Narrowest interval refined for curvature, in device units */
+    double break_jump;  /**< Jump across the narrowest interval treated as a discontinuity, in device units */
+    int threads;        /**< Number of threads evaluating each refinement level */
+} AdaptiveParams;
+
+/**
+ * @brief Refines an initial set of samples where the curve needs it.
+ *
+ * Intervals whose midpoint deviates from the chord by more than the
+ * tolerance are subdivided, down to min_step. Intervals where the curve
+ * changes between defined and NaN, or between inside and outside the
+ * window, are bisected until the transition is located to within a
+ * thousandth of a device unit, so path breaks land at the true
+ * discontinuity. Steps of min_step that still jump by more than break_jump
+ * are bisected the same way, and a NaN sample breaks the path where the
+ * jump persists.
+ * Midpoints of each refinement level are evaluated in one batch.
+ *
+ * @param[in] program The compiled expression.
+ * @param[in] initial Evaluated samples to start from, in increasing order of 'x'.
+ * @param[in] params The device mapping, visible window and accuracy settings.
+ * @param[out] evaluations Pointer receiving the number of evaluations performed
+ *             in addition to the initial samples.
+ * @return SampleBuffer* Returns the refined samples, or NULL if memory allocation failed.
+ */
+SampleBuffer* refine_samples(const Program *program, const SampleBuffer *initial,
+                             const AdaptiveParams *params, size_t *evaluations);
+
+/**
+ * @brief Frees a sample buffer.
+ *
+ * @param[in] samples The buffer to free (may be NULL).
+ */
+void free_samples(SampleBuffer *samples);
+
+#endif /* SAMPLER_H */
@@ -0,0 +1,293 @@
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "serve.h"
+#include "job.h"
+#include "options.h"
+#include "ps_writer.h"
+#include "cache.h"
+#include "jit.h"
+
+#define MAX_OPTION_WORD 64  /* Longest option name or value in a request */
+
+/* A compiled expression kept for later requests */
+typedef struct {
+    ExprTree *tree;             /* Parsed function, NULL if the entry is unused */
+    double x_min;
+    double x_max;
+    int derivative;
+    Program *program;
+    unsigned long last_used;    /* Request counter at the last use, for LRU eviction */
+} CachedProgram;
+
+/* State kept across requests and connections */
+typedef struct {
+    RenderOptions defaults;
+    CachedProgram cache[PROGRAM_CACHE_SIZE];
+    MemoryCache pages;          /* Rendered pages, keyed by make_render_key() */
+    unsigned long requests;
+} Server;
+
+/*
+ * Returns the compiled program for a job, compiling it into the least
+ * recently used cache entry on a miss. Native code is attached the first
+ * time a request asks for it.
+ */
+static const Program* find_program(Server *server, const PlotJob *job, const RenderOptions *options) {
+    CachedProgram *victim = &server->cache[0];
+
+    for (int i = 0; i < PROGRAM_CACHE_SIZE; i++) {
+        CachedProgram *entry = &server->cache[i];
+        if (entry->tree && entry->x_min == job->x_min && entry->x_max == job->x_max &&
+            entry->derivative == options->derivative && trees_equal(entry->tree, job->tree)) {
+            entry->last_used = server->requests;
+            if (options->jit) jit_compile_program(entry->program);
+            return entry->program;
+        }
+        if (entry->tree == NULL || (victim->tree != NULL && entry->last_used < victim->last_used)) {
+            victim = entry;
+        }
+    }
+
+    ExprTree *tree = copy_tree(job->tree);
+    Program *program = compile_for_render(job->tree, job->x_min, job->x_max, options);
+    if (tree == NULL || program == NULL) {
+        free_tree(tree);
+        free_program(program);
+        return NULL;
+    }
+
+    free_tree(victim->tree);
+    free_program(victim->program);
+    victim->tree = tree;
+    victim->x_min = job->x_min;
+    victim->x_max = job->x_max;
+    victim->derivative = options->derivative;
+    victim->program = program;
+    victim->last_used = server->requests;
+    return program;
+}
+
+/*
+ * Describes the error codes shared with the command line.
+ */
+static const char* error_message(int code) {
+    switch (code) {
+        case 1: return "Memory allocation failed or request incomplete";
+        case 2: return "Invalid function";
+        case 3: return "Cannot write output file";
+        case 4: return "Invalid range";
+        case 5: return "Invalid option value";
+        default: return "Request failed";
+    }
+}
+
+/*
+ * Copies the next whitespace-separated word into 'word' and returns the
+ * position after it, or NULL if there is no word or it is too long.
+ */
+static char* next_word(char *cursor, char *word) {
+    while (isspace((unsigned char)*cursor)) cursor++;
+    size_t length = 0;
+    while (cursor[length] != '\0' && !isspace((unsigned char)cursor[length])) length++;
+    if (length == 0 || length >= MAX_OPTION_WORD) return NULL;
+    memcpy(word, cursor, length);
+    word[length] = '\0';
+    return cursor + length;
+}
+
+/*
+ * Applies the options at the start of a request. Returns the rest of the line,
+ * or NULL after an invalid option value.
+ */
+static char* parse_request_options(char *line, RenderOptions *options) {
+    for (;;) {
+        char name[MAX_OPTION_WORD], value[MAX_OPTION_WORD];
+        char *argv[2] = { name, value };
+        char *after_name = next_word(line, name);
+        if (after_name == NULL || strncmp(name, "--", 2) != 0) return line;
+
+        char *after_value = next_word(after_name, value);
+        int argc = after_value ? 2 : 1;
+        int index = 0;
+        int option = parse_render_option(options, argc, argv, &index);
+        if (option < 0) return NULL;
+        /* Not an option, e.g. the function "--x" */
+        if (option == 0) return line;
+        line = index == 1 ? after_value : after_name;
+    }
+}
+
+/*
+ * Sends a page inline or writes it to the job's output file, then replies.
+ */
+static int deliver_page(const PlotJob *job, const char *data, size_t length, FILE *out) {
+    if (strcmp(job->outfile, "-") == 0) {
+        fprintf(out, "OK %zu\n", length);
+        fwrite(data, 1, length, out);
+        return 0;
+    }
+    int status = write_page(job->outfile, data, length);
+    if (status == 0) fprintf(out, "OK\n");
+    return status;
+}
+
+/*
+ * Serves a job from the page cache, or renders it with a cached program and
+ * stores the page for the next identical request.
+ */
+static int render_request(Server *server, const PlotJob *job, const RenderOptions *options, FILE *out) {
+    char *key = NULL;
+    int status;
+
+    if (server->pages.limit > 0) {
+        key = make_render_key(job, options);
+        if (key == NULL) return 1;
+        const CacheEntry *entry = memory_cache_get(&server->pages, key);
+        if (entry) {
+            status = deliver_page(job, entry->data, entry->length, out);
+            free(key);
+            return status;
+        }
+    }
+
+    const Program *program = find_program(server, job, options);
+    PsBuffer buffer = { NULL, 0, 0 };
+    status = program ? render_page(job, program, options, &buffer, NULL) : 1;
+    if (status == 0) {
+        status = deliver_page(job, buffer.data, buffer.length, out);
+        if (key) memory_cache_put(&server->pages, key, buffer.data, buffer.length);
+    }
+    free(buffer.data);
+    free(key);
+    return status;
+}
+
+/*
+ * Handles one request line. Returns 1 to keep reading, 0 to end the
+ * connection and -1 to stop the server.
+ */
+static int handle_request(Server *server, char *line, FILE *out) {
+    RenderOptions options = server->defaults;
+    const char *func, *outfile, *range;
+    PlotJob job;
+    int status;
+
+    while (isspace((unsigned char)*line)) line++;
+    size_t length = strlen(line);
+    while (length > 0 && isspace((unsigned char)line[length - 1])) line[--length] = '\0';
+
+    if (length == 0) return 1;
+    if (strcmp(line, "QUIT") == 0) return 0;
+    if (strcmp(line, "SHUTDOWN") == 0) return -1;
+
+    server->requests++;
+    init_job(&job);
+    line = parse_request_options(line, &options);
+    if (line == NULL) {
+        status = 5;
+    } else if (!split_job_line(line, &func, &outfile, &range)) {
+        status = 1;
+    } else {
+        status = set_job_function(&job, func);
+        if (status == 0) status = set_job_outfile(&job, outfile);
+        if (status == 0 && range) status = set_job_range(&job, range);
+        if (status == 0) status = render_request(server, &job, &options, out);
+    }
+    free_job(&job);
+
+    if (status != 0) fprintf(out, "ERROR %d %s\n", status, error_message(status));
+    fflush(out);
+    return 1;
+}
+
+/*
+ * Serves requests from one input stream. Returns -1 if the server should stop.
+ */
+static int serve_stream(Server *server, FILE *in, FILE *out) {
+    char *line = NULL;
+    size_t capacity = 0;
+    int result = 1;
+
+    while (result > 0 && getline(&line, &capacity, in) != -1) {
+        result = handle_request(server, line, out);
+    }
+    free(line);
+    return result;
+}
+
+/*
+ * Accepts connections one at a time until a client sends SHUTDOWN.
+ */
+static int serve_socket(Server *server, const char *socket_path) {
+    struct sockaddr_un address;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (listener < 0 || strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Cannot create socket '%s'.\n", socket_path);
+        if (listener >= 0) close(listener);
+        return 3;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        fprintf(stderr, "Error: Cannot listen on socket '%s'.\n", socket_path);
+        close(listener);
+        return 3;
+    }
+
+    int result = 1;
+    while (result >= 0) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) continue;
+
+        int write_fd = dup(connection);
+        FILE *in = fdopen(connection, "r");
+        FILE *out = write_fd >= 0 ? fdopen(write_fd, "w") : NULL;
+        if (in && out) result = serve_stream(server, in, out);
+
+        if (in) fclose(in); else close(connection);
+        if (out) fclose(out); else if (write_fd >= 0) close(write_fd);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
+
+int run_server(const char *socket_path, const RenderOptions *options, size_t cache_limit) {
+    Server *server = (Server*)calloc(1, sizeof(Server));
+    int status = 0;
+
+    if (server == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+    server->defaults = *options;
+    init_memory_cache(&server->pages, cache_limit);
+
+    /* A client closing its end early must not terminate the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (socket_path == NULL) {
+        serve_stream(server, stdin, stdout);
+    } else {
+        status = serve_socket(server, socket_path);
+    }
+
+    for (int i = 0; i < PROGRAM_CACHE_SIZE; i++) {
+        free_tree(server->cache[i].tree);
+        free_program(server->cache[i].program);
+    }
+    free_memory_cache(&server->pages);
+    free(server);
+    return status;
+}
@@ -0,0 +1,42 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stddef.h>
+#include "post_script.h"
+
+/**
+ * @brief Number of compiled expressions kept for reuse across requests.
+ */
+#define PROGRAM_CACHE_SIZE 64
+
+/**
+ * @brief Serves plot requests until the input ends or a client sends SHUTDOWN.
+ *
+ * Every request is one line: optional rendering options followed by a
+ * function, an output target and optionally a range (see split_job_line()):
+ *
+ *     --simplify 0.1 sin(x) * x - -5:5:-20:20
+ *
+ * With "-" as the output target the PostScript is returned inline as
+ * "OK <length>" followed by exactly that many bytes; otherwise it is written
+ * to the given path and the reply is "OK". Failures are answered with
+ * "ERROR <code> <message>", using the exit codes of the command line. The
+ * line QUIT ends the current connection and SHUTDOWN stops the server.
+ *
+ * Compiled expressions are kept in an LRU cache of PROGRAM_CACHE_SIZE
+ * entries keyed by the cleaned function and x range, so repeated requests
+ * skip parsing, simplification and compilation. Rendered pages are kept in
+ * an in-memory LRU cache keyed by make_render_key(), so a request for a page
+ * rendered before skips sampling and formatting as well.
+ *
+ * @param[in] socket_path Path of the Unix domain socket to listen on, or NULL
+ *            to serve a single session over stdin and stdout. Connections on
+ *            the socket are served one at a time.
+ * @param[in] options Default rendering options; requests may override them.
+ * @param[in] cache_limit Bytes of rendered pages to keep, 0 to disable the page cache.
+ * @return int Returns 0 when the server stops normally, 3 if the socket
+ *         cannot be set up.
+ */
+int run_server(const char *socket_path, const RenderOptions *options, size_t cache_limit);
+
+#endif /* SERVE_H */
@@ -0,0 +1,447 @@
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simplify.h"
+#include "utils.h"
+
+#define PI 3.14159265358979323846
+#define MAX_HORNER_DEGREE 8     /* Highest polynomial degree tracked for Horner form */
+#define MAX_CHAIN_EXPONENT 8    /* Highest integer power expanded into multiplications */
+#define SAFE_BOUND 1e300        /* Magnitude below which polynomial arithmetic cannot overflow */
+#define CALL_COST 8             /* Cost of pow() or a library function relative to + or * */
+
+/* Polynomial in 'x' with coefficients in ascending order of power */
+typedef struct {
+    double coef[MAX_HORNER_DEGREE + 1];
+    int degree;
+} Polynomial;
+
+/* What the pass knows about one node of the input tree */
+typedef struct {
+    NodeId id;          /* Node in the simplified tree */
+    NodeId horner;      /* Horner form of the node, NO_NODE if not decided yet */
+    double bound;       /* Upper bound of |value| whenever the value is not NaN */
+    int cost;           /* Estimated evaluation cost of the simplified subtree */
+    int depends_on_x;   /* Nonzero if the value depends on 'x' */
+    int is_polynomial;  /* Nonzero if the node is an exact, never-NaN polynomial */
+} NodeInfo;
+
+/* State of one simplification run */
+typedef struct {
+    const ExprTree *tree;   /* Input tree */
+    ExprTree *out;          /* Simplified tree being built */
+    NodeInfo *info;         /* Per-node facts, indexed by input NodeId */
+    Polynomial *poly;       /* Polynomial forms, indexed by input NodeId */
+    NodeId var;             /* Shared 'x' node of the output tree */
+    double x_bound;         /* Largest |x| the tree will be evaluated at */
+    int failed;             /* Set when a node allocation failed */
+} Simplifier;
+
+/*
+ * Records a failed node allocation.
+ */
+static NodeId checked(Simplifier *s, NodeId id) {
+    if (id == NO_NODE) s->failed = 1;
+    return id;
+}
+
+/*
+ * Returns nonzero if the output node is a constant, storing its value.
+ */
+static int const_value(const ExprTree *tree, NodeId id, double *value) {
+    if (id == NO_NODE || tree->nodes[id].type != CONST) return 0;
+    *value = tree->nodes[id].data.value;
+    return 1;
+}
+
+/*
+ * Returns nonzero if the output node is the given constant.
+ */
+static int is_const(const ExprTree *tree, NodeId id, double value) {
+    double c;
+    return const_value(tree, id, &c) && c == value;
+}
+
+/*
+ * Bound of |f(a)| for any finite a with |a| <= arg_bound.
+ */
+static double function_bound(FunctionId function, double arg_bound) {
+    switch (function) {
+        case FUNC_SIN:
+        case FUNC_COS:
+        case FUNC_TANH: return 1.0;
+        case FUNC_ASIN:
+        case FUNC_ATAN: return PI / 2;
+        case FUNC_ACOS: return PI;
+        case FUNC_TAN: return DBL_MAX;
+        case FUNC_LN: return 745.2;
+        case FUNC_LOG: return 323.7;
+        case FUNC_EXP: return exp(arg_bound);
+        case FUNC_SINH: return sinh(arg_bound);
+        case FUNC_COSH: return cosh(arg_bound);
+        case FUNC_ABS: return arg_bound;
+        default: return 0.0;
+    }
+}
+
+/*
+ * Bound of |left op right| given the bounds of both operands.
+ */
+static double operator_bound(char operator, double left, double right, const ExprTree *out, NodeId right_id) {
+    double bound, divisor;
+
+    switch (operator) {
+        case '+':
+        case '-': bound = left + right; break;
+        case '*': bound = left * right; break;
+        case '/':
+            if (const_value(out, right_id, &divisor) && fabs(divisor) >= MIN_DIVISOR) {
+                bound = left / fabs(divisor);
+            } else {
+                bound = left * 1e10;
+            }
+            break;
+        case '^':
+            if (const_value(out, right_id, &divisor) && divisor >= 0 && floor(divisor) == divisor) {
+                bound = fmin(pow(left, divisor), MAX_VALUE);
+            } else {
+                bound = MAX_VALUE;
+            }
+            break;
+        default: bound = 0.0; break;
+    }
+    return isnan(bound) ? HUGE_VAL : bound;
+}
+
+/*
+ * Drops leading zero coefficients.
+ */
+static void trim_polynomial(Polynomial *p) {
+    while (p->degree > 0 && p->coef[p->degree] == 0) p->degree--;
+}
+
+/*
+ * Multiplies two polynomials, failing if the degree would exceed the limit.
+ */
+static int multiply_polynomials(const Polynomial *a, const Polynomial *b, Polynomial *result) {
+    Polynomial product;
+    if (a->degree + b->degree > MAX_HORNER_DEGREE) return 0;
+
+    memset(&product, 0, sizeof(product));
+    product.degree = a->degree + b->degree;
+    for (int i = 0; i <= a->degree; i++) {
+        for (int j = 0; j <= b->degree; j++) {
+            product.coef[i + j] += a->coef[i] * b->coef[j];
+        }
+    }
+    trim_polynomial(&product);
+    *result = product;
+    return 1;
+}
+
+/*
+ * Derives the polynomial form of an operator node from its operands, if the
+ * node is a polynomial that can never overflow or produce NaN.
+ */
+static int operator_polynomial(Simplifier *s, char operator, NodeId left, NodeId right, double bound, Polynomial *result) {
+    const NodeInfo *l = &s->info[left], *r = &s->info[right];
+    const Polynomial *a = &s->poly[left], *b = &s->poly[right];
+    double c;
+
+    if (!l->is_polynomial || !r->is_polynomial || !(bound < SAFE_BOUND)) return 0;
+
+    switch (operator) {
+        case '+':
+        case '-': {
+            Polynomial sum;
+            memset(&sum, 0, sizeof(sum));
+            sum.degree = a->degree > b->degree ? a->degree : b->degree;
+            for (int i = 0; i <= sum.degree; i++) {
+                double ai = i <= a->degree ? a->coef[i] : 0.0;
+                double bi = i <= b->degree ? b->coef[i] : 0.0;
+                sum.coef[i] = operator == '+' ? ai + bi : ai - bi;
+            }
+            trim_polynomial(&sum);
+            *result = sum;
+            return 1;
+        }
+        case '*':
+            return multiply_polynomials(a, b, result);
+        case '/':
+            if (!const_value(s->out, r->id, &c) || fabs(c) < MIN_DIVISOR) return 0;
+            *result = *a;
+            for (int i = 0; i <= result->degree; i++) result->coef[i] /= c;
+            return 1;
+        case '^': {
+            Polynomial power;
+            if (!const_value(s->out, r->id, &c) || c < 0 || floor(c) != c) return 0;
+            if (c * a->degree > MAX_HORNER_DEGREE) return 0;
+            if (!(pow(l->bound, c) < MAX_VALUE * (1 - 1e-9))) return 0;
+
+            memset(&power, 0, sizeof(power));
+            power.coef[0] = 1.0;
+            for (int i = 0; i < (int)c; i++) {
+                if (!multiply_polynomials(&power, a, &power)) return 0;
+            }
+            *result = power;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the Horner form of a polynomial node if it is cheaper than the
+ * node's simplified subtree, otherwise the subtree itself.
+ */
+static NodeId horner_form(Simplifier *s, NodeId id) {
+    NodeInfo *info = &s->info[id];
+    const Polynomial *p = &s->poly[id];
+
+    if (!info->is_polynomial || !info->depends_on_x) return info->id;
+    if (info->horner != NO_NODE) return info->horner;
+    info->horner = info->id;
+
+    int cost = 0;
+    double bound = 0.0;
+    for (int k = p->degree; k >= 0; k--) {
+        bound += fabs(p->coef[k]) * pow(s->x_bound, k);
+        if (k < p->degree && p->coef[k] != 0) cost++;
+        if (k > 0 && !(k == p->degree && p->coef[k] == 1)) cost++;
+    }
+    if (cost >= info->cost || !(bound < SAFE_BOUND)) return info->id;
+
+    NodeId h;
+    if (p->degree == 0) {
+        h = checked(s, create_const_node(s->out, p->coef[0]));
+    } else {
+        h = NO_NODE;
+        for (int k = p->degree - 1; k >= 0; k--) {
+            if (h != NO_NODE) {
+                h = checked(s, create_operator_node(s->out, '*', h, s->var));
+            } else if (p->coef[p->degree] == 1) {
+                h = s->var;
+            } else {
+                NodeId lead = checked(s, create_const_node(s->out, p->coef[p->degree]));
+                h = checked(s, create_operator_node(s->out, '*', lead, s->var));
+            }
+            if (p->coef[k] != 0) {
+                NodeId coef = checked(s, create_const_node(s->out, p->coef[k]));
+                h = checked(s, create_operator_node(s->out, '+', h, coef));
+            }
+        }
+    }
+
+    info->horner = h;
+    return h;
+}
+
+/*
+ * Sets the info of a node that always evaluates to the given constant.
+ */
+static void make_const(Simplifier *s, NodeInfo *info, double value) {
+    info->id = checked(s, create_const_node(s->out, value));
+    info->bound = isinf(value) ? HUGE_VAL : (isnan(value) ? 0.0 : fabs(value));
+    info->depends_on_x = 0;
+    info->cost = 0;
+}
+
+/*
+ * Simplifies an operator node whose operands have already been simplified.
+ */
+static void simplify_operator(Simplifier *s, NodeId id) {
+    const Node *node = &s->tree->nodes[id];
+    NodeInfo *info = &s->info[id];
+    NodeId left = node->data.child.left, right = node->data.child.right;
+    char operator = (char)node->op;
+    double lc = 0.0, rc = 0.0;
+
+    if (left == NO_NODE || right == NO_NODE || strchr("+-*/^", operator) == NULL || operator == '\0') {
+        make_const(s, info, create_nan());
+        return;
+    }
+
+    const NodeInfo *l = &s->info[left], *r = &s->info[right];
+    int left_const = const_value(s->out, l->id, &lc);
+    int right_const = const_value(s->out, r->id, &rc);
+
+    /* Subtrees that do not depend on x fold to their value */
+    if (!l->depends_on_x && !r->depends_on_x && left_const && right_const) {
+        make_const(s, info, apply_operator(operator, lc, rc));
+        s->poly[id].degree = 0;
+        s->poly[id].coef[0] = info->id != NO_NODE ? s->out->nodes[info->id].data.value : 0.0;
+        info->is_polynomial = isfinite(s->poly[id].coef[0]);
+        return;
+    }
+
+    /* Double negation: -1 * (-1 * f) is f whenever f cannot be infinite */
+    const Node *inner = &s->tree->nodes[right];
+    if (operator == '*' && left_const && lc == -1 && inner->type == OPERATOR && inner->op == '*') {
+        double inner_const;
+        NodeId f = inner->data.child.right;
+        if (f != NO_NODE && const_value(s->out, s->info[inner->data.child.left].id, &inner_const) &&
+            inner_const == -1 && s->info[f].bound <= DBL_MAX) {
+            *info = s->info[f];
+            s->poly[id] = s->poly[f];
+            return;
+        }
+    }
+
+    /* Identities that return an operand which can never be infinite */
+    int keep_left = l->bound <= DBL_MAX &&
+                    ((operator == '*' && is_const(s->out, r->id, 1)) ||
+                     (operator == '/' && is_const(s->out, r->id, 1)) ||
+                     ((operator == '+' || operator == '-') && is_const(s->out, r->id, 0)));
+    int keep_right = r->bound <= DBL_MAX &&
+                     ((operator == '*' && is_const(s->out, l->id, 1)) ||
+                      (operator == '+' && is_const(s->out, l->id, 0)));
+    if (operator == '^' && is_const(s->out, r->id, 1) && l->bound < MAX_VALUE * (1 - 1e-9)) {
+        keep_left = 1;
+    }
+    if (keep_left || keep_right) {
+        NodeId kept = keep_left ? left : right;
+        *info = s->info[kept];
+        s->poly[id] = s->poly[kept];
+        return;
+    }
+
+    info->bound = operator_bound(operator, l->bound, r->bound, s->out, r->id);
+    info->depends_on_x = 1;
+    info->is_polynomial = operator_polynomial(s, operator, left, right, info->bound, &s->poly[id]);
+
+    /* Operands of a non-polynomial node are final, so use their Horner form */
+    NodeId left_id = info->is_polynomial ? l->id : horner_form(s, left);
+    NodeId right_id = info->is_polynomial ? r->id : horner_form(s, right);
+    l = &s->info[left];
+    r = &s->info[right];
+
+    /*
+     * Small integer powers become products of repeated squares. The squares
+     * are shared nodes, which the compiled program evaluates only once.
+     */
+    if (operator == '^' && right_const && rc >= 2 && rc <= MAX_CHAIN_EXPONENT && floor(rc) == rc &&
+        pow(l->bound, rc) < MAX_VALUE * (1 - 1e-9)) {
+        NodeId chain = NO_NODE, square = left_id;
+        int multiplications = 0;
+        for (int exponent = (int)rc; exponent > 0 && !s->failed; exponent >>= 1) {
+            if (exponent & 1) {
+                if (chain != NO_NODE) multiplications++;
+                chain = chain == NO_NODE ? square : checked(s, create_operator_node(s->out, '*', chain, square));
+            }
+            if (exponent > 1) {
+                square = checked(s, create_operator_node(s->out, '*', square, square));
+                multiplications++;
+            }
+        }
+        info->id = chain;
+        info->cost = l->cost + multiplications;
+        return;
+    }
+
+    info->id = checked(s, create_operator_node(s->out, operator, left_id, right_id));
+    info->cost = l->cost + r->cost + (operator == '^' ? CALL_COST : 1);
+}
+
+/*
+ * Simplifies a function node whose argument has already been simplified.
+ */
+static void simplify_function(Simplifier *s, NodeId id) {
+    const Node *node = &s->tree->nodes[id];
+    NodeInfo *info = &s->info[id];
+    NodeId argument = node->data.child.left;
+    FunctionId function = (FunctionId)node->op;
+    double value;
+
+    if (argument == NO_NODE || function >= FUNC_UNKNOWN) {
+        make_const(s, info, create_nan());
+        return;
+    }
+
+    const NodeInfo *a = &s->info[argument];
+    if (!a->depends_on_x && const_value(s->out, a->id, &value)) {
+        make_const(s, info, apply_function(function, value));
+        s->poly[id].degree = 0;
+        s->poly[id].coef[0] = info->id != NO_NODE ? s->out->nodes[info->id].data.value : 0.0;
+        info->is_polynomial = isfinite(s->poly[id].coef[0]);
+        return;
+    }
+
+    NodeId argument_id = horner_form(s, argument);
+    a = &s->info[argument];
+    info->id = checked(s, create_function_node(s->out, function, argument_id));
+    info->bound = function_bound(function, a->bound);
+    info->depends_on_x = 1;
+    info->cost = a->cost + CALL_COST;
+}
+
+/*
+ * Simplifies every live node in index order, so operands are always done
+ * before the nodes that use them.
+ */
+ExprTree* simplify_tree(const ExprTree *tree, double x_min, double x_max) {
+    Simplifier s;
+    unsigned char *live = mark_live_nodes(tree);
+
+    memset(&s, 0, sizeof(s));
+    s.tree = tree;
+    s.out = create_tree(tree->count);
+    s.info = (NodeInfo*)malloc((tree->count ? tree->count : 1) * sizeof(NodeInfo));
+    s.poly = (Polynomial*)malloc((tree->count ? tree->count : 1) * sizeof(Polynomial));
+    s.x_bound = fmax(fabs(x_min), fabs(x_max));
+    if (isnan(s.x_bound)) s.x_bound = HUGE_VAL;
+    s.var = s.out ? create_var_node(s.out) : NO_NODE;
+
+    if (live == NULL || s.out == NULL || s.info == NULL || s.poly == NULL || s.var == NO_NODE) {
+        s.failed = 1;
+    }
+
+    for (NodeId i = 0; !s.failed && i < tree->count; i++) {
+        if (!live[i]) continue;
+        const Node *node = &tree->nodes[i];
+        NodeInfo *info = &s.info[i];
+
+        info->horner = NO_NODE;
+        info->is_polynomial = 0;
+        switch (node->type) {
+            case CONST:
+                make_const(&s, info, node->data.value);
+                s.poly[i].degree = 0;
+                s.poly[i].coef[0] = node->data.value;
+                info->is_polynomial = isfinite(node->data.value);
+                break;
+            case VAR:
+                info->id = s.var;
+                info->bound = s.x_bound;
+                info->depends_on_x = 1;
+                info->cost = 0;
+                memset(&s.poly[i], 0, sizeof(Polynomial));
+                s.poly[i].degree = 1;
+                s.poly[i].coef[1] = 1.0;
+                info->is_polynomial = 1;
+                break;
+            case OPERATOR:
+                simplify_operator(&s, i);
+                break;
+            default:
+                simplify_function(&s, i);
+                break;
+        }
+    }
+
+    if (!s.failed && tree->root != NO_NODE) {
+        s.out->root = horner_form(&s, tree->root);
+    }
+    if (!s.failed && !prune_tree(s.out)) {
+        s.failed = 1;
+    }
+
+    free(live);
+    free(s.info);
+    free(s.poly);
+    if (s.failed) {
+        free_tree(s.out);
+        return NULL;
+    }
+    return s.out;
+}
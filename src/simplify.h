@@ -0,0 +1,26 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "parser.h"
+
+/**
+ * @brief Builds a simplified copy of an expression tree.
+ *
+ * The pass folds subtrees that do not depend on 'x' into constants, removes
+ * identities (x*1, x+0, x-0, x/1, x^1 and double negation), replaces small
+ * integer powers with multiplications of shared squares and rewrites polynomial
+ * subtrees into Horner form when that needs fewer operations.
+ *
+ * Rewrites that could change which samples evaluate to NaN are only applied
+ * when magnitude bounds derived from the x range prove they cannot, e.g. a
+ * power is only expanded when it can never reach MAX_VALUE. Results may still
+ * differ from the original tree in the last bits due to rounding.
+ *
+ * @param[in] tree Pointer to the parsed expression tree.
+ * @param[in] x_min The smallest 'x' the simplified tree will be evaluated at.
+ * @param[in] x_max The largest 'x' the simplified tree will be evaluated at.
+ * @return ExprTree* Returns the simplified tree, or NULL if memory allocation failed.
+ */
+ExprTree* simplify_tree(const ExprTree *tree, double x_min, double x_max);
+
+#endif /* SIMPLIFY_H */
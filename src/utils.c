@@ -1,20 +1,7 @@
+#define _POSIX_C_SOURCE 199309L
 #include "utils.h"
-#include <ctype.h>
 #include <string.h>
-
-/* 
- * Removes all whitespace characters from the source string and 
- * copies the result into the destination string.
- */
-void remove_whitespace(char* dest, const char* src) {
-    while (*src != '\0') {
-        if (!isspace((unsigned char)*src)) {
-            *dest++ = *src;
-        }
-        src++;
-    }
-    *dest = '\0';
-}
+#include <time.h>
 
 /* 
  * Creates a Not-a-Number (NaN) value.
@@ -36,3 +23,10 @@ int is_nan(double x) {
     memcpy(&bits, &x, sizeof(bits));
     return (bits & 0x7FF0000000000000) == 0x7FF0000000000000 && (bits & 0x000FFFFFFFFFFFFF) != 0;
 }
+
+/* Seconds on the monotonic clock */
+double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
@@ -1,17 +1,6 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-/**
- * @brief Removes all whitespace characters from a source string.
- * 
- * Copies the input string `src` into the output buffer `dest` while removing
- * all whitespace characters. The resulting string in `dest` is null-terminated.
- * 
- * @param[out] dest The destination buffer to store the string without whitespace.
- * @param[in] src The input string to process.
- */
-void remove_whitespace(char* dest, const char* src);
-
 /**
  * @brief Creates a Not-a-Number (NaN) value.
  * 
@@ -33,4 +22,14 @@ double create_nan();
  */
 int is_nan(double x);
 
+/**
+ * @brief Reads the monotonic clock.
+ * 
+ * Only differences between readings are meaningful; the clock is not
+ * affected by changes of the system time.
+ * 
+ * @return double Returns the time in seconds since an arbitrary start.
+ */
+double monotonic_seconds(void);
+
 #endif /* UTILS_H */